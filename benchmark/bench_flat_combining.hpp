@@ -0,0 +1,131 @@
+#ifndef YGG_BENCH_FLAT_COMBINING_HPP
+#define YGG_BENCH_FLAT_COMBINING_HPP
+
+#include <celero/Celero.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../src/ygg.hpp"
+#include "../src/flat_combining.hpp"
+
+using namespace ygg;
+
+constexpr size_t FC_BENCH_OPS_PER_THREAD = 20000;
+
+/*
+ * The experiment value is the number of threads hammering the tree. Every thread inserts
+ * its share of the nodes and removes them again.
+ */
+class ContendedTreeBaseFixture : public celero::TestFixture {
+public:
+	class Node : public RBTreeNodeBase<Node, TreeOptions<>>
+	{
+	public:
+		int value;
+
+		bool operator<(const Node & rhs) const {
+			return this->value < rhs.value;
+		}
+	};
+
+	virtual std::vector<std::pair<int64_t, uint64_t>> getExperimentValues() const override
+	{
+		std::vector<std::pair<int64_t, uint64_t>> thread_counts;
+		for (int64_t threads = 1 ; threads <= 16 ; threads *= 2) {
+			thread_counts.emplace_back(threads, 0u);
+		}
+		return thread_counts;
+	};
+
+	virtual void setUp(const int64_t thread_count_in) override
+	{
+		this->thread_count = static_cast<size_t>(thread_count_in);
+		this->nodes.resize(this->thread_count * FC_BENCH_OPS_PER_THREAD);
+
+		// Distinct values, so that every insert succeeds and every remove is valid
+		std::vector<int> values(this->nodes.size());
+		for (size_t i = 0 ; i < values.size() ; ++i) {
+			values[i] = static_cast<int>(i);
+		}
+		std::random_shuffle(values.begin(), values.end());
+
+		for (size_t i = 0 ; i < this->nodes.size() ; ++i) {
+			this->nodes[i].value = values[i];
+		}
+	}
+
+	virtual void tearDown() override
+	{
+		this->nodes.clear();
+	}
+
+	template<class ThreadBody>
+	void run_threads(ThreadBody body)
+	{
+		std::vector<std::thread> threads;
+		for (size_t t = 0 ; t < this->thread_count ; ++t) {
+			threads.emplace_back(body, t);
+		}
+		for (auto & thread : threads) {
+			thread.join();
+		}
+	}
+
+	size_t thread_count;
+	std::vector<Node> nodes;
+};
+
+class MutexTreeFixture : public ContendedTreeBaseFixture {
+public:
+	using Tree = RBTree<Node, RBDefaultNodeTraits<Node>, TreeOptions<>>;
+
+	std::mutex m;
+	Tree t;
+};
+
+class FlatCombiningTreeFixture : public ContendedTreeBaseFixture {
+public:
+	// Slots can not be unregistered, so every run constructs a fresh instance of this
+	using Tree = FlatCombiningRBTree<Node, RBDefaultNodeTraits<Node>, TreeOptions<>>;
+};
+
+BASELINE_F(ContendedTree, Mutex, MutexTreeFixture, 10, 1)
+{
+	this->run_threads([&](size_t thread) {
+		Node * begin = this->nodes.data() + thread * FC_BENCH_OPS_PER_THREAD;
+
+		for (size_t i = 0 ; i < FC_BENCH_OPS_PER_THREAD ; ++i) {
+			std::lock_guard<std::mutex> guard(this->m);
+			this->t.insert(begin[i]);
+		}
+		for (size_t i = 0 ; i < FC_BENCH_OPS_PER_THREAD ; ++i) {
+			std::lock_guard<std::mutex> guard(this->m);
+			this->t.remove(begin[i]);
+		}
+	});
+
+	celero::DoNotOptimizeAway(this->t);
+}
+
+BENCHMARK_F(ContendedTree, FlatCombining, FlatCombiningTreeFixture, 10, 1)
+{
+	Tree t;
+
+	this->run_threads([&](size_t thread) {
+		size_t slot = t.register_thread();
+		Node * begin = this->nodes.data() + thread * FC_BENCH_OPS_PER_THREAD;
+
+		for (size_t i = 0 ; i < FC_BENCH_OPS_PER_THREAD ; ++i) {
+			t.insert(slot, begin[i]);
+		}
+		for (size_t i = 0 ; i < FC_BENCH_OPS_PER_THREAD ; ++i) {
+			t.remove(slot, begin[i]);
+		}
+	});
+
+	celero::DoNotOptimizeAway(t);
+}
+
+#endif //YGG_BENCH_FLAT_COMBINING_HPP
@@ -0,0 +1,125 @@
+#ifndef YGG_BENCH_INTERVALTREE_HPP
+#define YGG_BENCH_INTERVALTREE_HPP
+
+#include <celero/Celero.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../src/ygg.hpp"
+
+using namespace ygg;
+
+constexpr size_t ITREE_BENCH_LOOKUPS = 1000;
+
+/*
+ * IP-to-lease lookups: Every node is a lease of a block of IPv4 addresses. Blocks are small and
+ * mostly disjoint. Every iteration looks up the leases containing a batch of random addresses.
+ * The experiment value is the number of leases.
+ */
+class LeaseFixture : public celero::TestFixture {
+public:
+	template<class Node>
+	class LeaseTraits : public ITreeNodeTraits<Node> {
+	public:
+		using key_type = uint32_t;
+
+		static uint32_t get_lower(const Node & lease) {
+			return lease.first_ip;
+		}
+
+		static uint32_t get_upper(const Node & lease) {
+			return lease.last_ip;
+		}
+	};
+
+	class Lease : public ITreeNodeBase<Lease, LeaseTraits<Lease>> {
+	public:
+		uint32_t first_ip;
+		uint32_t last_ip;
+
+		Lease() : first_ip(0), last_ip(0) {};
+		Lease(uint32_t first_ip_in, uint32_t last_ip_in)
+			: first_ip(first_ip_in), last_ip(last_ip_in) {};
+	};
+
+	using Tree = IntervalTree<Lease, LeaseTraits<Lease>>;
+
+	virtual std::vector<std::pair<int64_t, uint64_t>> getExperimentValues() const override
+	{
+		std::vector<std::pair<int64_t, uint64_t>> lease_counts;
+		for (int64_t exponent = 10 ; exponent <= 20 ; exponent += 2) {
+			lease_counts.emplace_back(static_cast<int64_t>(1) << exponent, 0u);
+		}
+		return lease_counts;
+	};
+
+	virtual void setUp(const int64_t lease_count) override
+	{
+		std::mt19937 rng(4);
+		// Place the leases in a /8, so that a good share of the lookups hits something
+		std::uniform_int_distribution<uint32_t> ip_distr(0x0A000000u, 0x0AFFFFFFu);
+		std::uniform_int_distribution<uint32_t> block_distr(0, 255);
+
+		this->leases.resize(static_cast<size_t>(lease_count));
+		for (auto & lease : this->leases) {
+			uint32_t first = ip_distr(rng);
+			lease = Lease(first, first + block_distr(rng));
+			this->t.insert(lease);
+		}
+
+		this->lookups.resize(ITREE_BENCH_LOOKUPS);
+		for (auto & ip : this->lookups) {
+			ip = ip_distr(rng);
+		}
+	}
+
+	virtual void tearDown() override
+	{
+		this->t.clear();
+		this->leases.clear();
+		this->lookups.clear();
+	}
+
+	std::vector<Lease> leases;
+	std::vector<uint32_t> lookups;
+	Tree t;
+};
+
+BASELINE_F(ITreeLeaseLookup, RangeQuery, LeaseFixture, 30, 50)
+{
+	size_t hits = 0;
+	for (uint32_t ip : this->lookups) {
+		for (const auto & lease : this->t.query(Lease(ip, ip))) {
+			celero::DoNotOptimizeAway(lease.first_ip);
+			hits++;
+		}
+	}
+	celero::DoNotOptimizeAway(hits);
+}
+
+BENCHMARK_F(ITreeLeaseLookup, PointQuery, LeaseFixture, 30, 50)
+{
+	size_t hits = 0;
+	for (uint32_t ip : this->lookups) {
+		for (const auto & lease : this->t.query_point(ip)) {
+			celero::DoNotOptimizeAway(lease.first_ip);
+			hits++;
+		}
+	}
+	celero::DoNotOptimizeAway(hits);
+}
+
+BENCHMARK_F(ITreeLeaseLookup, PointVisitor, LeaseFixture, 30, 50)
+{
+	size_t hits = 0;
+	for (uint32_t ip : this->lookups) {
+		this->t.query_point(ip, [&](const Lease & lease) {
+			celero::DoNotOptimizeAway(lease.first_ip);
+			hits++;
+		});
+	}
+	celero::DoNotOptimizeAway(hits);
+}
+
+#endif // YGG_BENCH_INTERVALTREE_HPP
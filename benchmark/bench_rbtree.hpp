@@ -7,6 +7,9 @@
 
 #include <celero/Celero.h>
 #include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
 
 #include "../src/ygg.hpp"
 #include <boost/intrusive/set.hpp>
@@ -474,6 +477,55 @@ BENCHMARK_F(RBTreeIteration, BoostMultiSet, BoostMultiSetSearchFixture, 50, 200)
 	}
 }
 
+BENCHMARK_F(RBTreeIteration, ScanYgg, YggTreeSearchFixture, 50, 200)
+{
+	for (auto it = this->t.scan_begin() ; it != this->t.scan_end() ; ++it) {
+		celero::DoNotOptimizeAway(*it);
+	}
+}
+
+/*
+ * Long scans over trees that are much larger than the caches. The nodes are linked in random
+ * order, so that the successor of a node is usually not in the cache.
+ */
+class YggLongScanFixture : public YggMultiTreeSearchFixture {
+public:
+	YggLongScanFixture()
+	{
+		this->instance_sizes.clear();
+		for (size_t exponent = 20 ; exponent <= 24 ; exponent += 2) {
+			this->instance_sizes.emplace_back(static_cast<int64_t>(1) << exponent, 0u);
+		}
+	}
+};
+
+BASELINE_F(RBTreeLongScan, Iterator, YggLongScanFixture, 3, 5)
+{
+	int64_t sum = 0;
+	for (const auto & n : this->t) {
+		sum += n.value;
+	}
+	celero::DoNotOptimizeAway(sum);
+}
+
+BENCHMARK_F(RBTreeLongScan, ScanIterator, YggLongScanFixture, 3, 5)
+{
+	int64_t sum = 0;
+	for (auto it = this->t.scan_begin() ; it != this->t.scan_end() ; ++it) {
+		sum += it->value;
+	}
+	celero::DoNotOptimizeAway(sum);
+}
+
+BENCHMARK_F(RBTreeLongScan, ScanIterator16, YggLongScanFixture, 3, 5)
+{
+	int64_t sum = 0;
+	for (auto it = this->t.scan_begin<16>() ; it != this->t.scan_end<16>() ; ++it) {
+		sum += it->value;
+	}
+	celero::DoNotOptimizeAway(sum);
+}
+
 /*
  * Deletion
  */
@@ -514,4 +566,219 @@ BENCHMARK_F(RBTreeDelete, BoostMultiSet, BoostMultiSetSearchFixture, 1000, 1)
 	celero::DoNotOptimizeAway(this->t);
 }
 
+/*
+ * Comparator cost: string keys with a boolean vs. a three-way comparator. Besides the running
+ * time, the number of comparator calls per operation is collected and printed at exit.
+ */
+class ComparisonReport {
+public:
+	~ComparisonReport()
+	{
+		std::cout << "\nComparator calls per operation (insert + find):\n";
+		for (const auto & entry : this->calls) {
+			std::cout << "  " << entry.first.first << " @ " << entry.first.second << ": "
+			          << static_cast<double>(entry.second.second) /
+			             static_cast<double>(entry.second.first) << "\n";
+		}
+	}
+
+	void add(const std::string & name, int64_t size, size_t operations, size_t comparisons)
+	{
+		auto & entry = this->calls[{name, size}];
+		entry.first += operations;
+		entry.second += comparisons;
+	}
+
+private:
+	// (name, size) -> (operations, comparisons)
+	std::map<std::pair<std::string, int64_t>, std::pair<size_t, size_t>> calls;
+};
+
+inline ComparisonReport & get_comparison_report()
+{
+	static ComparisonReport report;
+	return report;
+}
+
+class StringKeyNode : public RBTreeNodeBase<StringKeyNode, TreeOptions<TreeFlags::STATISTICS>>
+{
+public:
+	std::string key;
+};
+
+class BooleanStringCompare {
+public:
+	bool operator()(const StringKeyNode & lhs, const StringKeyNode & rhs) const {
+		return lhs.key < rhs.key;
+	}
+};
+
+class ThreeWayStringCompare {
+public:
+	int operator()(const StringKeyNode & lhs, const StringKeyNode & rhs) const {
+		return lhs.key.compare(rhs.key);
+	}
+};
+
+template<class Compare>
+class StringKeyFixture : public RBTreeBaseFixture<true> {
+public:
+	using Tree = RBTree<StringKeyNode, RBDefaultNodeTraits<StringKeyNode>,
+	                    TreeOptions<TreeFlags::STATISTICS>, int, Compare>;
+
+	virtual void setUp(const int64_t number_of_nodes) override
+	{
+		this->RBTreeBaseFixture<true>::setUp(number_of_nodes);
+
+		// Long common prefixes make every comparison expensive
+		this->nodes.resize((size_t)number_of_nodes);
+		for (size_t i = 0 ; i < (size_t)number_of_nodes ; ++i) {
+			this->nodes[i].key = std::string("ygg/benchmark/key/") + std::to_string(this->values[i]);
+		}
+
+		this->t.reset_statistics();
+		this->operations = 0;
+	}
+
+	virtual void tearDown() override
+	{
+		TreeStatistics stats = this->t.reset_statistics();
+		get_comparison_report().add(this->name(), this->value_count, this->operations,
+		                            stats.comparisons);
+
+		this->RBTreeBaseFixture<true>::tearDown();
+		this->nodes.clear();
+	}
+
+	virtual const char * name() const = 0;
+
+	std::vector<StringKeyNode> nodes;
+	Tree t;
+	size_t operations;
+};
+
+class BooleanStringKeyFixture : public StringKeyFixture<BooleanStringCompare> {
+public:
+	virtual const char * name() const override { return "Boolean"; }
+};
+
+class ThreeWayStringKeyFixture : public StringKeyFixture<ThreeWayStringCompare> {
+public:
+	virtual const char * name() const override { return "ThreeWay"; }
+};
+
+BASELINE_F(RBTreeStringKeys, Boolean, BooleanStringKeyFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	for (auto & n : this->nodes) {
+		celero::DoNotOptimizeAway(this->t.find(n));
+	}
+	this->operations += 2 * this->nodes.size();
+	celero::DoNotOptimizeAway(this->t);
+}
+
+BENCHMARK_F(RBTreeStringKeys, ThreeWay, ThreeWayStringKeyFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	for (auto & n : this->nodes) {
+		celero::DoNotOptimizeAway(this->t.find(n));
+	}
+	this->operations += 2 * this->nodes.size();
+	celero::DoNotOptimizeAway(this->t);
+}
+
+/*
+ * Bottom-up vs. top-down (TreeFlags::TOP_DOWN) rebalancing during insertion
+ */
+template<class Options, bool distinct>
+class YggRebalancingFixture : public RBTreeBaseFixture<distinct> {
+public:
+	class Node : public RBTreeNodeBase<Node, Options>
+	{
+	public:
+		int value;
+
+		bool operator<(const Node & rhs) const {
+			return this->value < rhs.value;
+		}
+	};
+
+	using Tree = RBTree<Node, RBDefaultNodeTraits<Node>, Options>;
+
+	virtual void setUp(const int64_t number_of_nodes) override
+	{
+		this->RBTreeBaseFixture<distinct>::setUp(number_of_nodes);
+
+		this->nodes.resize((size_t)number_of_nodes);
+		for (size_t i = 0 ; i < (size_t)number_of_nodes ; ++i) {
+			this->nodes[i].value = this->values[i];
+		}
+	}
+
+	virtual void tearDown() override
+	{
+		this->RBTreeBaseFixture<distinct>::tearDown();
+
+		this->t.clear();
+		this->nodes.clear();
+	}
+
+	std::vector<Node> nodes;
+	Tree t;
+};
+
+using BottomUpFixture = YggRebalancingFixture<TreeOptions<>, true>;
+using TopDownFixture = YggRebalancingFixture<TreeOptions<TreeFlags::TOP_DOWN>, true>;
+using MultiBottomUpFixture = YggRebalancingFixture<TreeOptions<TreeFlags::MULTIPLE>, false>;
+using MultiTopDownFixture = YggRebalancingFixture<TreeOptions<TreeFlags::MULTIPLE,
+                                                              TreeFlags::TOP_DOWN>, false>;
+
+BASELINE_F(RBTreeRebalancing, BottomUp, BottomUpFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	celero::DoNotOptimizeAway(this->t);
+}
+
+BENCHMARK_F(RBTreeRebalancing, TopDown, TopDownFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	celero::DoNotOptimizeAway(this->t);
+}
+
+BENCHMARK_F(RBTreeRebalancing, MultiBottomUp, MultiBottomUpFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	celero::DoNotOptimizeAway(this->t);
+}
+
+BENCHMARK_F(RBTreeRebalancing, MultiTopDown, MultiTopDownFixture, 30, 50)
+{
+	this->t.clear();
+
+	for (auto & n : this->nodes) {
+		this->t.insert(n);
+	}
+	celero::DoNotOptimizeAway(this->t);
+}
+
 #endif //YGG_BENCH_RBTREE_HPP
@@ -1,5 +1,7 @@
 #include <celero/Celero.h>
 
 #include "bench_rbtree.hpp"
+#include "bench_flat_combining.hpp"
+#include "bench_intervaltree.hpp"
 
 CELERO_MAIN
@@ -0,0 +1,237 @@
+#include "const_table.hpp"
+
+namespace ygg {
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr
+ConstTable<Key, Value, N, Compare>::ConstTable(const Entry (& entries)[N])
+{
+	Entry sorted[N] = {};
+	for (size_t i = 0 ; i < N ; ++i) {
+		sorted[i] = entries[i];
+	}
+	this->sort(sorted);
+
+	size_t next = 0;
+	this->lay_out(sorted, 0, next);
+}
+
+/*
+ * Heap sort, since it needs no additional memory and few steps in constant evaluation
+ */
+template<class Key, class Value, size_t N, class Compare>
+constexpr void
+ConstTable<Key, Value, N, Compare>::sort(Entry (& entries)[N])
+{
+	for (size_t i = N / 2 ; i > 0 ; --i) {
+		this->sift_down(entries, i - 1, N);
+	}
+
+	for (size_t end = N ; end > 1 ; --end) {
+		Entry tmp = entries[0];
+		entries[0] = entries[end - 1];
+		entries[end - 1] = tmp;
+		this->sift_down(entries, 0, end - 1);
+	}
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr void
+ConstTable<Key, Value, N, Compare>::sift_down(Entry (& entries)[N], size_t root, size_t end)
+{
+	while (2 * root + 1 < end) {
+		size_t child = 2 * root + 1;
+		if ((child + 1 < end) && this->cmp(entries[child].key, entries[child + 1].key)) {
+			child++;
+		}
+		if (!this->cmp(entries[root].key, entries[child].key)) {
+			return;
+		}
+		Entry tmp = entries[root];
+		entries[root] = entries[child];
+		entries[child] = tmp;
+		root = child;
+	}
+}
+
+/*
+ * Fills the subtree rooted at <index> of the Eytzinger layout in order, taking the entries from
+ * sorted[next] on.
+ */
+template<class Key, class Value, size_t N, class Compare>
+constexpr void
+ConstTable<Key, Value, N, Compare>::lay_out(const Entry (& sorted)[N], size_t index,
+                                            size_t & next)
+{
+	if (index >= N) {
+		return;
+	}
+	this->lay_out(sorted, 2 * index + 1, next);
+	this->layout[index] = sorted[next++];
+	this->lay_out(sorted, 2 * index + 2, next);
+}
+
+template<class Key, class Value, size_t N, class Compare>
+template<class Comparable>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::lower_bound(const Comparable & query) const
+{
+	size_t result = N;
+	size_t index = 0;
+	while (index < N) {
+		if (this->cmp(this->layout[index].key, query)) {
+			index = 2 * index + 2;
+		} else {
+			result = index;
+			index = 2 * index + 1;
+		}
+	}
+	return const_iterator(this->layout, result);
+}
+
+template<class Key, class Value, size_t N, class Compare>
+template<class Comparable>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::upper_bound(const Comparable & query) const
+{
+	size_t result = N;
+	size_t index = 0;
+	while (index < N) {
+		if (this->cmp(query, this->layout[index].key)) {
+			result = index;
+			index = 2 * index + 1;
+		} else {
+			index = 2 * index + 2;
+		}
+	}
+	return const_iterator(this->layout, result);
+}
+
+template<class Key, class Value, size_t N, class Compare>
+template<class Comparable>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::find(const Comparable & query) const
+{
+	const_iterator it = this->lower_bound(query);
+	if ((it.index < N) && !this->cmp(query, this->layout[it.index].key)) {
+		return it;
+	}
+	return this->end();
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::begin() const
+{
+	size_t index = 0;
+	while (2 * index + 1 < N) {
+		index = 2 * index + 1;
+	}
+	return const_iterator(this->layout, index);
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::end() const
+{
+	return const_iterator(this->layout, N);
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::cbegin() const
+{
+	return this->begin();
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::cend() const
+{
+	return this->end();
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr size_t
+ConstTable<Key, Value, N, Compare>::size() const
+{
+	return N;
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr bool
+ConstTable<Key, Value, N, Compare>::empty() const
+{
+	return false;
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator &
+ConstTable<Key, Value, N, Compare>::const_iterator::operator++()
+{
+	if (2 * this->index + 2 < N) {
+		// Smallest entry in the right subtree
+		this->index = 2 * this->index + 2;
+		while (2 * this->index + 1 < N) {
+			this->index = 2 * this->index + 1;
+		}
+		return *this;
+	}
+
+	// Go up until we come from a left child
+	while ((this->index > 0) && (this->index % 2 == 0)) {
+		this->index = (this->index - 1) / 2;
+	}
+	this->index = (this->index == 0) ? N : (this->index - 1) / 2;
+	return *this;
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::const_iterator::operator++(int)
+{
+	const_iterator old = *this;
+	++(*this);
+	return old;
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator &
+ConstTable<Key, Value, N, Compare>::const_iterator::operator--()
+{
+	if (this->index == N) {
+		// The largest entry
+		this->index = 0;
+		while (2 * this->index + 2 < N) {
+			this->index = 2 * this->index + 2;
+		}
+		return *this;
+	}
+
+	if (2 * this->index + 1 < N) {
+		// Largest entry in the left subtree
+		this->index = 2 * this->index + 1;
+		while (2 * this->index + 2 < N) {
+			this->index = 2 * this->index + 2;
+		}
+		return *this;
+	}
+
+	// Go up until we come from a right child. Decrementing begin() is undefined.
+	while (this->index % 2 == 1) {
+		this->index = (this->index - 1) / 2;
+	}
+	this->index = (this->index - 1) / 2;
+	return *this;
+}
+
+template<class Key, class Value, size_t N, class Compare>
+constexpr typename ConstTable<Key, Value, N, Compare>::const_iterator
+ConstTable<Key, Value, N, Compare>::const_iterator::operator--(int)
+{
+	const_iterator old = *this;
+	--(*this);
+	return old;
+}
+
+} // namespace ygg
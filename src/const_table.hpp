@@ -0,0 +1,175 @@
+#ifndef YGG_CONST_TABLE_HPP
+#define YGG_CONST_TABLE_HPP
+
+#include <cstddef>
+#include <iterator>
+
+#include "util.hpp"
+
+namespace ygg {
+
+/**
+ * @brief One entry of a ConstTable
+ *
+ * @tparam Key 		The key type. Must be a literal type.
+ * @tparam Value 	The value type. Must be a literal type.
+ */
+template<class Key, class Value>
+class ConstTableEntry {
+public:
+	Key key;
+	Value value;
+};
+
+/**
+ * @brief An immutable ordered table that can be built at compile time
+ *
+ * Many lookup tables are known at compile time. ConstTable is built from a constant array of
+ * entries in a constexpr constructor, so a constexpr ConstTable costs nothing at startup. The
+ * entries are sorted by key and stored in Eytzinger (BFS) order, i.e., the children of the
+ * entry at index i are at 2i+1 and 2i+2. Thus, a search reads the entries of a perfectly balanced
+ * search tree without following any pointers, and the first levels of the tree share cache lines.
+ *
+ * find(), lower_bound() and upper_bound() have the same semantics as the respective methods of
+ * RBTree (with MULTIPLE set), and iteration visits the entries in sorted order. All of them
+ * can be used in constant expressions. Entries with equal keys are allowed, but their order is
+ * unspecified.
+ *
+ * Example:
+ *
+ * @code{.c++}
+ * constexpr ConstTableEntry<int, const char *> codes[] = {{404, "Not Found"}, {200, "OK"}};
+ * constexpr auto table = make_const_table(codes);
+ * static_assert(table.find(200)->value[0] == 'O', "");
+ * @endcode
+ *
+ * @tparam Key 		The key type. Must be a literal type and default constructible.
+ * @tparam Value 	The value type. Must be a literal type and default constructible.
+ * @tparam N 		The number of entries
+ * @tparam Compare 	A compare class for keys. Its operator() must be constexpr. See RBTree.
+ */
+template<class Key, class Value, size_t N, class Compare = utilities::flexible_less>
+class ConstTable {
+public:
+	static_assert(N > 0, "A ConstTable needs at least one entry");
+
+	using Entry = ConstTableEntry<Key, Value>;
+
+	/**
+	 * @brief Iterator over the entries of a ConstTable, in sorted order
+	 */
+	class const_iterator {
+	public:
+		typedef ptrdiff_t                         difference_type;
+		typedef Entry                             value_type;
+		typedef const Entry &                     reference;
+		typedef const Entry *                     pointer;
+		typedef std::bidirectional_iterator_tag   iterator_category;
+
+		constexpr const_iterator() : entries(nullptr), index(N) {}
+
+		constexpr bool operator==(const const_iterator & other) const {
+			return (this->entries == other.entries) && (this->index == other.index);
+		}
+		constexpr bool operator!=(const const_iterator & other) const {
+			return !(*this == other);
+		}
+
+		constexpr const_iterator & operator++();
+		constexpr const_iterator operator++(int);
+		constexpr const_iterator & operator--();
+		constexpr const_iterator operator--(int);
+
+		constexpr reference operator*() const {
+			return this->entries[this->index];
+		}
+		constexpr pointer operator->() const {
+			return &(this->entries[this->index]);
+		}
+
+	private:
+		friend class ConstTable;
+
+		constexpr const_iterator(const Entry * entries_in, size_t index_in)
+			: entries(entries_in), index(index_in) {}
+
+		const Entry * entries;
+		// Index into the Eytzinger layout. N is the end.
+		size_t index;
+	};
+
+	/**
+	 * @brief Builds the table from an array of entries
+	 *
+	 * Sorts a copy of the entries and lays them out for searching. This takes O(N log N)
+	 * and is meant to be evaluated at compile time.
+	 *
+	 * @param entries 	The entries, in any order
+	 */
+	constexpr explicit ConstTable(const Entry (& entries)[N]);
+
+	/**
+	 * @brief Finds an entry
+	 *
+	 * @param query 	Anything that Compare can compare to a Key
+	 * @return An iterator to the first entry with a key equal to <query>, or end()
+	 */
+	template<class Comparable>
+	constexpr const_iterator find(const Comparable & query) const;
+
+	/**
+	 * @brief Returns an iterator to the first entry whose key is not less than <query>
+	 */
+	template<class Comparable>
+	constexpr const_iterator lower_bound(const Comparable & query) const;
+
+	/**
+	 * @brief Returns an iterator to the first entry whose key is greater than <query>
+	 */
+	template<class Comparable>
+	constexpr const_iterator upper_bound(const Comparable & query) const;
+
+	/**
+	 * @brief Returns an iterator to the entry with the smallest key
+	 */
+	constexpr const_iterator begin() const;
+	/**
+	 * @brief Returns an iterator past the entry with the largest key
+	 */
+	constexpr const_iterator end() const;
+	constexpr const_iterator cbegin() const;
+	constexpr const_iterator cend() const;
+
+	/**
+	 * @brief Returns the number of entries
+	 */
+	constexpr size_t size() const;
+	constexpr bool empty() const;
+
+private:
+	constexpr void sort(Entry (& entries)[N]);
+	constexpr void sift_down(Entry (& entries)[N], size_t root, size_t end);
+	constexpr void lay_out(const Entry (& sorted)[N], size_t index, size_t & next);
+
+	Compare cmp = Compare();
+	Entry layout[N] = {};
+};
+
+/**
+ * @brief Creates a ConstTable from an array, deducing its size
+ *
+ * @param entries 	The entries, in any order
+ * @return The table
+ */
+template<class Key, class Value, size_t N>
+constexpr ConstTable<Key, Value, N>
+make_const_table(const ConstTableEntry<Key, Value> (& entries)[N])
+{
+	return ConstTable<Key, Value, N>(entries);
+}
+
+} // namespace ygg
+
+#include "const_table.cpp"
+
+#endif //YGG_CONST_TABLE_HPP
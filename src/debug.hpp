@@ -5,8 +5,11 @@
 #ifndef YGG_DEBUG_HPP
 #define YGG_DEBUG_HPP
 
-#include <unordered_map>
+#include <iostream>
 #include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace ygg {
 namespace debug {
@@ -0,0 +1,118 @@
+#ifndef YGG_DEBUG_DOT_HPP
+#define YGG_DEBUG_DOT_HPP
+
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+#include "rbtree.hpp"
+#include "intervaltree.hpp"
+
+namespace ygg {
+namespace debug {
+
+/// @cond INTERNAL
+template<class Tree, class Node, class NodeNameGetter>
+void
+output_dot_node(Node * node, std::ofstream & out, NodeNameGetter & name_getter)
+{
+	using NB = typename Tree::NB;
+	using Color = typename Tree::Base::Color;
+
+	if (node == nullptr) {
+		return;
+	}
+
+	std::string color;
+	if (node->NB::_rbt_color == Color::BLACK) {
+		color = "black";
+	} else {
+		color = "red";
+	}
+
+	out << "  " << std::to_string((long unsigned int)node) << "[ color=" << color << " label=\""
+	    << name_getter(node) << "\"]\n";
+
+	if (node->NB::_rbt_parent != nullptr) {
+		std::string label;
+		if (node->NB::_rbt_parent->NB::_rbt_left == node) {
+			label = std::string("L");
+		} else {
+			label = std::string("R");
+		}
+
+		out << "  " << std::to_string((long unsigned int)node->NB::_rbt_parent) << " -> "
+		    << std::to_string((long unsigned int)node) << "[ label=\"" << label << "\"]\n";
+	}
+
+	output_dot_node<Tree>(Tree::get_left_child(node), out, name_getter);
+	output_dot_node<Tree>(Tree::get_right_child(node), out, name_getter);
+}
+/// @endcond
+
+/**
+ * @brief Draws a tree as a .dot file
+ *
+ * Writes the tree as a .dot file which can be drawn using graphviz. Nodes are drawn in their
+ * color and labeled by name_getter(node). Works on every tree derived from RBTree.
+ *
+ * This lives outside of the tree classes, so that only code that includes this header pulls in
+ * file streams.
+ *
+ * @param t           The tree to draw
+ * @param filename    The file path where to write the .dot file
+ * @param name_getter Called as name_getter(const Node *). Must return something that can be
+ * written to a std::ostream.
+ */
+template<class Tree, class NodeNameGetter>
+void
+dump_to_dot(const Tree & t, const std::string & filename, NodeNameGetter name_getter)
+{
+	std::ofstream dotfile;
+	dotfile.open(filename);
+	dotfile << "digraph G {\n";
+	output_dot_node<Tree>(t.get_root(), dotfile, name_getter);
+	dotfile << "}\n";
+}
+
+/**
+ * @brief Draws an RBTree as a .dot file, labeling nodes by NodeTraits::get_id()
+ *
+ * @param t           The tree to draw
+ * @param filename    The file path where to write the .dot file
+ */
+template<class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+dump_to_dot(const RBTree<Node, NodeTraits, Options, Tag, Compare> & t,
+            const std::string & filename)
+{
+	dump_to_dot(t, filename, [](const Node * node) { return NodeTraits::get_id(node); });
+}
+
+/**
+ * @brief Draws an IntervalTree as a .dot file
+ *
+ * Nodes are labeled by NodeTraits::get_id(), their interval and the maximum upper bound in their
+ * subtree.
+ *
+ * @param t           The tree to draw
+ * @param filename    The file path where to write the .dot file
+ */
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+dump_to_dot(const IntervalTree<Node, NodeTraits, Options, Tag> & t, const std::string & filename)
+{
+	using INB = ITreeNodeBase<Node, NodeTraits, Options, Tag>;
+
+	dump_to_dot(t, filename, [](const Node * node) {
+		return NodeTraits::get_id(node) + std::string("\n[") +
+		       std::to_string(NodeTraits::get_lower(*node)) + std::string(", ") +
+		       std::to_string(NodeTraits::get_upper(*node)) + std::string("]\n") +
+		       std::string("-> ") + std::to_string(node->INB::_it_max_upper);
+	});
+}
+
+} // namespace debug
+} // namespace ygg
+
+#endif //YGG_DEBUG_DOT_HPP
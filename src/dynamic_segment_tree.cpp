@@ -9,6 +9,7 @@
 #include "ygg.hpp"
 
 #include <iostream>
+#include <set>
 #include <tuple>
 #include <algorithm>
 
@@ -0,0 +1,107 @@
+#ifndef YGG_FIND_CACHE_HPP
+#define YGG_FIND_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ygg {
+
+/**
+ * @brief Hit and miss counts of the find() cache of an RBTree
+ *
+ * A snapshot of the counters an RBTree keeps if the TreeFlags::FIND_CACHE option is set. See
+ * RBTree::get_find_cache_statistics() and RBTree::reset_find_cache_statistics().
+ */
+class FindCacheStatistics {
+public:
+	/// Number of find() calls answered from the cache
+	size_t hits = 0;
+	/// Number of find() calls that had to descend the tree
+	size_t misses = 0;
+
+	/**
+	 * @brief Returns the fraction of find() calls answered from the cache
+	 */
+	double
+	hit_rate() const
+	{
+		if (this->hits + this->misses == 0) {
+			return 0;
+		}
+		return static_cast<double>(this->hits) / static_cast<double>(this->hits + this->misses);
+	}
+};
+
+namespace utilities {
+
+/// @cond INTERNAL
+/*
+ * A direct-mapped cache from query hashes to nodes. Every entry remembers the version of the
+ * tree it was written in. Modifying the tree increments the version, which invalidates all
+ * entries at once.
+ */
+template<class Node, size_t slots>
+class FindCacheHolder {
+public:
+	static_assert((slots & (slots - 1)) == 0, "The number of find cache slots must be a power of two");
+
+	Node * get(size_t hash) {
+		const Entry & e = this->entries[hash & (slots - 1)];
+		if (e.version != this->version) {
+			return nullptr;
+		}
+		return e.node;
+	}
+
+	void put(size_t hash, Node * node) {
+		Entry & e = this->entries[hash & (slots - 1)];
+		e.node = node;
+		e.version = this->version;
+	}
+
+	void invalidate() {
+		this->version++;
+	}
+
+	void count_hit() {
+		this->stats.hits++;
+	}
+
+	void count_miss() {
+		this->stats.misses++;
+	}
+
+	FindCacheStatistics get_statistics() const {
+		return this->stats;
+	}
+
+	FindCacheStatistics reset_statistics() {
+		FindCacheStatistics old = this->stats;
+		this->stats = FindCacheStatistics();
+		return old;
+	}
+
+private:
+	class Entry {
+	public:
+		Node * node = nullptr;
+		uint64_t version = 0;
+	};
+
+	Entry entries[slots];
+	// Starts above the version of the empty entries
+	uint64_t version = 1;
+	FindCacheStatistics stats;
+};
+
+template<class Node>
+class FindCacheHolder<Node, 0> {
+public:
+	void invalidate() {}
+};
+/// @endcond
+
+} // namespace utilities
+} // namespace ygg
+
+#endif //YGG_FIND_CACHE_HPP
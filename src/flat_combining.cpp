@@ -0,0 +1,191 @@
+#include "flat_combining.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <thread>
+
+namespace ygg {
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::FlatCombiningRBTree()
+	: t(), cmp(), m(), registered(0)
+{}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+size_t
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::register_thread()
+{
+	size_t slot = this->registered.load(std::memory_order_relaxed);
+	do {
+		if (slot >= max_threads) {
+			throw std::length_error("FlatCombiningRBTree: more than max_threads threads registered");
+		}
+	} while (!this->registered.compare_exchange_weak(slot, slot + 1));
+
+	return slot;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+bool
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::insert(size_t slot,
+                                                                                 Node & node)
+{
+	return this->execute(slot, OpType::INSERT, node);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+bool
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::remove(size_t slot,
+                                                                                 Node & node)
+{
+	return this->execute(slot, OpType::REMOVE, node);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+typename FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::Tree &
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::get_tree()
+{
+	return this->t;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+const typename FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::Tree &
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::get_tree() const
+{
+	return this->t;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+bool
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::execute(size_t slot_index,
+                                                                                  OpType op,
+                                                                                  Node & node)
+{
+	assert(slot_index < this->registered.load(std::memory_order_relaxed));
+	Slot & slot = this->slots[slot_index];
+
+	// Publish the operation
+	slot.op = op;
+	slot.node = &node;
+	slot.state.store(SLOT_PENDING, std::memory_order_release);
+
+	while (slot.state.load(std::memory_order_acquire) != SLOT_DONE) {
+		if (this->m.try_lock()) {
+			// We are the combiner. Our own operation is pending, so the first pass will apply it.
+			// Do a few more passes for operations that have been published in the meantime.
+			unsigned int passes = 0;
+			while (this->combine() && (++passes < 3)) {}
+			this->m.unlock();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+
+	bool result = slot.result;
+	slot.state.store(SLOT_IDLE, std::memory_order_relaxed);
+
+	return result;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+bool
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::combine()
+{
+	Slot * inserts[max_threads];
+	size_t insert_count = 0;
+	bool did_work = false;
+
+	size_t slot_count = std::min(this->registered.load(std::memory_order_acquire), max_threads);
+	for (size_t i = 0 ; i < slot_count ; ++i) {
+		Slot & slot = this->slots[i];
+		if (slot.state.load(std::memory_order_acquire) != SLOT_PENDING) {
+			continue;
+		}
+
+		did_work = true;
+		if (slot.op == OpType::REMOVE) {
+			// Removals are applied right away. A node can not be inserted and removed
+			// concurrently, so the order relative to the inserts of this batch does not matter.
+			this->t.remove(*slot.node);
+			slot.result = true;
+			slot.state.store(SLOT_DONE, std::memory_order_release);
+		} else {
+			inserts[insert_count++] = &slot;
+		}
+	}
+
+	this->apply_inserts(inserts, insert_count);
+
+	return did_work;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+void
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::apply_inserts(
+				Slot ** inserts, size_t count)
+{
+	std::sort(inserts, inserts + count, [&](const Slot * lhs, const Slot * rhs) {
+		return utilities::compare_less(this->cmp, *lhs->node, *rhs->node);
+	});
+
+	// Insert from largest to smallest. Whenever the previously inserted node is the successor of
+	// the current node, we can use it as hint.
+	Node * successor = nullptr;
+	for (size_t i = count ; i > 0 ; --i) {
+		Slot & slot = *inserts[i - 1];
+		Node & node = *slot.node;
+		bool inserted = false;
+		bool handled = false;
+
+		if (successor != nullptr) {
+			if (!Options::multiple && !utilities::compare_less(this->cmp, node, *successor)) {
+				// Duplicate within the batch
+				handled = true;
+			} else {
+				auto pred = this->t.iterator_to(*successor);
+				--pred;
+
+				if ((pred == this->t.end()) || utilities::compare_less(this->cmp, *pred, node)) {
+					// Nothing in the tree between node and successor.
+					this->t.insert(node, *successor);
+					inserted = true;
+					handled = true;
+				}
+			}
+		}
+
+		if (!handled) {
+			inserted = this->insert_descending(node);
+		}
+
+		if (inserted) {
+			successor = &node;
+		}
+
+		slot.result = inserted;
+		slot.state.store(SLOT_DONE, std::memory_order_release);
+	}
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+template<bool multiple>
+typename std::enable_if<multiple, bool>::type
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::insert_descending(
+				Node & node)
+{
+	this->t.insert(node);
+	return true;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag, class Compare, size_t max_threads>
+template<bool multiple>
+typename std::enable_if<!multiple, bool>::type
+FlatCombiningRBTree<Node, NodeTraits, Options, Tag, Compare, max_threads>::insert_descending(
+				Node & node)
+{
+	// Checks for an equal element and links in <node> in the same descent
+	return this->t.insert_unique(node).second;
+}
+
+} // namespace ygg
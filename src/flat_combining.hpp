@@ -0,0 +1,135 @@
+#ifndef YGG_FLAT_COMBINING_HPP
+#define YGG_FLAT_COMBINING_HPP
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <type_traits>
+
+#include "rbtree.hpp"
+
+namespace ygg {
+
+/**
+ * @brief A flat-combining front end for an RBTree that is shared by many threads
+ *
+ * When many threads perform small insert / remove operations on the same tree, handing a lock
+ * from thread to thread quickly becomes more expensive than the tree operations themselves. This
+ * class implements flat combining: every thread owns a slot into which it publishes its
+ * operation. Whichever thread manages to acquire the lock (the "combiner") then applies all
+ * published operations in one batch and hands the per-operation results back through the slots.
+ *
+ * Inserts within a batch are sorted. Where a freshly inserted node is known to be the successor
+ * of the next node to be inserted, the hinted RBTree::insert(Node &, Node &) is used, saving a
+ * full descent from the root.
+ *
+ * Every thread that wants to operate on the tree must first obtain a slot via register_thread().
+ * Slots cannot be shared between threads that operate concurrently.
+ *
+ * @tparam Node         The node class of the tree. See RBTree for details.
+ * @tparam NodeTraits   The node traits of the tree. See RBTree for details.
+ * @tparam Options      The options of the tree. See RBTree for details.
+ * @tparam Tag          The tag of the tree. See RBTree for details.
+ * @tparam Compare      The compare class of the tree. See RBTree for details.
+ * @tparam max_threads  The maximum number of threads that can be registered.
+ */
+template<class Node, class NodeTraits, class Options = DefaultOptions, class Tag = int,
+         class Compare = ygg::utilities::flexible_less, size_t max_threads = 64>
+class FlatCombiningRBTree {
+public:
+	using Tree = RBTree<Node, NodeTraits, Options, Tag, Compare>;
+
+	FlatCombiningRBTree();
+
+	/**
+	 * @brief Registers the calling thread and returns its slot
+	 *
+	 * Every thread must call this once before using insert() or remove(), and must pass the
+	 * returned slot to all subsequent calls. At most max_threads threads can be registered.
+	 *
+	 * @throws std::length_error if max_threads threads have already been registered
+	 *
+	 * @return The slot of the calling thread
+	 */
+	size_t register_thread();
+
+	/**
+	 * @brief Inserts <node> into the tree
+	 *
+	 * The operation is published in the given slot and applied by whichever thread currently
+	 * combines. This method returns after the operation has been applied.
+	 *
+	 * @param slot  The slot of the calling thread, as returned by register_thread()
+	 * @param node  The node to be inserted
+	 * @return true if the node was inserted, false if the tree does not allow multiple elements
+	 * and an element comparing equally to <node> was already present.
+	 */
+	bool insert(size_t slot, Node & node);
+
+	/**
+	 * @brief Removes <node> from the tree
+	 *
+	 * The operation is published in the given slot and applied by whichever thread currently
+	 * combines. This method returns after the operation has been applied.
+	 *
+	 * @param slot  The slot of the calling thread, as returned by register_thread()
+	 * @param node  The node to be removed. Must be in the tree.
+	 * @return Always true.
+	 */
+	bool remove(size_t slot, Node & node);
+
+	/**
+	 * @brief Returns the underlying tree
+	 *
+	 * @warning Accessing the tree is not synchronized. Only do this while no other thread
+	 * operates on this FlatCombiningRBTree.
+	 *
+	 * @return The underlying tree
+	 */
+	Tree & get_tree();
+	const Tree & get_tree() const;
+
+private:
+	enum class OpType : unsigned char { INSERT, REMOVE };
+
+	// Slot states
+	static constexpr unsigned char SLOT_IDLE = 0;
+	static constexpr unsigned char SLOT_PENDING = 1;
+	static constexpr unsigned char SLOT_DONE = 2;
+
+	/// @cond INTERNAL
+	class alignas(64) Slot {
+	public:
+		Slot() : state(SLOT_IDLE), op(OpType::INSERT), node(nullptr), result(false) {}
+
+		std::atomic<unsigned char> state;
+		OpType op;
+		Node * node;
+		bool result;
+	};
+	/// @endcond
+
+	bool execute(size_t slot, OpType op, Node & node);
+	bool combine();
+	void apply_inserts(Slot ** inserts, size_t count);
+
+	// Inserts <node> with a single descent from the root. Returns false if an equal element
+	// was already present.
+	template<bool multiple = Options::multiple>
+	typename std::enable_if<multiple, bool>::type insert_descending(Node & node);
+	template<bool multiple = Options::multiple>
+	typename std::enable_if<!multiple, bool>::type insert_descending(Node & node);
+
+	Tree t;
+	Compare cmp;
+
+	std::mutex m;
+	std::atomic<size_t> registered;
+	Slot slots[max_threads];
+};
+
+} // namespace ygg
+
+#include "flat_combining.cpp"
+
+#endif //YGG_FLAT_COMBINING_HPP
@@ -1,14 +1,16 @@
 namespace utilities {
 
-template <class Node, class NodeTraits>
+template <class Node, class INB, class NodeTraits>
 template <class T1, class T2>
 bool
-IntervalCompare<Node, NodeTraits>::operator()(const T1 &lhs, const T2 &rhs) const
+IntervalCompare<Node, INB, NodeTraits>::operator()(const T1 &lhs, const T2 &rhs) const
 {
-	if (NodeTraits::get_lower(lhs) < NodeTraits::get_lower(rhs)) {
+	using Bounds = Endpoints<Node, INB, NodeTraits, INB::endpoint_cache>;
+
+	if (Bounds::get_lower(lhs) < Bounds::get_lower(rhs)) {
 		return true;
-	} else if ((NodeTraits::get_lower(lhs) == NodeTraits::get_lower(rhs)) &&
-	           (NodeTraits::get_upper(lhs) < NodeTraits::get_upper(rhs))) {
+	} else if ((Bounds::get_lower(lhs) == Bounds::get_lower(rhs)) &&
+	           (Bounds::get_upper(lhs) < Bounds::get_upper(rhs))) {
 		return true;
 	} else {
 		return false;
@@ -19,7 +21,8 @@ template <class Node, class INB, class NodeTraits>
 void
 ExtendedNodeTraits<Node, INB, NodeTraits>::leaf_inserted(Node &node)
 {
-	node.INB::_it_max_upper = NodeTraits::get_upper(node);
+	node.INB::_it_max_upper = Bounds::get_upper(node);
+	Sizes::leaf_inserted(node);
 
 	// Propagate up
 	Node *cur = node._rbt_parent;
@@ -34,7 +37,7 @@ void
 ExtendedNodeTraits<Node, INB, NodeTraits>::fix_node(Node &node)
 {
 	auto old_val = node.INB::_it_max_upper;
-	node.INB::_it_max_upper = NodeTraits::get_upper(node);
+	node.INB::_it_max_upper = Bounds::get_upper(node);
 
 	if (node._rbt_left != nullptr) {
 		node.INB::_it_max_upper = std::max(node.INB::_it_max_upper, node._rbt_left->INB::_it_max_upper);
@@ -60,6 +63,7 @@ void
 ExtendedNodeTraits<Node, INB, NodeTraits>::rotated_left(Node &node)
 {
 	// 'node' is the node that was the old parent.
+	Sizes::rotated(node);
 	fix_node(node);
 	fix_node(*(node._rbt_parent));
 }
@@ -69,6 +73,7 @@ void
 ExtendedNodeTraits<Node, INB, NodeTraits>::rotated_right(Node &node)
 {
 	// 'node' is the node that was the old parent.
+	Sizes::rotated(node);
 	fix_node(node);
 	fix_node(*(node._rbt_parent));
 }
@@ -80,10 +85,21 @@ ExtendedNodeTraits<Node, INB, NodeTraits>::deleted_below(Node &node)
 	fix_node(node);
 }
 
+template <class Node, class INB, class NodeTraits>
+void
+ExtendedNodeTraits<Node, INB, NodeTraits>::delete_leaf(Node &node)
+{
+	Sizes::delete_leaf(node);
+	// The node leaves the tree, its bounds may change from now on
+	Bounds::invalidate(node);
+}
+
 template <class Node, class INB, class NodeTraits>
 void
 ExtendedNodeTraits<Node, INB, NodeTraits>::swapped(Node &n1, Node &n2)
 {
+	Sizes::swapped(n1, n2);
+
 	fix_node(n1);
 	if (n1._rbt_parent != nullptr) {
 		fix_node(*(n1._rbt_parent));
@@ -95,6 +111,41 @@ ExtendedNodeTraits<Node, INB, NodeTraits>::swapped(Node &n1, Node &n2)
 	}
 }
 
+template <class Node, class INB, class NodeTraits>
+void
+ExtendedNodeTraits<Node, INB, NodeTraits>::relocated(Node &from, Node &to)
+{
+	to.INB::_it_max_upper = from.INB::_it_max_upper;
+	Sizes::relocated(from, to);
+	Bounds::relocated(from, to);
+}
+
+template <class Node, class INB, class NodeTraits>
+void
+ExtendedNodeTraits<Node, INB, NodeTraits>::subtree_rebuilt(Node &node)
+{
+	// Both subtrees are final, so there is nothing to propagate
+	node.INB::_it_max_upper = Bounds::get_upper(node);
+
+	if (node._rbt_left != nullptr) {
+		node.INB::_it_max_upper = std::max(node.INB::_it_max_upper, node._rbt_left->INB::_it_max_upper);
+	}
+
+	if (node._rbt_right != nullptr) {
+		node.INB::_it_max_upper = std::max(node.INB::_it_max_upper, node._rbt_right->INB::_it_max_upper);
+	}
+
+	Sizes::recompute(node);
+}
+
+template <class Node, class INB, class NodeTraits>
+void
+ExtendedNodeTraits<Node, INB, NodeTraits>::key_changed(Node &node)
+{
+	// The node kept its place, but its upper bound may have changed
+	fix_node(node);
+}
+
 template <class Node, class INB, class NodeTraits>
 typename NodeTraits::key_type
 ExtendedNodeTraits<Node, INB, NodeTraits>::get_lower(
@@ -110,6 +161,278 @@ ExtendedNodeTraits<Node, INB, NodeTraits>::get_upper(
 {
 	return std::get<1>(range);
 }
+
+template <class Node, class INB, class NodeTraits>
+typename NodeTraits::key_type
+Endpoints<Node, INB, NodeTraits, true>::get_lower(const Node &node)
+{
+	if (node.INB::_it_endpoints_cached) {
+		return node.INB::_it_lower;
+	}
+	return NodeTraits::get_lower(node);
+}
+
+template <class Node, class INB, class NodeTraits>
+typename NodeTraits::key_type
+Endpoints<Node, INB, NodeTraits, true>::get_upper(const Node &node)
+{
+	if (node.INB::_it_endpoints_cached) {
+		return node.INB::_it_upper;
+	}
+	return NodeTraits::get_upper(node);
+}
+
+template <class Node, class INB, class NodeTraits>
+void
+Endpoints<Node, INB, NodeTraits, true>::fill(Node &node)
+{
+	node.INB::_it_lower = NodeTraits::get_lower(node);
+	node.INB::_it_upper = NodeTraits::get_upper(node);
+	node.INB::_it_endpoints_cached = true;
+}
+
+template <class Node, class INB, class NodeTraits>
+void
+Endpoints<Node, INB, NodeTraits, true>::invalidate(Node &node)
+{
+	node.INB::_it_endpoints_cached = false;
+}
+
+template <class Node, class INB, class NodeTraits>
+void
+Endpoints<Node, INB, NodeTraits, true>::relocated(Node &from, Node &to)
+{
+	// The payload of <to> might not have been moved yet
+	to.INB::_it_lower = from.INB::_it_lower;
+	to.INB::_it_upper = from.INB::_it_upper;
+	to.INB::_it_endpoints_cached = from.INB::_it_endpoints_cached;
+	from.INB::_it_endpoints_cached = false;
+}
+
+template <class Node, class INB, class NodeTraits>
+template <class Iterator>
+void
+Endpoints<Node, INB, NodeTraits, true>::invalidate_all(Iterator begin, Iterator end)
+{
+	for (Iterator it = begin ; it != end ; ++it) {
+		invalidate(*it);
+	}
+}
+
+template <class Node, class INB, class NodeTraits>
+bool
+Endpoints<Node, INB, NodeTraits, true>::verify(const Node *node)
+{
+	if (node == nullptr) {
+		return true;
+	}
+
+	bool valid = !node->INB::_it_endpoints_cached ||
+	             ((node->INB::_it_lower == NodeTraits::get_lower(*node)) &&
+	              (node->INB::_it_upper == NodeTraits::get_upper(*node)));
+
+	return valid && verify(node->_rbt_left) && verify(node->_rbt_right);
+}
+
+template <class Node>
+size_t
+SubtreeSizes<Node, true>::get(const Node *node)
+{
+	if (node == nullptr) {
+		return 0;
+	}
+	return node->_it_size;
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::leaf_inserted(Node &node)
+{
+	node._it_size = 1;
+	for (Node *cur = node._rbt_parent ; cur != nullptr ; cur = cur->_rbt_parent) {
+		cur->_it_size++;
+	}
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::delete_leaf(Node &node)
+{
+	// node is still linked at this point
+	for (Node *cur = node._rbt_parent ; cur != nullptr ; cur = cur->_rbt_parent) {
+		cur->_it_size--;
+	}
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::rotated(Node &node)
+{
+	// 'node' is the node that was the old parent.
+	recompute(node);
+	recompute(*(node._rbt_parent));
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::swapped(Node &n1, Node &n2)
+{
+	// The sizes belong to the positions, which have been swapped
+	std::swap(n1._it_size, n2._it_size);
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::relocated(Node &from, Node &to)
+{
+	to._it_size = from._it_size;
+}
+
+template <class Node>
+void
+SubtreeSizes<Node, true>::recompute(Node &node)
+{
+	node._it_size = 1 + get(node._rbt_left) + get(node._rbt_right);
+}
+
+template <class Node>
+bool
+SubtreeSizes<Node, true>::verify(const Node *node)
+{
+	if (node == nullptr) {
+		return true;
+	}
+
+	return verify(node->_rbt_left) && verify(node->_rbt_right) &&
+	       (node->_it_size == 1 + get(node->_rbt_left) + get(node->_rbt_right));
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::copy_bounds(Node &node)
+{
+	node._it_upper_node._it_lower = NodeTraits::get_lower(node);
+	node._it_upper_node._it_upper = NodeTraits::get_upper(node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::insert(Node &node)
+{
+	copy_bounds(node);
+	this->tree.insert(node._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::remove(Node &node)
+{
+	this->tree.remove(node._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::reposition(Node &node, bool still_in_tree)
+{
+	if (!still_in_tree) {
+		this->tree.remove(node._it_upper_node);
+		return;
+	}
+
+	copy_bounds(node);
+	this->tree.reposition(node._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::replace_node(Node &old_node, Node &new_node)
+{
+	copy_bounds(new_node);
+	this->tree.replace_node(old_node._it_upper_node, new_node._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::relocate(Node &from, Node &to)
+{
+	// The payload of <to> might not have been moved yet
+	to._it_upper_node._it_lower = from._it_upper_node._it_lower;
+	to._it_upper_node._it_upper = from._it_upper_node._it_upper;
+	this->tree.relocate(from._it_upper_node, to._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::mark_for_removal(Node &node)
+{
+	this->tree.mark_for_removal(node._it_upper_node);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::flush_removals(double rebuild_fraction)
+{
+	this->tree.flush_removals(rebuild_fraction);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::merge(OverlapCounter &other)
+{
+	// Intervals compare equally in this index iff they do in the interval tree, so exactly
+	// the same elements stay in <other> in both indices.
+	this->tree.merge(other.tree);
+}
+
+template <class Node, class NodeTraits, class Options>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::clear()
+{
+	this->tree.clear();
+}
+
+template <class Node, class NodeTraits, class Options>
+template <class Iterator>
+void
+OverlapCounter<Node, NodeTraits, Options, true>::rebuild(Iterator begin, Iterator end)
+{
+	this->tree.clear();
+	for (Iterator it = begin ; it != end ; ++it) {
+		this->insert(*it);
+	}
+}
+
+template <class Node, class NodeTraits, class Options>
+bool
+OverlapCounter<Node, NodeTraits, Options, true>::verify_integrity(const Node *primary_root) const
+{
+	bool tree_valid = this->tree.verify_integrity();
+	bool sizes_valid = SubtreeSizes<UpperNode, true>::verify(this->tree.get_root());
+	bool in_sync = (SubtreeSizes<UpperNode, true>::get(this->tree.get_root()) ==
+	                SubtreeSizes<Node, true>::get(primary_root));
+
+	return tree_valid && sizes_valid && in_sync;
+}
+
+template <class Node, class NodeTraits, class Options>
+size_t
+OverlapCounter<Node, NodeTraits, Options, true>::count_ending_before(const Key &x) const
+{
+	size_t count = 0;
+	UpperNode *cur = this->tree.get_root();
+
+	while (cur != nullptr) {
+		if (cur->_it_upper < x) {
+			// cur and everything left of it ends before x
+			count += SubtreeSizes<UpperNode, true>::get(cur->_rbt_left) + 1;
+			cur = cur->_rbt_right;
+		} else {
+			cur = cur->_rbt_left;
+		}
+	}
+
+	return count;
+}
 } // namespace utilities
 
 template<class Node, class NodeTraits, class Options, class Tag>
@@ -124,8 +447,14 @@ IntervalTree<Node, NodeTraits, Options, Tag>::verify_integrity() const
   assert(base_verification);
   bool maxima_valid = this->root == nullptr ? true :  this->verify_maxima(this->root);
   assert(maxima_valid);
+  bool sizes_valid = utilities::SubtreeSizes<Node, Options::overlap_counting>::verify(this->root);
+  assert(sizes_valid);
+  bool counter_valid = this->counter().verify_integrity(this->root);
+  assert(counter_valid);
+  bool cache_valid = Bounds::verify(this->root);
+  assert(cache_valid);
 
-  return base_verification && maxima_valid;
+  return base_verification && maxima_valid && sizes_valid && counter_valid && cache_valid;
 }
 
 template<class Node, class NodeTraits, class Options, class Tag>
@@ -149,6 +478,208 @@ IntervalTree<Node, NodeTraits, Options, Tag>::verify_maxima(Node * n) const
   return valid;
 }
 
+/*
+ * Bounds::fill() must run before inserting, since the insertion already maintains the maxima. A
+ * tree that does not allow equal elements may still reject the node, which then must not keep
+ * valid-looking cached bounds nor be counted.
+ */
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::finish_insert(Node & node, bool inserted)
+{
+  if (inserted) {
+    this->counter().insert(node);
+  } else {
+    Bounds::invalidate(node);
+  }
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::insert(Node & node)
+{
+  Bounds::fill(node);
+  this->finish_insert(node, this->BaseTree::insert_below(node, this->root));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::insert(Node & node, Node & hint)
+{
+  Bounds::fill(node);
+  this->finish_insert(node, this->BaseTree::insert_hinted(node, hint));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::insert(Node & node, typename BaseTree::template iterator<false> hint)
+{
+  Bounds::fill(node);
+  this->finish_insert(node, this->BaseTree::insert_hinted(node, hint));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::insert_left_leaning(Node & node)
+{
+  Bounds::fill(node);
+  this->finish_insert(node, this->BaseTree::insert_below(node, this->root));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::insert_right_leaning(Node & node)
+{
+  Bounds::fill(node);
+  this->finish_insert(node, this->BaseTree::template insert_below<false>(node, this->root));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+std::pair<typename IntervalTree<Node, NodeTraits, Options, Tag>::BaseTree::template iterator<false>, bool>
+IntervalTree<Node, NodeTraits, Options, Tag>::insert_unique(Node & node)
+{
+  Bounds::fill(node);
+  auto result = this->BaseTree::insert_unique(node);
+  this->finish_insert(node, result.second);
+  return result;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::BaseTree::template iterator<false>
+IntervalTree<Node, NodeTraits, Options, Tag>::insert_commit(Node & node, const typename BaseTree::InsertCommitData & commit_data)
+{
+  Bounds::fill(node);
+  auto it = this->BaseTree::insert_commit(node, commit_data);
+  this->counter().insert(node);
+  return it;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::remove(Node & node)
+{
+  this->BaseTree::remove(node);
+  this->counter().remove(node);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+bool
+IntervalTree<Node, NodeTraits, Options, Tag>::reposition(Node & node)
+{
+  // The cache still holds the old bounds
+  Bounds::fill(node);
+  bool still_in_tree = this->BaseTree::reposition(node);
+  if (still_in_tree && !BaseTree::is_marked(node)) {
+    // The node may have been removed and inserted again
+    Bounds::fill(node);
+  } else {
+    Bounds::invalidate(node);
+  }
+  this->counter().reposition(node, still_in_tree);
+  return still_in_tree;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::replace_node(Node & old_node, Node & new_node)
+{
+  Bounds::fill(new_node);
+  this->BaseTree::replace_node(old_node, new_node);
+  Bounds::invalidate(old_node);
+  this->counter().replace_node(old_node, new_node);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::relocate(Node & from, Node & to)
+{
+  this->BaseTree::relocate(from, to);
+  this->counter().relocate(from, to);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::mark_for_removal(Node & node)
+{
+  this->BaseTree::mark_for_removal(node);
+  // flush_removals() may drop the node without telling us
+  Bounds::invalidate(node);
+  this->counter().mark_for_removal(node);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+size_t
+IntervalTree<Node, NodeTraits, Options, Tag>::flush_removals(double rebuild_fraction)
+{
+  this->counter().flush_removals(rebuild_fraction);
+  return this->BaseTree::flush_removals(rebuild_fraction);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::merge(IntervalTree & other)
+{
+  this->BaseTree::merge(other);
+  this->counter().merge(other.counter());
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::clear()
+{
+  Bounds::invalidate_all(this->BaseTree::begin(), this->BaseTree::end());
+  this->BaseTree::clear();
+  this->counter().clear();
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Callback>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::drain(Callback callback)
+{
+  // The callback may free the nodes, so the index must let go of them first
+  this->counter().clear();
+  this->BaseTree::drain([&](Node & node) {
+    Bounds::invalidate(node);
+    callback(node);
+  });
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Pool>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::clear_and_release(Pool & pool)
+{
+  this->counter().clear();
+  this->BaseTree::clear_and_release(pool);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::defragment(Node * arena, DefragmentationOrder order)
+{
+  this->BaseTree::defragment(arena, order);
+  this->counter().rebuild(this->BaseTree::begin(), this->BaseTree::end());
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Stream, class IdToNodeFn>
+bool
+IntervalTree<Node, NodeTraits, Options, Tag>::deserialize_shape(Stream & stream, IdToNodeFn id_to_node_fn, bool verify)
+{
+  // Every node is cached as soon as it is read, so that the maxima can use the cache
+  bool success = this->BaseTree::deserialize_shape(stream, [&](uint64_t id) {
+    Node * node = id_to_node_fn(id);
+    if (node != nullptr) {
+      Bounds::fill(*node);
+    }
+    return node;
+  }, verify);
+  // On failure, the tree is empty
+  this->counter().rebuild(this->BaseTree::begin(), this->BaseTree::end());
+  return success;
+}
+
 template<class Node, class NodeTraits, class Options, class Tag>
 void
 IntervalTree<Node, NodeTraits, Options, Tag>::fixup_maxima(Node & node) {
@@ -165,15 +696,16 @@ IntervalTree<Node, NodeTraits, Options, Tag>::query(const Comparable & q) const
     return QueryResult<Comparable>(nullptr, q);
   }
 
-  while ((cur->_rbt_left != nullptr) && (cur->_rbt_left->INB::_it_max_upper >= NodeTraits::get_lower(q))) {
+  const Key q_lower = Bounds::get_lower(q);
+  while ((cur->_rbt_left != nullptr) && (cur->_rbt_left->INB::_it_max_upper >= q_lower)) {
       cur = cur->_rbt_left;
   }
   // Everthing left of here ends too early.
 
   Node * hit;
   // If this overlaps, this is our first hit. otherwise, find the next one
-  if ((NodeTraits::get_lower(q) <= NodeTraits::get_upper(*cur)) &&
-      (NodeTraits::get_upper(q) >= NodeTraits::get_lower(*cur))) {
+  if ((q_lower <= Bounds::get_upper(*cur)) &&
+      (Bounds::get_upper(q) >= Bounds::get_lower(*cur))) {
     hit = cur;
   } else {
     hit = utilities::find_next_overlapping<Node, INB, NodeTraits, false, Comparable>(cur, q);
@@ -187,6 +719,97 @@ IntervalTree<Node, NodeTraits, Options, Tag>::query(const Comparable & q) const
   return QueryResult<Comparable>(hit, q);
 }
 
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult
+IntervalTree<Node, NodeTraits, Options, Tag>::query_point(const Key & x) const
+{
+  Node * cur = this->root;
+  if (cur == nullptr) {
+    return PointQueryResult(nullptr, x);
+  }
+
+  while ((cur->_rbt_left != nullptr) && (cur->_rbt_left->INB::_it_max_upper >= x)) {
+    cur = cur->_rbt_left;
+  }
+  // Everything left of here ends before x.
+
+  Node * hit;
+  if (Bounds::get_lower(*cur) > x) {
+    // Everything from here on starts after x
+    hit = nullptr;
+  } else if (Bounds::get_upper(*cur) >= x) {
+    hit = cur;
+  } else {
+    hit = utilities::find_next_containing<Node, INB, NodeTraits>(cur, x);
+  }
+
+  return PointQueryResult(hit, x);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Callback>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::query_point(const Key & x, Callback cb) const
+{
+  visit_containing(this->root, x, cb);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Comparable>
+size_t
+IntervalTree<Node, NodeTraits, Options, Tag>::count_overlapping(const Comparable & q) const
+{
+  static_assert(Options::overlap_counting,
+                "count_overlapping() requires the OVERLAP_COUNTING option!");
+
+  // Every interval ending before q starts before q, too. Thus, we can subtract them.
+  return this->count_starting_until(Bounds::get_upper(q)) -
+         this->counter().count_ending_before(Bounds::get_lower(q));
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+size_t
+IntervalTree<Node, NodeTraits, Options, Tag>::count_starting_until(const Key & x) const
+{
+  size_t count = 0;
+  Node * cur = this->root;
+
+  while (cur != nullptr) {
+    if (Bounds::get_lower(*cur) <= x) {
+      // cur and everything left of it starts until x
+      count += utilities::SubtreeSizes<Node, true>::get(cur->_rbt_left) + 1;
+      cur = cur->_rbt_right;
+    } else {
+      cur = cur->_rbt_left;
+    }
+  }
+
+  return count;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+template<class Callback>
+void
+IntervalTree<Node, NodeTraits, Options, Tag>::visit_containing(Node * n, const Key & x, Callback & cb)
+{
+  // Subtrees in which every interval ends before x are pruned. The right subtree is handled
+  // iteratively, so the recursion only goes as deep as the tree.
+  while ((n != nullptr) && (n->INB::_it_max_upper >= x)) {
+    visit_containing(n->_rbt_left, x, cb);
+
+    if (Bounds::get_lower(*n) > x) {
+      // n and everything right of it starts after x
+      return;
+    }
+
+    if (Bounds::get_upper(*n) >= x) {
+      cb(static_cast<const Node &>(*n));
+    }
+
+    n = n->_rbt_right;
+  }
+}
+
 template<class Node, class NodeTraits, class Options, class Tag>
 template<class Comparable>
 typename IntervalTree<Node, NodeTraits, Options, Tag>::BaseTree::template const_iterator<false>
@@ -213,6 +836,9 @@ find_next_overlapping(Node * cur, const Comparable & q)
 {
   // We search for the next bigger node, pruning the search as necessary. When
   // Pruning occurrs, we need to restart the search for the next larger node.
+  using Bounds = Endpoints<Node, INB, NodeTraits, INB::endpoint_cache>;
+  const auto q_lower = Bounds::get_lower(q);
+  const auto q_upper = Bounds::get_upper(q);
 
   do {
     //std::cout << std::flush;
@@ -224,7 +850,7 @@ find_next_overlapping(Node * cur, const Comparable & q)
       //std::cout << "Going right…";
       // go to smallest larger-or-equal child
       cur = cur->_rbt_right;
-      if (cur->INB::_it_max_upper < NodeTraits::get_lower(q)) {
+      if (cur->INB::_it_max_upper < q_lower) {
         //std::cout << "Pruning 1…";
         // Prune!
         // Nothing starting from this node can overlap b/c of upper limit. Backtrack.
@@ -247,7 +873,7 @@ find_next_overlapping(Node * cur, const Comparable & q)
         while (cur->_rbt_left != nullptr) {
           cur = cur->_rbt_left;
           //std::cout << "descending…";
-          if (cur->INB::_it_max_upper < NodeTraits::get_lower(q)) {
+          if (cur->INB::_it_max_upper < q_lower) {
             //std::cout << "Pruning 2…";
             // Prune!
             // Nothing starting from this node can overlap. Backtrack.
@@ -275,12 +901,12 @@ find_next_overlapping(Node * cur, const Comparable & q)
       }
     }
 
-    if (NodeTraits::get_lower(*cur) > NodeTraits::get_upper(q)) {
+    if (Bounds::get_lower(*cur) > q_upper) {
       // No larger node can be an overlap!
       return nullptr;
     }
 
-    if (NodeTraits::get_upper(*cur) >= NodeTraits::get_lower(q)) {
+    if (Bounds::get_upper(*cur) >= q_lower) {
       // Found!
       return cur;
     }
@@ -288,6 +914,56 @@ find_next_overlapping(Node * cur, const Comparable & q)
   } while (true);
 }
 
+template<class Node, class INB, class NodeTraits>
+Node *
+find_next_containing(Node * cur, const typename NodeTraits::key_type & x)
+{
+  // Like find_next_overlapping(), specialized to the query [x, x]. At the start of the loop,
+  // the lower bound of cur is at most x, so we only need to check the upper bound.
+  using Bounds = Endpoints<Node, INB, NodeTraits, INB::endpoint_cache>;
+
+  do {
+    if (cur->_rbt_right != nullptr) {
+      cur = cur->_rbt_right;
+      if (cur->INB::_it_max_upper < x) {
+        // Prune! Everything in this subtree ends before x. Backtrack.
+        while ((cur->_rbt_parent != nullptr) && (cur->_rbt_parent->_rbt_right == cur)) {
+          cur = cur->_rbt_parent;
+        }
+
+        if (cur->_rbt_parent == nullptr) {
+          return nullptr;
+        }
+        cur = cur->_rbt_parent;
+      } else {
+        // go to the smallest node in this subtree that can still contain x
+        while ((cur->_rbt_left != nullptr) && (cur->_rbt_left->INB::_it_max_upper >= x)) {
+          cur = cur->_rbt_left;
+        }
+      }
+    } else {
+      // skip over the nodes already visited
+      while ((cur->_rbt_parent != nullptr) && (cur->_rbt_parent->_rbt_right == cur)) {
+        cur = cur->_rbt_parent;
+      }
+
+      if (cur->_rbt_parent == nullptr) {
+        return nullptr;
+      }
+      cur = cur->_rbt_parent;
+    }
+
+    if (Bounds::get_lower(*cur) > x) {
+      // No larger node can contain x
+      return nullptr;
+    }
+
+    if (Bounds::get_upper(*cur) >= x) {
+      return cur;
+    }
+  } while (true);
+}
+
 } // namespace utilities
 
 template<class Node, class NodeTraits, class Options, class Tag>
@@ -344,7 +1020,7 @@ template<class Comparable>
 bool
 IntervalTree<Node, NodeTraits, Options, Tag>::QueryResult<Comparable>::const_iterator::operator==(const typename IntervalTree<Node, NodeTraits, Options, Tag>::template QueryResult<Comparable>::const_iterator & other) const
 {
-  return ((this->n == other.n) && (NodeTraits::get_lower(this->q) == NodeTraits::get_lower(other.q)) && (NodeTraits::get_upper(this->q) && NodeTraits::get_upper(other.q)));
+  return ((this->n == other.n) && (NodeTraits::get_lower(this->q) == NodeTraits::get_lower(other.q)) && (NodeTraits::get_upper(this->q) == NodeTraits::get_upper(other.q)));
 }
 
 template<class Node, class NodeTraits, class Options, class Tag>
@@ -397,17 +1073,73 @@ IntervalTree<Node, NodeTraits, Options, Tag>::QueryResult<Comparable>::const_ite
 }
 
 template<class Node, class NodeTraits, class Options, class Tag>
-void
-IntervalTree<Node, NodeTraits, Options, Tag>::dump_to_dot(const std::string & filename) const
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::PointQueryResult(Node * n_in, const Key & x_in)
+  : n(n_in), x(x_in)
+{}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::begin() const
 {
-  this->dump_to_dot_base(filename, [&](const Node * node) {
-    return NodeTraits::get_id(node) +
-          std::string("\n[") +
-          std::to_string(NodeTraits::get_lower(*node)) +
-          std::string(", ") +
-          std::to_string(NodeTraits::get_upper(*node)) +
-          std::string("]\n") +
-          std::string("-> ") +
-          std::to_string(node->INB::_it_max_upper);
-  });
+  return const_iterator(this->n, this->x);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::end() const
+{
+  return const_iterator(nullptr, this->x);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::const_iterator(Node * n_in, const Key & x_in)
+  : n(n_in), x(x_in)
+{}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+bool
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator==(const typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator & other) const
+{
+  return (this->n == other.n) && (this->x == other.x);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+bool
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator!=(const typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator & other) const
+{
+  return !(*this == other);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator &
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator++()
+{
+  this->n = utilities::find_next_containing<Node, INB, NodeTraits>(this->n, this->x);
+
+  return *this;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+typename IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator++(int)
+{
+  const_iterator cpy(*this);
+
+  this->operator++();
+
+  return cpy;
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+const Node &
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator*() const
+{
+  return *(this->n);
+}
+
+template<class Node, class NodeTraits, class Options, class Tag>
+const Node *
+IntervalTree<Node, NodeTraits, Options, Tag>::PointQueryResult::const_iterator::operator->() const
+{
+  return this->n;
 }
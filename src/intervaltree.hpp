@@ -2,8 +2,6 @@
 #define INTERVALTREE_HPP
 
 #include <algorithm>
-#include <string>
-#include <iostream>
 
 #include "rbtree.hpp"
 
@@ -12,19 +10,244 @@ namespace ygg {
     template<class Node, class INB, class NodeTraits, bool skipfirst, class Comparable>
     Node * find_next_overlapping(Node * cur, const Comparable & q);
 
+    template<class Node, class INB, class NodeTraits>
+    Node * find_next_containing(Node * cur, const typename NodeTraits::key_type & x);
+
     template<class KeyType>
     class DummyRange : public std::pair<KeyType, KeyType> {
     public:
       DummyRange(KeyType lower, KeyType upper);
     };
 
-	  template<class Node, class NodeTraits>
+	  template<class Node, class INB, class NodeTraits>
 	  class IntervalCompare {
 	  public:
 		  template<class T1, class T2>
 		  bool operator()(const T1 & lhs, const T2 & rhs) const;
 	  };
 
+	  template<class KeyType, bool enable>
+	  class EndpointCacheHolder {};
+
+	  template<class KeyType>
+	  class EndpointCacheHolder<KeyType, true> {
+	  public:
+		  EndpointCacheHolder() : _it_endpoints_cached(false) {}
+		  // A copy is not in any tree, and its bounds may be changed at will
+		  EndpointCacheHolder(const EndpointCacheHolder & other)
+		    : _it_endpoints_cached(false) { (void)other; }
+		  EndpointCacheHolder & operator=(const EndpointCacheHolder & other) {
+			  (void)other;
+			  this->_it_endpoints_cached = false;
+			  return *this;
+		  }
+
+		  KeyType _it_lower;
+		  KeyType _it_upper;
+		  bool _it_endpoints_cached;
+	  };
+
+	  /*
+	   * Reads the bounds of nodes and queries. With TreeFlags::ENDPOINT_CACHE, the bounds of a
+	   * node are read from its cache if they have been cached, i.e., if the node is in the tree.
+	   * Everything else is read via the NodeTraits.
+	   */
+	  template<class Node, class INB, class NodeTraits, bool enable>
+	  class Endpoints {
+	  public:
+		  using Key = typename NodeTraits::key_type;
+
+		  template<class Comparable>
+		  static Key get_lower(const Comparable & q) { return NodeTraits::get_lower(q); }
+		  template<class Comparable>
+		  static Key get_upper(const Comparable & q) { return NodeTraits::get_upper(q); }
+
+		  static void fill(Node & node) { (void)node; }
+		  static void invalidate(Node & node) { (void)node; }
+		  static void relocated(Node & from, Node & to) { (void)from; (void)to; }
+		  template<class Iterator>
+		  static void invalidate_all(Iterator begin, Iterator end) { (void)begin; (void)end; }
+		  static bool verify(const Node * node) { (void)node; return true; }
+	  };
+
+	  template<class Node, class INB, class NodeTraits>
+	  class Endpoints<Node, INB, NodeTraits, true> {
+	  public:
+		  using Key = typename NodeTraits::key_type;
+
+		  template<class Comparable>
+		  static Key get_lower(const Comparable & q) { return NodeTraits::get_lower(q); }
+		  template<class Comparable>
+		  static Key get_upper(const Comparable & q) { return NodeTraits::get_upper(q); }
+		  static Key get_lower(const Node & node);
+		  static Key get_upper(const Node & node);
+
+		  static void fill(Node & node);
+		  static void invalidate(Node & node);
+		  static void relocated(Node & from, Node & to);
+		  template<class Iterator>
+		  static void invalidate_all(Iterator begin, Iterator end);
+		  static bool verify(const Node * node);
+	  };
+
+	  /*
+	   * Keeps the number of nodes in every subtree in a member _it_size, if enabled. The
+	   * RBTree hooks of both indices of an IntervalTree with OVERLAP_COUNTING call these.
+	   */
+	  template<class Node, bool enable>
+	  class SubtreeSizes {
+	  public:
+		  static void leaf_inserted(Node & node) { (void)node; }
+		  static void delete_leaf(Node & node) { (void)node; }
+		  static void rotated(Node & node) { (void)node; }
+		  static void swapped(Node & n1, Node & n2) { (void)n1; (void)n2; }
+		  static void relocated(Node & from, Node & to) { (void)from; (void)to; }
+		  static void recompute(Node & node) { (void)node; }
+		  static bool verify(const Node * node) { (void)node; return true; }
+	  };
+
+	  template<class Node>
+	  class SubtreeSizes<Node, true> {
+	  public:
+		  static size_t get(const Node * node);
+
+		  static void leaf_inserted(Node & node);
+		  static void delete_leaf(Node & node);
+		  static void rotated(Node & node);
+		  static void swapped(Node & n1, Node & n2);
+		  static void relocated(Node & from, Node & to);
+		  static void recompute(Node & node);
+		  static bool verify(const Node * node);
+	  };
+
+	  /*
+	   * A node of the second index of an IntervalTree with OVERLAP_COUNTING. It is ordered by the
+	   * upper bound first and by the lower bound second, so that two intervals compare equally in
+	   * both indices or in none. The bounds are copied, so that the index never has to look at
+	   * the interval tree's node.
+	   */
+	  template<class KeyType, class Options>
+	  class UpperEndpointNode : public RBTreeNodeBase<UpperEndpointNode<KeyType, Options>, Options> {
+	  public:
+		  KeyType _it_lower;
+		  KeyType _it_upper;
+		  size_t _it_size;
+
+		  bool operator<(const UpperEndpointNode & other) const {
+			  return (this->_it_upper < other._it_upper) ||
+			         ((this->_it_upper == other._it_upper) && (this->_it_lower < other._it_lower));
+		  }
+	  };
+
+	  template<class Node>
+	  class UpperEndpointTraits : public RBDefaultNodeTraits<Node> {
+	  public:
+		  static void leaf_inserted(Node & node) { SubtreeSizes<Node, true>::leaf_inserted(node); }
+		  static void rotated_left(Node & node) { SubtreeSizes<Node, true>::rotated(node); }
+		  static void rotated_right(Node & node) { SubtreeSizes<Node, true>::rotated(node); }
+		  static void delete_leaf(Node & node) { SubtreeSizes<Node, true>::delete_leaf(node); }
+		  static void swapped(Node & n1, Node & n2) { SubtreeSizes<Node, true>::swapped(n1, n2); }
+		  static void relocated(Node & from, Node & to) {
+			  SubtreeSizes<Node, true>::relocated(from, to);
+		  }
+		  static void subtree_rebuilt(Node & node) { SubtreeSizes<Node, true>::recompute(node); }
+	  };
+
+	  // Removals are marked in both indices, so the second one needs DEFERRED_REMOVAL, too
+	  template<class Options>
+	  using UpperEndpointOptions = typename std::conditional<Options::multiple,
+	          typename std::conditional<Options::deferred_removal,
+	                                    TreeOptions<TreeFlags::MULTIPLE, TreeFlags::DEFERRED_REMOVAL>,
+	                                    TreeOptions<TreeFlags::MULTIPLE>>::type,
+	          typename std::conditional<Options::deferred_removal,
+	                                    TreeOptions<TreeFlags::DEFERRED_REMOVAL>,
+	                                    TreeOptions<>>::type>::type;
+
+	  template<class KeyType, class Options, bool enable>
+	  class OverlapCountHolder {};
+
+	  template<class KeyType, class Options>
+	  class OverlapCountHolder<KeyType, Options, true> {
+	  public:
+		  size_t _it_size;
+		  UpperEndpointNode<KeyType, UpperEndpointOptions<Options>> _it_upper_node;
+	  };
+
+	  /*
+	   * The second index of an IntervalTree with OVERLAP_COUNTING. If disabled, it does nothing.
+	   */
+	  template<class Node, class NodeTraits, class Options, bool enable>
+	  class OverlapCounter {
+	  public:
+		  void insert(Node & node) { (void)node; }
+		  void remove(Node & node) { (void)node; }
+		  void reposition(Node & node, bool still_in_tree) { (void)node; (void)still_in_tree; }
+		  void replace_node(Node & old_node, Node & new_node) { (void)old_node; (void)new_node; }
+		  void relocate(Node & from, Node & to) { (void)from; (void)to; }
+		  void mark_for_removal(Node & node) { (void)node; }
+		  void flush_removals(double rebuild_fraction) { (void)rebuild_fraction; }
+		  void merge(const OverlapCounter & other) { (void)other; }
+		  void clear() {}
+		  template<class Iterator>
+		  void rebuild(Iterator begin, Iterator end) { (void)begin; (void)end; }
+		  bool verify_integrity(const Node * primary_root) const { (void)primary_root; return true; }
+	  };
+
+	  template<class Node, class NodeTraits, class Options>
+	  class OverlapCounter<Node, NodeTraits, Options, true> {
+	  public:
+		  using Key = typename NodeTraits::key_type;
+		  using UpperOptions = UpperEndpointOptions<Options>;
+		  using UpperNode = UpperEndpointNode<Key, UpperOptions>;
+		  using UpperTree = RBTree<UpperNode, UpperEndpointTraits<UpperNode>, UpperOptions>;
+
+		  void insert(Node & node);
+		  void remove(Node & node);
+		  void reposition(Node & node, bool still_in_tree);
+		  void replace_node(Node & old_node, Node & new_node);
+		  void relocate(Node & from, Node & to);
+		  void mark_for_removal(Node & node);
+		  void flush_removals(double rebuild_fraction);
+		  void merge(OverlapCounter & other);
+		  void clear();
+		  template<class Iterator>
+		  void rebuild(Iterator begin, Iterator end);
+		  bool verify_integrity(const Node * primary_root) const;
+
+		  // Number of intervals whose upper bound is smaller than x
+		  size_t count_ending_before(const Key & x) const;
+
+	  private:
+		  static void copy_bounds(Node & node);
+
+		  UpperTree tree;
+	  };
+
+	  /*
+	   * Holds the OverlapCounter of an IntervalTree. The IntervalTree derives from this, so that a
+	   * disabled counter takes no space. Disabled counters are stateless, so counter() just hands
+	   * out a fresh one.
+	   */
+	  template<class Node, class NodeTraits, class Options, bool enable>
+	  class OverlapCounterHolder {
+	  public:
+		  using Counter = OverlapCounter<Node, NodeTraits, Options, enable>;
+
+		  Counter & counter() { return this->c; }
+		  const Counter & counter() const { return this->c; }
+
+	  private:
+		  Counter c;
+	  };
+
+	  template<class Node, class NodeTraits, class Options>
+	  class OverlapCounterHolder<Node, NodeTraits, Options, false> {
+	  public:
+		  using Counter = OverlapCounter<Node, NodeTraits, Options, false>;
+
+		  Counter counter() const { return Counter(); }
+	  };
+
 	  // TODO add a possibility for bulk updates
 	  template<class Node, class NB, class NodeTraits>
 	  class ExtendedNodeTraits : public NodeTraits {
@@ -35,19 +258,35 @@ namespace ygg {
 		  static void rotated_left(Node & node);
 		  static void rotated_right(Node & node);
 		  static void deleted_below(Node & node);
-		  static void delete_leaf(Node & node) { (void) node; };
+		  static void delete_leaf(Node & node);
 		  static void swapped(Node & n1, Node & n2);
+		  static void relocated(Node & from, Node & to);
+		  static void subtree_rebuilt(Node & node);
+		  static void key_changed(Node & node);
 
 		  // Make our DummyRange comparable
 		  static typename NodeTraits::key_type get_lower(const utilities::DummyRange<typename NodeTraits::key_type> & range);
 		  static typename NodeTraits::key_type get_upper(const utilities::DummyRange<typename NodeTraits::key_type> & range);
+
+	  private:
+		  using Sizes = SubtreeSizes<Node, NB::overlap_counting>;
+		  using Bounds = Endpoints<Node, NB, NodeTraits, NB::endpoint_cache>;
 	  };
   } // namespace utilities
 
 template<class Node, class NodeTraits, class Options = DefaultOptions, class Tag = int>
-class ITreeNodeBase : public RBTreeNodeBase<Node, Options, Tag> {
+class ITreeNodeBase : public RBTreeNodeBase<Node, Options, Tag>,
+                      public utilities::OverlapCountHolder<typename NodeTraits::key_type, Options,
+                                                           Options::overlap_counting>,
+                      public utilities::EndpointCacheHolder<typename NodeTraits::key_type,
+                                                            Options::endpoint_cache> {
 public:
   typename NodeTraits::key_type    _it_max_upper;
+
+  /// @cond INTERNAL
+  static constexpr bool overlap_counting = Options::overlap_counting;
+  static constexpr bool endpoint_cache = Options::endpoint_cache;
+  /// @endcond
 };
 
 /**
@@ -101,7 +340,9 @@ class IntervalTree : public RBTree<Node,
                                    utilities::ExtendedNodeTraits<Node,
                                                                  ITreeNodeBase<Node, NodeTraits, Options, Tag>,
                                                                  NodeTraits>,
-                                   Options, Tag, utilities::IntervalCompare<Node, NodeTraits>>
+                                   Options, Tag, utilities::IntervalCompare<Node, ITreeNodeBase<Node, NodeTraits, Options, Tag>, NodeTraits>>,
+                     private utilities::OverlapCounterHolder<Node, NodeTraits, Options,
+                                                             Options::overlap_counting>
 {
 public:
   using Key = typename NodeTraits::key_type;
@@ -114,16 +355,55 @@ public:
 	static_assert(std::is_base_of<ITreeNodeTraits<Node>, NodeTraits>::value,
 	              "NodeTraits not properly derived from ITreeNodeTraits!");
 
+	static_assert(!Options::equality_buckets,
+	              "EQUALITY_BUCKETS is not supported by the IntervalTree!");
+
   using ENodeTraits = utilities::ExtendedNodeTraits<Node, INB, NodeTraits>;
   using BaseTree = RBTree<Node, utilities::ExtendedNodeTraits<Node, INB, NodeTraits>, Options, Tag,
-					                utilities::IntervalCompare<Node, NodeTraits>>;
+					                utilities::IntervalCompare<Node, INB, NodeTraits>>;
 
 
 
   IntervalTree();
 
   bool verify_integrity() const;
-  void dump_to_dot(const std::string & filename) const;
+
+  /**
+   * @name Modification
+   *
+   * These do exactly what the RBTree methods of the same names do. If OVERLAP_COUNTING is set,
+   * they additionally keep the index of upper bounds up to date. If ENDPOINT_CACHE is set, they
+   * cache the bounds of the nodes they add to the tree. Without either, they only forward to the
+   * RBTree.
+   *
+   * defragment() and deserialize_shape() rebuild the index of upper bounds from scratch,
+   * which takes O(n log n). With ENDPOINT_CACHE, clear() visits every node and takes O(n).
+   */
+  ///@{
+  void insert(Node & node);
+  void insert(Node & node, Node & hint);
+  void insert(Node & node, typename BaseTree::template iterator<false> hint);
+  void insert_left_leaning(Node & node);
+  void insert_right_leaning(Node & node);
+  std::pair<typename BaseTree::template iterator<false>, bool> insert_unique(Node & node);
+  typename BaseTree::template iterator<false>
+  insert_commit(Node & node, const typename BaseTree::InsertCommitData & commit_data);
+  void remove(Node & node);
+  bool reposition(Node & node);
+  void replace_node(Node & old_node, Node & new_node);
+  void relocate(Node & from, Node & to);
+  void mark_for_removal(Node & node);
+  size_t flush_removals(double rebuild_fraction = 0.1);
+  void merge(IntervalTree & other);
+  void clear();
+  template<class Callback>
+  void drain(Callback callback);
+  template<class Pool>
+  void clear_and_release(Pool & pool);
+  void defragment(Node * arena, DefragmentationOrder order = DefragmentationOrder::IN_ORDER);
+  template<class Stream, class IdToNodeFn>
+  bool deserialize_shape(Stream & stream, IdToNodeFn id_to_node_fn, bool verify = false);
+  ///@}
 
   // Iteration of sets of intervals
   template <class Comparable>
@@ -169,6 +449,82 @@ public:
   template<class Comparable>
   QueryResult<Comparable> query(const Comparable & q) const;
 
+  // Iteration of the intervals containing a point
+  class PointQueryResult {
+  public:
+    class const_iterator {
+    public:
+      typedef ptrdiff_t                         difference_type;
+      typedef Node                              value_type;
+      typedef const Node &                      const_reference;
+      typedef const Node *                      const_pointer;
+      typedef std::input_iterator_tag           iterator_category;
+
+      const_iterator (Node * n, const Key & x);
+
+      bool operator==(const const_iterator & other) const;
+      bool operator!=(const const_iterator & other) const;
+
+      const_iterator& operator++();
+      const_iterator operator++(int);
+
+      const_reference operator*() const;
+      const_pointer operator->() const;
+
+    private:
+      Node * n;
+      Key x;
+    };
+
+    PointQueryResult(Node * n, const Key & x);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+  private:
+    Node * n;
+    Key x;
+  };
+
+  /**
+   * @brief Finds all intervals containing a point
+   *
+   * Returns the intervals [lower, upper] with lower <= x <= upper, in the order of the tree.
+   * This does the same as query() with the degenerate interval [x, x], but the search is
+   * specialized for a single point: it prunes every subtree whose maximum upper bound lies
+   * before x, and stops at the first interval starting after x.
+   *
+   * @param x The point to query for
+   * @return An iterable over all intervals containing x
+   */
+  PointQueryResult query_point(const Key & x) const;
+
+  /**
+   * @brief Calls a function for every interval containing a point
+   *
+   * The same as query_point(x), but instead of returning an iterable, cb(const Node &) is called
+   * for every interval containing x, in the order of the tree. This walks the tree recursively and
+   * does not need to find the next hit from scratch after every hit.
+   *
+   * @param x   The point to query for
+   * @param cb  The function to call for every interval containing x
+   */
+  template<class Callback>
+  void query_point(const Key & x, Callback cb) const;
+
+  /**
+   * @brief Counts the intervals overlapping a query interval
+   *
+   * Returns the number of intervals that query() would return for <q>, without enumerating
+   * them. This takes O(log n), no matter how many intervals overlap <q>.
+   *
+   * @warning Only available if OVERLAP_COUNTING is set
+   *
+   * @param q The query interval. Its lower bound must not be larger than its upper bound.
+   * @return The number of intervals overlapping q
+   */
+  template<class Comparable>
+  size_t count_overlapping(const Comparable & q) const;
+
   template<class Comparable>
   typename BaseTree::template const_iterator<false> interval_upper_bound(const Comparable & query_range) const;
 
@@ -177,6 +533,16 @@ public:
 
 private:
   bool verify_maxima(Node * n) const;
+
+  void finish_insert(Node & node, bool inserted);
+
+  // Number of intervals whose lower bound is at most x
+  size_t count_starting_until(const Key & x) const;
+
+  using Bounds = utilities::Endpoints<Node, INB, NodeTraits, Options::endpoint_cache>;
+
+  template<class Callback>
+  static void visit_containing(Node * n, const Key & x, Callback & cb);
 };
 
 #include "intervaltree.cpp"
@@ -0,0 +1,232 @@
+#include "multi_index.hpp"
+
+namespace ygg {
+
+template<class Node, class ... Indices>
+MultiIndex<Node, Indices...>::MultiIndex()
+	: indices(), count(0)
+{}
+
+template<class Node, class ... Indices>
+bool
+MultiIndex<Node, Indices...>::insert(Node & node)
+{
+	CommitSlots slots;
+	if (!this->check_all<0>(node, slots)) {
+		return false;
+	}
+
+	this->commit_all<0>(node, slots);
+	this->count++;
+	return true;
+}
+
+template<class Node, class ... Indices>
+void
+MultiIndex<Node, Indices...>::remove(Node & node)
+{
+	bool skip[index_count] = {};
+	this->remove_all<0>(node, skip);
+	this->count--;
+}
+
+template<class Node, class ... Indices>
+template<class Fn>
+bool
+MultiIndex<Node, Indices...>::modify(Node & node, Fn fn)
+{
+	fn(node);
+
+	// Indexes that already dropped <node> because of a collision
+	bool removed[index_count] = {};
+	if (this->reposition_all<0>(node, removed)) {
+		return true;
+	}
+
+	this->remove_all<0>(node, removed);
+	this->count--;
+	return false;
+}
+
+template<class Node, class ... Indices>
+void
+MultiIndex<Node, Indices...>::clear()
+{
+	this->clear_all<0>();
+	this->count = 0;
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename MultiIndex<Node, Indices...>::template Index<i> &
+MultiIndex<Node, Indices...>::get()
+{
+	return std::get<i>(this->indices);
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+const typename MultiIndex<Node, Indices...>::template Index<i> &
+MultiIndex<Node, Indices...>::get() const
+{
+	return std::get<i>(this->indices);
+}
+
+template<class Node, class ... Indices>
+size_t
+MultiIndex<Node, Indices...>::size() const
+{
+	return this->count;
+}
+
+template<class Node, class ... Indices>
+bool
+MultiIndex<Node, Indices...>::empty() const
+{
+	return this->count == 0;
+}
+
+/*
+ * Checks whether index i and all following indexes accept <node>, stopping at the first
+ * rejection
+ */
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i < MultiIndex<Node, Indices...>::index_count), bool>::type
+MultiIndex<Node, Indices...>::check_all(Node & node, CommitSlots & slots)
+{
+	if (!check_one(std::get<i>(this->indices), node, std::get<i>(slots))) {
+		return false;
+	}
+	return this->check_all<i + 1>(node, slots);
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i == MultiIndex<Node, Indices...>::index_count), bool>::type
+MultiIndex<Node, Indices...>::check_all(Node & node, CommitSlots & slots)
+{
+	(void)node;
+	(void)slots;
+	return true;
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i < MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::commit_all(Node & node, CommitSlots & slots)
+{
+	commit_one(std::get<i>(this->indices), node, std::get<i>(slots));
+	this->commit_all<i + 1>(node, slots);
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i == MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::commit_all(Node & node, CommitSlots & slots)
+{
+	(void)node;
+	(void)slots;
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i < MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::remove_all(Node & node, const bool * skip)
+{
+	if (!skip[i]) {
+		std::get<i>(this->indices).remove(node);
+	}
+	this->remove_all<i + 1>(node, skip);
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i == MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::remove_all(Node & node, const bool * skip)
+{
+	(void)node;
+	(void)skip;
+}
+
+/*
+ * Repositions <node> in index i and all following indexes. Returns false if any of them
+ * removed <node>, and records which ones did in <removed>.
+ */
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i < MultiIndex<Node, Indices...>::index_count), bool>::type
+MultiIndex<Node, Indices...>::reposition_all(Node & node, bool * removed)
+{
+	removed[i] = !std::get<i>(this->indices).reposition(node);
+	bool rest_kept = this->reposition_all<i + 1>(node, removed);
+	return !removed[i] && rest_kept;
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i == MultiIndex<Node, Indices...>::index_count), bool>::type
+MultiIndex<Node, Indices...>::reposition_all(Node & node, bool * removed)
+{
+	(void)node;
+	(void)removed;
+	return true;
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i < MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::clear_all()
+{
+	std::get<i>(this->indices).clear();
+	this->clear_all<i + 1>();
+}
+
+template<class Node, class ... Indices>
+template<size_t i>
+typename std::enable_if<(i == MultiIndex<Node, Indices...>::index_count), void>::type
+MultiIndex<Node, Indices...>::clear_all()
+{}
+
+template<class Node, class ... Indices>
+template<class Tree>
+typename std::enable_if<!Tree::allows_equal_elements, bool>::type
+MultiIndex<Node, Indices...>::check_one(Tree & t, Node & node,
+                                        utilities::MultiIndexCommitSlot<Tree> & slot)
+{
+	slot.data = t.insert_check(node);
+	return slot.data.existing == nullptr;
+}
+
+template<class Node, class ... Indices>
+template<class Tree>
+typename std::enable_if<Tree::allows_equal_elements, bool>::type
+MultiIndex<Node, Indices...>::check_one(Tree & t, Node & node,
+                                        utilities::MultiIndexCommitSlot<Tree> & slot)
+{
+	(void)t;
+	(void)node;
+	(void)slot;
+	return true;
+}
+
+template<class Node, class ... Indices>
+template<class Tree>
+typename std::enable_if<!Tree::allows_equal_elements, void>::type
+MultiIndex<Node, Indices...>::commit_one(Tree & t, Node & node,
+                                         utilities::MultiIndexCommitSlot<Tree> & slot)
+{
+	t.insert_commit(node, slot.data);
+}
+
+template<class Node, class ... Indices>
+template<class Tree>
+typename std::enable_if<Tree::allows_equal_elements, void>::type
+MultiIndex<Node, Indices...>::commit_one(Tree & t, Node & node,
+                                         utilities::MultiIndexCommitSlot<Tree> & slot)
+{
+	(void)slot;
+	t.insert(node);
+}
+
+} // namespace ygg
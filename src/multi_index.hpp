@@ -0,0 +1,200 @@
+#ifndef YGG_MULTI_INDEX_HPP
+#define YGG_MULTI_INDEX_HPP
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+
+#include "rbtree.hpp"
+
+namespace ygg {
+
+namespace utilities {
+/// @cond INTERNAL
+/*
+ * What MultiIndex::insert() remembers about one index between checking and committing. Only
+ * trees without MULTIPLE can reject a node, and for those, the position found by insert_check()
+ * is kept so that committing does not descend again.
+ */
+template<class Tree, bool allows_equal = Tree::allows_equal_elements>
+class MultiIndexCommitSlot {
+public:
+	typename Tree::InsertCommitData data;
+};
+
+template<class Tree>
+class MultiIndexCommitSlot<Tree, true> {};
+/// @endcond
+} // namespace utilities
+
+/**
+ * @brief A container that keeps the same nodes in several trees at once
+ *
+ * With Tags, a node can be part of several RBTrees (or IntervalTrees etc.) that order it by
+ * different keys. MultiIndex bundles such trees - the indexes - and inserts nodes into or
+ * removes them from all indexes at once.
+ *
+ * Indexes without MULTIPLE can reject a node because an equal element is already present. For
+ * those, insert() first checks every such index with RBTree::insert_check() and only modifies
+ * the indexes if none of them rejects the node. A rejected insertion thus leaves all indexes
+ * untouched, and an accepted one reuses the positions found while checking, so that every index
+ * is descended only once.
+ *
+ * Example, indexing persons by a unique ID and by a non-unique name:
+ *
+ * @code{.c++}
+ * class ById {};
+ * class ByName {};
+ * using IdOptions = TreeOptions<>;
+ * using NameOptions = TreeOptions<TreeFlags::MULTIPLE>;
+ *
+ * class Person : public RBTreeNodeBase<Person, IdOptions, ById>,
+ *                public RBTreeNodeBase<Person, NameOptions, ByName> { … };
+ *
+ * using Persons = MultiIndex<Person,
+ *                            RBTree<Person, RBDefaultNodeTraits<Person>, IdOptions, ById, IdCmp>,
+ *                            RBTree<Person, RBDefaultNodeTraits<Person>, NameOptions, ByName,
+ *                                   NameCmp>>;
+ * @endcode
+ *
+ * @tparam Node 		The node class. Must be derived from the node base of every index.
+ * @tparam Indices 	The tree classes, each with its own Tag.
+ */
+template<class Node, class ... Indices>
+class MultiIndex {
+public:
+	static_assert(sizeof...(Indices) > 0, "A MultiIndex needs at least one index");
+
+	/// The number of indexes
+	static constexpr size_t index_count = sizeof...(Indices);
+
+	/// The tree class of the index at position i
+	template<size_t i>
+	using Index = typename std::tuple_element<i, std::tuple<Indices...>>::type;
+
+	MultiIndex();
+
+	/**
+	 * @brief Inserts <node> into all indexes, or into none
+	 *
+	 * If an index without MULTIPLE already contains an element comparing equally to <node>,
+	 * nothing is changed.
+	 *
+	 * @param node 	The node to be inserted. Must not be in any of the indexes.
+	 * @return true if <node> was inserted, false if it was rejected
+	 */
+	bool insert(Node & node);
+
+	/**
+	 * @brief Removes <node> from all indexes
+	 *
+	 * @param node 	The node to be removed. Must be in the container.
+	 */
+	void remove(Node & node);
+
+	/**
+	 * @brief Changes the keys of <node> and restores the order of all indexes
+	 *
+	 * Calls fn(node), which may change any of the keys of <node>. Afterwards, RBTree::reposition()
+	 * is called on every index. An index whose key of <node> did not change is left as it is,
+	 * which costs up to two comparisons with the neighbors of <node>.
+	 *
+	 * If an index without MULTIPLE now contains another element comparing equally to <node>,
+	 * <node> is removed from all indexes, so that it is either in all of them or in none.
+	 *
+	 * @param node 	The node to be modified. Must be in the container.
+	 * @param fn 		Called as fn(Node &)
+	 * @return true if <node> is still in the container, false if it was removed
+	 */
+	template<class Fn>
+	bool modify(Node & node, Fn fn);
+
+	/**
+	 * @brief Removes all nodes from all indexes
+	 */
+	void clear();
+
+	/**
+	 * @brief Returns the index at position i
+	 *
+	 * Use it for everything but modifications, e.g., to search or iterate. Inserting into or
+	 * removing from an index directly leaves the indexes out of sync.
+	 *
+	 * @tparam i 	The position of the index in Indices
+	 * @return The tree of that index
+	 */
+	template<size_t i>
+	Index<i> & get();
+	template<size_t i>
+	const Index<i> & get() const;
+
+	/**
+	 * @brief Returns the number of nodes in the container
+	 */
+	size_t size() const;
+
+	/**
+	 * @brief Returns whether the container is empty
+	 */
+	bool empty() const;
+
+private:
+	using CommitSlots = std::tuple<utilities::MultiIndexCommitSlot<Indices>...>;
+
+	template<size_t i>
+	typename std::enable_if<(i < index_count), bool>::type check_all(Node & node,
+	                                                                   CommitSlots & slots);
+	template<size_t i>
+	typename std::enable_if<(i == index_count), bool>::type check_all(Node & node,
+	                                                                    CommitSlots & slots);
+
+	template<size_t i>
+	typename std::enable_if<(i < index_count), void>::type commit_all(Node & node,
+	                                                                    CommitSlots & slots);
+	template<size_t i>
+	typename std::enable_if<(i == index_count), void>::type commit_all(Node & node,
+	                                                                     CommitSlots & slots);
+
+	template<size_t i>
+	typename std::enable_if<(i < index_count), void>::type remove_all(Node & node,
+	                                                                    const bool * skip);
+	template<size_t i>
+	typename std::enable_if<(i == index_count), void>::type remove_all(Node & node,
+	                                                                     const bool * skip);
+
+	template<size_t i>
+	typename std::enable_if<(i < index_count), bool>::type reposition_all(Node & node,
+	                                                                        bool * removed);
+	template<size_t i>
+	typename std::enable_if<(i == index_count), bool>::type reposition_all(Node & node,
+	                                                                         bool * removed);
+
+	template<size_t i>
+	typename std::enable_if<(i < index_count), void>::type clear_all();
+	template<size_t i>
+	typename std::enable_if<(i == index_count), void>::type clear_all();
+
+	// Dispatch for indexes with and without MULTIPLE
+	template<class Tree>
+	static typename std::enable_if<!Tree::allows_equal_elements, bool>::type
+	check_one(Tree & t, Node & node, utilities::MultiIndexCommitSlot<Tree> & slot);
+	template<class Tree>
+	static typename std::enable_if<Tree::allows_equal_elements, bool>::type
+	check_one(Tree & t, Node & node, utilities::MultiIndexCommitSlot<Tree> & slot);
+
+	template<class Tree>
+	static typename std::enable_if<!Tree::allows_equal_elements, void>::type
+	commit_one(Tree & t, Node & node, utilities::MultiIndexCommitSlot<Tree> & slot);
+	template<class Tree>
+	static typename std::enable_if<Tree::allows_equal_elements, void>::type
+	commit_one(Tree & t, Node & node, utilities::MultiIndexCommitSlot<Tree> & slot);
+
+	std::tuple<Indices...> indices;
+	size_t count;
+};
+
+} // namespace ygg
+
+#include "multi_index.cpp"
+
+#endif //YGG_MULTI_INDEX_HPP
@@ -0,0 +1,247 @@
+#include "node_pool.hpp"
+
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace ygg {
+
+template<class Node>
+thread_local typename NodePool<Node>::LocalCache NodePool<Node>::local_cache;
+
+template<class Node>
+NodePool<Node>::NodePool(size_t nodes_per_slab_in, bool use_huge_pages_in)
+	: nodes_per_slab(nodes_per_slab_in > 0 ? nodes_per_slab_in : 1),
+	  use_huge_pages(use_huge_pages_in), slabs(), shared(std::make_shared<Shared>())
+{}
+
+template<class Node>
+NodePool<Node>::~NodePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->shared->m);
+		this->shared->alive = false;
+		this->shared->free = nullptr;
+	}
+
+	// Other threads notice that we're gone the next time they use their cache
+	LocalCache & cache = local_cache;
+	if (cache.shared == this->shared) {
+		cache.head = nullptr;
+		cache.count = 0;
+		cache.shared.reset();
+	}
+
+	for (const Slab & slab : this->slabs) {
+#ifdef __linux__
+		if (slab.mapped) {
+			munmap(slab.mem, slab.bytes);
+			continue;
+		}
+#endif
+		::operator delete(slab.mem);
+	}
+}
+
+template<class Node>
+template<class ... Args>
+Node *
+NodePool<Node>::construct(Args && ... args)
+{
+	Node * mem = this->allocate();
+	return new (static_cast<void *>(mem)) Node(std::forward<Args>(args)...);
+}
+
+template<class Node>
+void
+NodePool<Node>::destroy(Node * node)
+{
+	node->~Node();
+	this->deallocate(node);
+}
+
+template<class Node>
+Node *
+NodePool<Node>::allocate()
+{
+	LocalCache & cache = this->get_local_cache();
+	if (cache.count == 0) {
+		this->refill(cache);
+	}
+
+	FreeSlot * slot = cache.head;
+	cache.head = slot->next;
+	cache.count--;
+
+	return reinterpret_cast<Node *>(slot);
+}
+
+template<class Node>
+void
+NodePool<Node>::deallocate(Node * node)
+{
+	LocalCache & cache = this->get_local_cache();
+
+	FreeSlot * slot = reinterpret_cast<FreeSlot *>(node);
+	slot->next = cache.head;
+	cache.head = slot;
+	cache.count++;
+
+	if (cache.count > 2 * LOCAL_BATCH) {
+		cache.flush(LOCAL_BATCH);
+	}
+}
+
+template<class Node>
+size_t
+NodePool<Node>::get_slab_count() const
+{
+	std::lock_guard<std::mutex> lock(this->shared->m);
+	return this->slabs.size();
+}
+
+template<class Node>
+bool
+NodePool<Node>::uses_huge_pages() const
+{
+	std::lock_guard<std::mutex> lock(this->shared->m);
+	for (const Slab & slab : this->slabs) {
+		if (slab.huge) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template<class Node>
+typename NodePool<Node>::LocalCache &
+NodePool<Node>::get_local_cache()
+{
+	LocalCache & cache = local_cache;
+	if (cache.shared != this->shared) {
+		// This thread last used a different pool for this node class
+		cache.flush(0);
+		cache.shared = this->shared;
+	}
+
+	return cache;
+}
+
+template<class Node>
+void
+NodePool<Node>::refill(LocalCache & cache)
+{
+	std::lock_guard<std::mutex> lock(this->shared->m);
+
+	if (this->shared->free == nullptr) {
+		this->add_slab();
+	}
+
+	while ((this->shared->free != nullptr) && (cache.count < LOCAL_BATCH)) {
+		FreeSlot * slot = this->shared->free;
+		this->shared->free = slot->next;
+
+		slot->next = cache.head;
+		cache.head = slot;
+		cache.count++;
+	}
+}
+
+/*
+ * Must be called with the shared lock held.
+ */
+template<class Node>
+void
+NodePool<Node>::add_slab()
+{
+	Slab slab;
+	slab.bytes = this->nodes_per_slab * slot_size;
+	slab.mapped = false;
+	slab.huge = false;
+	slab.mem = nullptr;
+
+	char * begin = nullptr;
+
+#ifdef __linux__
+	if (this->use_huge_pages) {
+		slab.bytes = ((slab.bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+
+		void * mem = mmap(nullptr, slab.bytes, PROT_READ | PROT_WRITE,
+		                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem != MAP_FAILED) {
+			slab.huge = true;
+		} else {
+			// No huge pages reserved. Fall back to transparent huge pages.
+			mem = mmap(nullptr, slab.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			           -1, 0);
+			if (mem == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+#ifdef MADV_HUGEPAGE
+			madvise(mem, slab.bytes, MADV_HUGEPAGE);
+#endif
+		}
+
+		slab.mem = mem;
+		slab.mapped = true;
+		begin = static_cast<char *>(mem);
+	}
+#endif
+
+	if (!slab.mapped) {
+		// Over-allocate so that the first slot can be aligned
+		slab.mem = ::operator new(slab.bytes + slot_align);
+		uintptr_t addr = reinterpret_cast<uintptr_t>(slab.mem);
+		addr = ((addr + slot_align - 1) / slot_align) * slot_align;
+		begin = reinterpret_cast<char *>(addr);
+	}
+
+	this->slabs.push_back(slab);
+
+	// Link the slots back to front, so that they are handed out in ascending address order
+	size_t slot_count = slab.bytes / slot_size;
+	for (size_t i = slot_count ; i > 0 ; --i) {
+		FreeSlot * slot = reinterpret_cast<FreeSlot *>(begin + (i - 1) * slot_size);
+		slot->next = this->shared->free;
+		this->shared->free = slot;
+	}
+}
+
+template<class Node>
+NodePool<Node>::LocalCache::~LocalCache()
+{
+	this->flush(0);
+}
+
+template<class Node>
+void
+NodePool<Node>::LocalCache::flush(size_t keep)
+{
+	if (this->shared == nullptr) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(this->shared->m);
+
+	if (!this->shared->alive) {
+		// The pool and its memory are gone. Just forget about the nodes.
+		this->head = nullptr;
+		this->count = 0;
+		return;
+	}
+
+	while (this->count > keep) {
+		FreeSlot * slot = this->head;
+		this->head = slot->next;
+		this->count--;
+
+		slot->next = this->shared->free;
+		this->shared->free = slot;
+	}
+}
+
+} // namespace ygg
@@ -0,0 +1,158 @@
+#ifndef YGG_NODE_POOL_HPP
+#define YGG_NODE_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ygg {
+
+/**
+ * @brief A slab allocator for tree nodes
+ *
+ * Since all trees in this library are intrusive, you must take care of storing the nodes
+ * yourself. NodePool is an allocator that does this for one node class. Nodes are carved out of
+ * large slabs, so that nodes allocated together are close in memory. Nodes never move, i.e., the
+ * address of a node is stable until it is destroyed. Slabs are only returned to the operating
+ * system when the pool is destroyed.
+ *
+ * Optionally, slabs can be backed by huge pages (on Linux). If no huge pages are available, the
+ * pool falls back to regular pages and asks the kernel for transparent huge pages instead.
+ *
+ * The pool is thread safe. Every thread keeps a small local list of free nodes per node class,
+ * so that most allocations and deallocations do not touch the pool's lock.
+ *
+ * To quickly free all nodes of a tree, see RBTree::clear_and_release().
+ *
+ * @tparam Node The node class to allocate
+ */
+template<class Node>
+class NodePool {
+public:
+	/**
+	 * @brief Creates a new, empty pool
+	 *
+	 * No memory is allocated until the first node is requested.
+	 *
+	 * @param nodes_per_slab 	The number of nodes to allocate at once
+	 * @param use_huge_pages 	If true, slabs are rounded up to and backed by huge pages
+	 */
+	explicit NodePool(size_t nodes_per_slab = 1024, bool use_huge_pages = false);
+
+	/**
+	 * @brief Destroys the pool and returns all memory to the operating system
+	 *
+	 * @warning This does not call any destructors. Either destroy() all nodes first, or make sure
+	 * that your node class does not need to be destructed.
+	 */
+	~NodePool();
+
+	NodePool(const NodePool & other) = delete;
+	NodePool & operator=(const NodePool & other) = delete;
+
+	/**
+	 * @brief Allocates a node and constructs it from the given arguments
+	 *
+	 * @param args The arguments to pass to Node's constructor
+	 * @return The newly constructed node
+	 */
+	template<class ... Args>
+	Node * construct(Args && ... args);
+
+	/**
+	 * @brief Destructs a node and returns its memory to the pool
+	 *
+	 * @param node The node to destroy. Must have been allocated from this pool, and must not be
+	 * in any tree anymore.
+	 */
+	void destroy(Node * node);
+
+	/**
+	 * @brief Allocates memory for one node without constructing it
+	 *
+	 * @return Memory suitable for one node
+	 */
+	Node * allocate();
+
+	/**
+	 * @brief Returns memory obtained from allocate() to the pool without destructing anything
+	 *
+	 * @param node The memory to return
+	 */
+	void deallocate(Node * node);
+
+	/**
+	 * @brief Returns the number of slabs allocated so far
+	 */
+	size_t get_slab_count() const;
+
+	/**
+	 * @brief Returns whether at least one slab is backed by explicitly allocated huge pages
+	 */
+	bool uses_huge_pages() const;
+
+private:
+	/// @cond INTERNAL
+	class FreeSlot {
+	public:
+		FreeSlot * next;
+	};
+
+	class Slab {
+	public:
+		void * mem;
+		size_t bytes;
+		bool mapped;
+		bool huge;
+	};
+
+	/*
+	 * Everything threads need to return free nodes to the pool. Thread-local caches keep this
+	 * alive, so that a thread can tell whether the pool it caches nodes for still exists.
+	 */
+	class Shared {
+	public:
+		std::mutex m;
+		FreeSlot * free = nullptr;
+		bool alive = true;
+	};
+
+	class LocalCache {
+	public:
+		~LocalCache();
+		void flush(size_t keep);
+
+		std::shared_ptr<Shared> shared;
+		FreeSlot * head = nullptr;
+		size_t count = 0;
+	};
+	/// @endcond
+
+	static constexpr size_t LOCAL_BATCH = 32;
+	static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	static constexpr size_t slot_align =
+	    (alignof(Node) > alignof(FreeSlot)) ? alignof(Node) : alignof(FreeSlot);
+	static constexpr size_t slot_size_unaligned =
+	    (sizeof(Node) > sizeof(FreeSlot)) ? sizeof(Node) : sizeof(FreeSlot);
+	static constexpr size_t slot_size =
+	    ((slot_size_unaligned + slot_align - 1) / slot_align) * slot_align;
+
+	LocalCache & get_local_cache();
+	void refill(LocalCache & cache);
+	void add_slab();
+
+	static thread_local LocalCache local_cache;
+
+	size_t nodes_per_slab;
+	bool use_huge_pages;
+	std::vector<Slab> slabs;
+	std::shared_ptr<Shared> shared;
+};
+
+} // namespace ygg
+
+#include "node_pool.cpp"
+
+#endif //YGG_NODE_POOL_HPP
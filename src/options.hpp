@@ -5,6 +5,7 @@
 #ifndef YGG_OPTIONS_HPP
 #define YGG_OPTIONS_HPP
 
+#include <cstddef>
 #include <type_traits>
 
 #include "util.hpp"
@@ -36,7 +37,18 @@ public:
 	 * form "is a before b in the tree". Please note that this only makes sense if MULTIPLE is also
 	 * set --- otherwise, Compare(a,b) answers that question for every pair (a,b). For elements that
 	 * compare equally (i.e. Compare(a,b) == Compare(b,a) == false), the hinted version of
-	 * RBTree::insert allows you to enforce a certain order on equal elements. TODO link to method
+	 * RBTree::insert allows you to enforce a certain order on equal elements.
+	 *
+	 * The queries are answered by RBTree::is_before() in O(1). To this end, every node stores a
+	 * 64-bit label, and the labels are kept increasing along the order of the tree. Insertions
+	 * occasionally have to relabel a range of nodes, which costs O(log n) amortized. Removals
+	 * never relabel and are O(1).
+	 *
+	 * @note The two-level labelling scheme by Dietz and Sleator / Bender et al. would bring the
+	 * relabelling cost down to O(1) amortized, but it needs a group record for every run of
+	 * O(log n) consecutive nodes. The tree never allocates memory, and storing the group
+	 * records inside the nodes would make removing or moving a group's first node cost O(log n)
+	 * again, so only the single-level scheme is implemented.
 	 */
 	class ORDER_QUERIES {};
 	/**
@@ -47,7 +59,142 @@ public:
 	 * down insert and remove operations minimally.
 	 */
 	class CONSTANT_TIME_SIZE {};
+	/**
+	 * @brief RBTree option: count operations
+	 *
+	 * If this flag is set, the RBTree counts comparisons, descent depths, rotations, node swaps
+	 * and rebalancing iterations. The counters can be read via RBTree::get_statistics() and
+	 * RBTree::reset_statistics(). If this flag is not set, no counting code is compiled in.
+	 */
+	class STATISTICS {};
+	/**
+	 * @brief RBTree option: cache a key prefix in every node
+	 *
+	 * If this flag is set, every node stores a 64-bit, order-preserving prefix of its key right
+	 * next to its tree links. During searches and insertions, the prefixes decide most comparisons,
+	 * and only if two prefixes are equal is the Compare class called. This pays off for keys that
+	 * are expensive to compare, such as strings.
+	 *
+	 * Your NodeTraits must implement a static get_key_prefix() method that returns a uint64_t for
+	 * a node as well as for every type that you query the tree with. The prefixes must be
+	 * consistent with your Compare class: If the prefix of a is smaller than the prefix of b,
+	 * a must compare smaller than b. See utilities::make_key_prefix() for a helper to create
+	 * prefixes from strings.
+	 */
+	class KEY_PREFIX_CACHE {};
+	/**
+	 * @brief RBTree option: keep equal elements in buckets
+	 *
+	 * If this flag is set, only the first of several elements that compare equally is a node of
+	 * the actual tree. All further equal elements are kept in an intrusive list hanging off that
+	 * representative. Thus, the height of the tree only depends on the number of distinct keys,
+	 * find() etc. run in O(log k) for k distinct keys, and inserting or removing an element whose
+	 * key is already present takes O(1) after the search. The iteration order is the same as
+	 * without this flag.
+	 *
+	 * This flag requires MULTIPLE to be set. Since elements in buckets are not tree nodes, the
+	 * NodeTraits hooks are only called for representatives. Thus, this option can not be used
+	 * with augmented trees such as the IntervalTree.
+	 */
+	class EQUALITY_BUCKETS {};
+	/**
+	 * @brief RBTree option: rebalance top-down while inserting
+	 *
+	 * By default, an insertion first descends to a leaf, links the new node there and then walks
+	 * back up, recoloring and rotating until the tree is balanced again. If this flag is set,
+	 * every node with two red children is split (recolored, and rotated if its parent is red) on
+	 * the way down instead. When the new node is linked, at most one final rotation is
+	 * necessary, so an insertion touches every node on its path only once. Which variant is
+	 * faster depends on the workload; see the benchmarks.
+	 *
+	 * The NodeTraits hooks are called exactly as for bottom-up insertion, i.e., every rotation
+	 * calls rotated_left() or rotated_right(). Insertions that start below the root, e.g.
+	 * RBTree::insert(Node &, Node &) with a hint, as well as all deletions remain bottom-up.
+	 */
+	class TOP_DOWN {};
+	/**
+	 * @brief RBTree option: cache the results of find()
+	 *
+	 * If this flag is set, the RBTree keeps a small direct-mapped cache of <slots> entries that
+	 * maps the hash of a query to the node that find() returned for it. A find() that hits the
+	 * cache costs one or two comparisons instead of a full descent. Any modification of the tree
+	 * invalidates all entries at once by incrementing a version counter. Thus, the cache pays off
+	 * if a few hot keys are looked up many times between modifications. Hit and miss counts can be
+	 * read via RBTree::get_find_cache_statistics().
+	 *
+	 * Only the non-const RBTree::find() uses the cache. Since it writes to the cache even if it
+	 * does not modify the tree, it must not run concurrently with any other access to the tree.
+	 * The const find() bypasses the cache, so several threads may call it at once (as long as
+	 * STATISTICS, which counts every descent, is not set).
+	 *
+	 * Your NodeTraits must implement a static get_key_hash() method that returns a size_t for
+	 * every type that you query the tree with. Queries that compare equally must have equal
+	 * hashes.
+	 *
+	 * @tparam slots 	The number of cache entries. Must be a power of two.
+	 */
+	template<size_t slots>
+	class FIND_CACHE {};
+	/**
+	 * @brief RBTree option: support deferred removal
+	 *
+	 * If this flag is set, RBTree::mark_for_removal() and RBTree::flush_removals() are available.
+	 * To this end, every node stores a flag telling whether it is marked, and the tree counts the
+	 * marked nodes. If this flag is not set, neither is compiled in.
+	 */
+	class DEFERRED_REMOVAL {};
+	/**
+	 * @brief IntervalTree option: count overlapping intervals in O(log n)
+	 *
+	 * If this flag is set, every node of an IntervalTree stores the size of its subtree, and the
+	 * tree keeps a second index of all intervals ordered by their upper bounds. This allows
+	 * IntervalTree::count_overlapping() to count the intervals overlapping a query without
+	 * enumerating them, as
+	 *
+	 *   #(lower <= query upper) - #(upper < query lower).
+	 *
+	 * Every node additionally stores a copy of its bounds, two subtree sizes and the links of the
+	 * second index, and every insertion or removal takes place in both indices. If this flag is not
+	 * set, none of this is compiled in. The RBTree ignores this flag.
+	 */
+	class OVERLAP_COUNTING {};
+	/**
+	 * @brief IntervalTree option: cache the interval bounds in every node
+	 *
+	 * If this flag is set, every node of an IntervalTree stores a copy of its lower and upper
+	 * bound right next to its tree links. The copies are taken whenever a node is inserted,
+	 * repositioned, replaced or relocated, and comparisons, queries and the maintenance of the
+	 * maxima read them instead of calling your NodeTraits. This pays off if get_lower() and
+	 * get_upper() are expensive, e.g., because they read from a separate record.
+	 *
+	 * As always, you must not change the bounds of a node while it is in the tree without calling
+	 * IntervalTree::reposition(). Nodes that are not in a tree, e.g., nodes used as queries, are
+	 * read via your NodeTraits. The RBTree ignores this flag.
+	 */
+	class ENDPOINT_CACHE {};
+};
+
+namespace utilities {
+/// @cond INTERNAL
+template<class ... Opts>
+class FindCacheSlots {
+public:
+	static constexpr size_t value = 0;
+};
+
+template<size_t slots, class ... Rest>
+class FindCacheSlots<TreeFlags::FIND_CACHE<slots>, Rest...> {
+public:
+	static constexpr size_t value = slots;
+};
+
+template<class First, class ... Rest>
+class FindCacheSlots<First, Rest...> {
+public:
+	static constexpr size_t value = FindCacheSlots<Rest...>::value;
 };
+/// @endcond
+} // namespace utilities
 
 /**
  * @brief Class holding the options for an RBTree
@@ -76,6 +223,19 @@ public:
 	                                                               Opts...>();
 	static constexpr bool constant_time_size = utilities::pack_contains<TreeFlags::CONSTANT_TIME_SIZE,
 	                                                                    Opts...>();
+	static constexpr bool statistics = utilities::pack_contains<TreeFlags::STATISTICS, Opts...>();
+	static constexpr bool key_prefix_cache = utilities::pack_contains<TreeFlags::KEY_PREFIX_CACHE,
+	                                                                  Opts...>();
+	static constexpr bool equality_buckets = utilities::pack_contains<TreeFlags::EQUALITY_BUCKETS,
+	                                                                  Opts...>();
+	static constexpr bool top_down = utilities::pack_contains<TreeFlags::TOP_DOWN, Opts...>();
+	static constexpr size_t find_cache_slots = utilities::FindCacheSlots<Opts...>::value;
+	static constexpr bool deferred_removal = utilities::pack_contains<TreeFlags::DEFERRED_REMOVAL,
+	                                                                  Opts...>();
+	static constexpr bool overlap_counting = utilities::pack_contains<TreeFlags::OVERLAP_COUNTING,
+	                                                                  Opts...>();
+	static constexpr bool endpoint_cache = utilities::pack_contains<TreeFlags::ENDPOINT_CACHE,
+	                                                                Opts...>();
 	/// @endcond
 private:
 	TreeOptions(); // Instantiation not allowed
@@ -0,0 +1,214 @@
+#ifndef YGG_PROFILING_HPP
+#define YGG_PROFILING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ygg {
+namespace debug {
+
+/**
+ * @brief Shape and memory layout of a tree at one point in time
+ *
+ * Collected by profile_tree(). Depths are counted in edges, i.e., the root has depth 0. All
+ * address statistics are taken over the parent-child edges of the tree.
+ */
+class TreeProfile {
+public:
+	/// Number of nodes in the tree
+	size_t node_count = 0;
+	/// Number of nodes on the longest root-to-leaf path. Zero for an empty tree.
+	size_t height = 0;
+	/// depth_histogram[d] is the number of nodes at depth d
+	std::vector<size_t> depth_histogram;
+	/// Sum of the depths of all nodes
+	size_t total_depth = 0;
+	/// Number of black nodes on the path from the root to the leftmost leaf
+	size_t black_height = 0;
+
+	/// Number of parent-child edges
+	size_t edges = 0;
+	/// Sum of the absolute address distances (in bytes) between parents and children
+	size_t total_distance = 0;
+	/// Largest absolute address distance (in bytes) between a parent and a child
+	size_t max_distance = 0;
+	/// distance_histogram[i] is the number of edges with a distance in [2^(i-1), 2^i)
+	std::vector<size_t> distance_histogram;
+	/// Number of edges whose parent and child start on different pages
+	size_t page_crossings = 0;
+	/// Number of edges whose parent and child start in different cache lines
+	size_t cache_line_crossings = 0;
+
+	/// Page size that was used to compute page_crossings
+	size_t page_size = 0;
+	/// Cache line size that was used to compute cache_line_crossings
+	size_t cache_line_size = 0;
+
+	/**
+	 * @brief Returns the average number of nodes visited by a successful search
+	 */
+	double
+	average_path_length() const
+	{
+		if (this->node_count == 0) {
+			return 0;
+		}
+		return static_cast<double>(this->total_depth + this->node_count) /
+		       static_cast<double>(this->node_count);
+	}
+
+	/**
+	 * @brief Returns the average absolute address distance between parents and children
+	 */
+	double
+	average_distance() const
+	{
+		if (this->edges == 0) {
+			return 0;
+		}
+		return static_cast<double>(this->total_distance) / static_cast<double>(this->edges);
+	}
+
+	/**
+	 * @brief Writes the profile as a single JSON object to the given stream
+	 *
+	 * @param os The stream to write to
+	 */
+	void
+	to_json(std::ostream & os) const
+	{
+		os << "{";
+		os << "\"node_count\":" << this->node_count;
+		os << ",\"height\":" << this->height;
+		os << ",\"black_height\":" << this->black_height;
+		os << ",\"average_path_length\":" << this->average_path_length();
+		os << ",\"depth_histogram\":";
+		write_array(os, this->depth_histogram);
+		os << ",\"edges\":" << this->edges;
+		os << ",\"average_distance\":" << this->average_distance();
+		os << ",\"max_distance\":" << this->max_distance;
+		os << ",\"distance_histogram\":";
+		write_array(os, this->distance_histogram);
+		os << ",\"page_size\":" << this->page_size;
+		os << ",\"page_crossings\":" << this->page_crossings;
+		os << ",\"cache_line_size\":" << this->cache_line_size;
+		os << ",\"cache_line_crossings\":" << this->cache_line_crossings;
+		os << "}";
+	}
+
+private:
+	static void
+	write_array(std::ostream & os, const std::vector<size_t> & values)
+	{
+		os << "[";
+		for (size_t i = 0 ; i < values.size() ; ++i) {
+			if (i != 0) {
+				os << ",";
+			}
+			os << values[i];
+		}
+		os << "]";
+	}
+};
+
+/**
+ * @brief Walks a tree and collects its shape and memory layout
+ *
+ * Works on every tree that offers get_root(), get_left_child() and get_right_child(), such as
+ * RBTree and IntervalTree. The tree is not modified. Takes O(n) time and O(height) extra
+ * memory.
+ *
+ * @param t               The tree to profile
+ * @param page_size       The page size used to count page crossings
+ * @param cache_line_size The cache line size used to count cache line crossings
+ * @return The collected profile
+ */
+template<class Tree>
+TreeProfile
+profile_tree(const Tree & t, size_t page_size = 4096, size_t cache_line_size = 64)
+{
+	using Node = typename std::remove_pointer<decltype(t.get_root())>::type;
+	using NB = typename Tree::NB;
+	using Color = typename Tree::Base::Color;
+
+	TreeProfile p;
+	p.page_size = page_size;
+	p.cache_line_size = cache_line_size;
+
+	Node * root = t.get_root();
+	if (root == nullptr) {
+		return p;
+	}
+
+	for (Node * n = root ; n != nullptr ; n = Tree::get_left_child(n)) {
+		if (n->NB::_rbt_color == Color::BLACK) {
+			p.black_height++;
+		}
+	}
+
+	std::vector<std::pair<Node *, size_t>> stack;
+	stack.emplace_back(root, 0);
+
+	while (!stack.empty()) {
+		Node * n = stack.back().first;
+		size_t depth = stack.back().second;
+		stack.pop_back();
+
+		p.node_count++;
+		p.total_depth += depth;
+		if (p.depth_histogram.size() <= depth) {
+			p.depth_histogram.resize(depth + 1, 0);
+		}
+		p.depth_histogram[depth]++;
+		if (depth + 1 > p.height) {
+			p.height = depth + 1;
+		}
+
+		Node * children[2] = {Tree::get_left_child(n), Tree::get_right_child(n)};
+		for (Node * child : children) {
+			if (child == nullptr) {
+				continue;
+			}
+			stack.emplace_back(child, depth + 1);
+
+			uintptr_t parent_addr = reinterpret_cast<uintptr_t>(n);
+			uintptr_t child_addr = reinterpret_cast<uintptr_t>(child);
+			size_t distance = (parent_addr > child_addr) ? (parent_addr - child_addr)
+			                                             : (child_addr - parent_addr);
+
+			p.edges++;
+			p.total_distance += distance;
+			if (distance > p.max_distance) {
+				p.max_distance = distance;
+			}
+
+			size_t bucket = 0;
+			while (distance != 0) {
+				bucket++;
+				distance >>= 1;
+			}
+			if (p.distance_histogram.size() <= bucket) {
+				p.distance_histogram.resize(bucket + 1, 0);
+			}
+			p.distance_histogram[bucket]++;
+
+			if ((parent_addr / page_size) != (child_addr / page_size)) {
+				p.page_crossings++;
+			}
+			if ((parent_addr / cache_line_size) != (child_addr / cache_line_size)) {
+				p.cache_line_crossings++;
+			}
+		}
+	}
+
+	return p;
+}
+
+} // namespace debug
+} // namespace ygg
+
+#endif //YGG_PROFILING_HPP
@@ -7,77 +7,206 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::RBTree()
         : root(nullptr)
 {}
 
+/*
+ * Returns the element that prevented the insertion because the tree does not allow equal
+ * elements, or nullptr if <node> was inserted.
+ */
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 template <bool on_equality_prefer_left>
-void
+Node *
 RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_leaf_base(Node &node, Node *start)
 {
-  node.NB::_rbt_right = nullptr;
-  node.NB::_rbt_left = nullptr;
-
   Node *parent = start;
   Node *cur = start;
+  uint64_t prefix = this->stored_key_prefix(node);
 
+  // The direction of the last step tells on which side of the parent the node belongs
+  bool went_left = false;
+  // Without MULTIPLE or with buckets: the last node passed in the 'equal' direction, i.e., the
+  // only candidate for an element equal to <node>
+  Node *equal_candidate = nullptr;
+  constexpr bool track_equal = Options::equality_buckets || !Options::multiple;
+
+  // Only descents from the root can split on the way down, see TreeFlags::TOP_DOWN
+  const bool top_down = Options::top_down && (start == this->root);
+
+  this->stats.count_descent();
   while (cur != nullptr) {
+    // TODO constexpr - if
+    if (top_down && this->split_four_node(cur)) {
+      // The split rotated <cur> upwards, the path above it has changed
+      // TODO constexpr - if
+      if (track_equal) {
+        equal_candidate =
+            this->last_equal_ancestor<on_equality_prefer_left>(cur, node, prefix);
+      }
+    }
+
     parent = cur;
+    this->stats.count_descent_step();
 
     // TODO constexpr - if
-    if (on_equality_prefer_left) {
-      if (this->cmp(*cur, node)) {
-        cur = cur->NB::_rbt_right;
-      } else {
-        cur = cur->NB::_rbt_left;
+    if (uses_three_way_compare<Node>()) {
+      int c = this->node_cmp_query(*cur, node, prefix);
+      went_left = on_equality_prefer_left ? (c >= 0) : (c > 0);
+      if (track_equal && (c == 0)) {
+        equal_candidate = cur;
       }
     } else {
-      if (this->cmp(node, *cur)) {
-        cur = cur->NB::_rbt_left;
+      // TODO constexpr - if
+      if (on_equality_prefer_left) {
+        went_left = !this->node_less_query(*cur, node, prefix);
       } else {
-        cur = cur->NB::_rbt_right;
+        went_left = this->query_less_node(node, prefix, *cur);
+      }
+      if (track_equal && (went_left == on_equality_prefer_left)) {
+        equal_candidate = cur;
+      }
+    }
+
+    cur = went_left ? cur->NB::_rbt_left : cur->NB::_rbt_right;
+  }
+
+  // TODO constexpr - if
+  if (track_equal && (equal_candidate != nullptr)) {
+    bool equal;
+    // TODO constexpr - if
+    if (uses_three_way_compare<Node>()) {
+      equal = true;
+    } else if (on_equality_prefer_left) {
+      equal = !this->query_less_node(node, prefix, *equal_candidate);
+    } else {
+      equal = !this->node_less_query(*equal_candidate, node, prefix);
+    }
+
+    if (equal) {
+      // TODO constexpr - if
+      if (!Options::multiple) {
+        return equal_candidate;
       }
+
+      this->insert_into_bucket(node, *equal_candidate, on_equality_prefer_left);
+      this->update_order_label(node);
+      return nullptr;
     }
   }
 
+  this->link_leaf(node, parent, went_left);
+  return nullptr;
+}
+
+/*
+ * Walks up from <cur> to the last node at which a descent towards <cur> went into the 'equal'
+ * direction, i.e., what insert_leaf_base() tracks as equal_candidate.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <bool on_equality_prefer_left>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::last_equal_ancestor(Node *cur,
+                                                                    const Node &node,
+                                                                    uint64_t prefix)
+{
+  Node *child = cur;
+  Node *ancestor = cur->NB::_rbt_parent;
+  while ((ancestor != nullptr) &&
+         ((ancestor->NB::_rbt_left == child) != on_equality_prefer_left)) {
+    child = ancestor;
+    ancestor = ancestor->NB::_rbt_parent;
+  }
+
+  // TODO constexpr - if
+  if (uses_three_way_compare<Node>() && (ancestor != nullptr) &&
+      (this->node_cmp_query(*ancestor, node, prefix) != 0)) {
+    // With three-way comparisons, the candidate must already be known to be equal
+    return nullptr;
+  }
+
+  return ancestor;
+}
+
+/*
+ * The top-down split: If <node> has two red children, it is recolored red and its children
+ * black. If that makes <node> and its parent both red, rotations fix it. Returns whether
+ * <node> was rotated.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::split_four_node(Node *node)
+{
+  Node *left = node->NB::_rbt_left;
+  Node *right = node->NB::_rbt_right;
+  if ((left == nullptr) || (right == nullptr) ||
+      (left->NB::_rbt_color != Base::Color::RED) ||
+      (right->NB::_rbt_color != Base::Color::RED)) {
+    return false;
+  }
+
+  this->stats.count_insert_fixup();
+  left->NB::_rbt_color = Base::Color::BLACK;
+  right->NB::_rbt_color = Base::Color::BLACK;
+
+  Node *parent = node->NB::_rbt_parent;
+  if (parent == nullptr) {
+    // The root stays black
+    return false;
+  }
+
+  node->NB::_rbt_color = Base::Color::RED;
+  if (parent->NB::_rbt_color == Base::Color::BLACK) {
+    return false;
+  }
+
+  // Since we split every such node on the way down, the uncle of <node> is black
+  this->rotate_red_pair(node);
+  return true;
+}
+
+/*
+ * Attaches <node> as a child of <parent> (or as root if parent is nullptr) and rebalances
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::link_leaf(Node &node, Node *parent, bool left)
+{
+  node.NB::_rbt_right = nullptr;
+  node.NB::_rbt_left = nullptr;
+  set_marked(node, false);
+  this->find_cache.invalidate();
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    bucket_next(&node) = &node;
+    bucket_prev(&node) = &node;
+  }
+
   if (parent == nullptr) {
     // new root!
     node.NB::_rbt_parent = nullptr;
     node.NB::_rbt_color = Base::Color::BLACK;
     this->root = &node;
+    this->update_order_label(node);
     NodeTraits::leaf_inserted(node);
   } else {
     node.NB::_rbt_parent = parent;
     node.NB::_rbt_color = Base::Color::RED;
 
-    if (this->cmp(node, *parent)) {
+    if (left) {
       parent->NB::_rbt_left = &node;
-    } else if (this->cmp(*parent, node)) {
-      parent->NB::_rbt_right = &node;
     } else {
-      //assert(multiple);
-
-      // TODO constexpr - if
-      if (!Options::multiple) {
-        return;
-      }
-
-      // TODO constexpr - if
-      if (on_equality_prefer_left) {
-        parent->NB::_rbt_left = &node;
-      } else {
-        parent->NB::_rbt_right = &node;
-      }
+      parent->NB::_rbt_right = &node;
     }
 
+    this->update_order_label(node);
     NodeTraits::leaf_inserted(node);
     this->fixup_after_insert(&node);
   }
-
-  return;
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::rotate_left(Node *parent)
 {
+  this->stats.count_rotation();
+
   Node *right_child = parent->NB::_rbt_right;
   parent->NB::_rbt_right = right_child->NB::_rbt_left;
   if (right_child->NB::_rbt_left != nullptr) {
@@ -106,6 +235,8 @@ template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::rotate_right(Node *parent)
 {
+  this->stats.count_rotation();
+
   Node *left_child = parent->NB::_rbt_left;
   parent->NB::_rbt_left = left_child->NB::_rbt_right;
   if (left_child->NB::_rbt_right != nullptr) {
@@ -145,6 +276,7 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::fixup_after_insert(Node *node)
   while ((node->NB::_rbt_parent->NB::_rbt_color == Base::Color::RED) &&
          (this->get_uncle(node) != nullptr) &&
          (this->get_uncle(node)->NB::_rbt_color == Base::Color::RED)) {
+    this->stats.count_insert_fixup();
     node->NB::_rbt_parent->NB::_rbt_color = Base::Color::BLACK;
     this->get_uncle(node)->NB::_rbt_color = Base::Color::BLACK;
 
@@ -162,6 +294,17 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::fixup_after_insert(Node *node)
     return;
   }
 
+  this->rotate_red_pair(node);
+}
+
+/*
+ * Resolves a red <node> below a red parent if the uncle of <node> is black, using one or two
+ * rotations
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::rotate_red_pair(Node *node)
+{
   Node *parent = node->NB::_rbt_parent;
   Node *grandparent = parent->NB::_rbt_parent;
 
@@ -195,80 +338,891 @@ template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::insert(Node &node)
 {
-	this->s.add(1);
-	this->insert_leaf_base<true>(node, this->root);
+	this->set_key_prefix(node, this->get_query_prefix(node));
+	if (this->insert_leaf_base<true>(node, this->root) == nullptr) {
+		this->s.add(1);
+	}
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_left_leaning(Node &node){
+	this->set_key_prefix(node, this->get_query_prefix(node));
+	if (this->insert_leaf_base<true>(node, this->root) == nullptr) {
+		this->s.add(1);
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_right_leaning(Node &node){
+	this->set_key_prefix(node, this->get_query_prefix(node));
+	if (this->insert_leaf_base<false>(node, this->root) == nullptr) {
+		this->s.add(1);
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+std::pair<typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<false>, bool>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_unique(Node &node)
+{
+	InsertCommitData commit_data = this->insert_check(node);
+	if (commit_data.existing != nullptr) {
+		return std::make_pair(iterator<false>(commit_data.existing), false);
+	}
+
+	this->insert_commit(node, commit_data);
+	return std::make_pair(iterator<false>(&node), true);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Comparable>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::InsertCommitData
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_check(const Comparable &key) const
+{
+	static_assert(!Options::multiple, "insert_check() requires a tree without MULTIPLE");
+
+	InsertCommitData commit_data;
+	Node *cur = this->root;
+	Node *equal_candidate = nullptr;
+	uint64_t prefix = this->get_query_prefix(key);
+
+	this->stats.count_descent();
+	while (cur != nullptr) {
+		this->stats.count_descent_step();
+		commit_data.parent = cur;
+
+		// TODO constexpr - if
+		if (uses_three_way_compare<Comparable>()) {
+			int c = this->node_cmp_query(*cur, key, prefix);
+			if (c == 0) {
+				commit_data.existing = cur;
+				return commit_data;
+			}
+			commit_data.left = (c > 0);
+		} else {
+			commit_data.left = !this->node_less_query(*cur, key, prefix);
+			if (commit_data.left) {
+				equal_candidate = cur;
+			}
+		}
+
+		cur = commit_data.left ? cur->NB::_rbt_left : cur->NB::_rbt_right;
+	}
+
+	// TODO constexpr - if
+	if (!uses_three_way_compare<Comparable>() && (equal_candidate != nullptr) &&
+	    !this->query_less_node(key, prefix, *equal_candidate)) {
+		commit_data.existing = equal_candidate;
+	}
+
+	return commit_data;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<false>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_commit(Node &node,
+                                                               const InsertCommitData &commit_data)
+{
+	assert(commit_data.existing == nullptr);
+
+	this->set_key_prefix(node, this->get_query_prefix(node));
 	this->s.add(1);
-	this->insert_leaf_base<true>(node, this->root);
+	this->link_leaf(node, commit_data.parent, commit_data.left);
+
+	return iterator<false>(&node);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert(Node &node, Node &hint)
+{
+  this->insert_hinted(node, hint);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert(Node &node,
+                                                        RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator<false> hint)
+{
+  this->insert_hinted(node, hint);
+}
+
+/*
+ * The hinted insertions. Return whether <node> was inserted, i.e., false if the tree does not
+ * allow equal elements and already contains one.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_hinted(Node &node, Node &hint)
+{
+  this->set_key_prefix(node, this->get_query_prefix(node));
+  uint64_t prefix = this->stored_key_prefix(node);
+
+  // TODO constexpr - if
+  if (Options::equality_buckets || !Options::multiple) {
+    /* Without equal elements in the tree, the key alone determines the position. With buckets,
+     * the hint only matters if <node> joins the bucket of <hint> or of the element before it.
+     * Since the hint does not need to be exact, we check both directions.
+     */
+    // TODO constexpr - if
+    if (Options::equality_buckets) {
+      if (!this->query_less_node(node, prefix, hint) &&
+          !this->node_less_query(hint, node, prefix)) {
+        this->insert_into_bucket(node, hint, !is_bucket_member(&hint));
+        this->update_order_label(node);
+        this->s.add(1);
+        return true;
+      }
+
+      iterator<false> pred(&hint);
+      --pred;
+      if ((pred != this->end()) && !this->node_less_query(*pred, node, prefix) &&
+          !this->query_less_node(node, prefix, *pred)) {
+        // The predecessor is the last element of its bucket, so this appends to the bucket
+        this->insert_into_bucket(node, *bucket_next(&*pred), false);
+        this->update_order_label(node);
+        this->s.add(1);
+        return true;
+      }
+    }
+
+    /* The key alone determines the position of <node>. Use the hint as a finger: Climb to the
+     * smallest subtree containing both the hint and that position, and descend from there. An
+     * element equal to <node> can only lie inside that subtree.
+     */
+    Node *finger = &hint;
+    // TODO constexpr - if
+    if (Options::equality_buckets) {
+      // Bucket members are not linked into the tree, but their representative is
+      while (is_bucket_member(finger)) {
+        finger = bucket_next(finger);
+      }
+    }
+    bool moving_right = this->node_less_query(*finger, node, prefix);
+    Node *start = this->subtree_around(finger, node, prefix, moving_right);
+    if (this->insert_leaf_base<true>(node, start) != nullptr) {
+      return false;
+    }
+    this->s.add(1);
+    return true;
+  }
+
+  // find parent
+  Node *parent = &hint;
+
+  /* We need to walk up if:
+   *  - we're larger than the parent and in its left subtree
+   *  - we're smaller than the parent and in its right subtree
+   */
+  while ((parent->NB::_rbt_parent != nullptr) &&
+         (((parent->NB::_rbt_parent->NB::_rbt_left == parent) &&
+           (this->node_less_query(*parent->NB::_rbt_parent, node,
+                                  prefix))) || // left subtree, parent should go before node
+          ((parent->NB::_rbt_parent->NB::_rbt_right == parent) &&
+           (this->query_less_node(node, prefix,
+                                  *parent->NB::_rbt_parent))))) { // right subtree, node should go before parent
+    parent = parent->NB::_rbt_parent;
+  }
+
+  Node *existing;
+  if (parent->NB::_rbt_left != nullptr) {
+    parent = parent->NB::_rbt_left;
+    existing = this->insert_leaf_base<false>(node, parent);
+  } else {
+    existing = this->insert_leaf_base<true>(node, parent);
+  }
+
+  if (existing != nullptr) {
+    return false;
+  }
+  this->s.add(1);
+  return true;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_hinted(Node &node,
+                                                               RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator<false> hint)
+{
+  if (hint == this->end()) {
+    // special case: insert at the end
+    this->set_key_prefix(node, this->get_query_prefix(node));
+    Node *parent = this->root;
+
+    if (parent != nullptr) {
+      while (parent->NB::_rbt_right != nullptr) {
+        parent = parent->NB::_rbt_right;
+      }
+    }
+
+    if (this->insert_leaf_base<false>(node, parent) != nullptr) {
+      return false;
+    }
+    this->s.add(1);
+    return true;
+  } else {
+    return this->insert_hinted(node, *hint);
+  }
+}
+
+/*
+ * Links <node> into the bucket of <successor>, right before <successor>. If take_over is set,
+ * <successor> must be a representative, and <node> replaces it in the tree.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_into_bucket(Node &node, Node &successor,
+                                                                    bool take_over)
+{
+  set_marked(node, false);
+  this->find_cache.invalidate();
+
+  Node *pred = bucket_prev(&successor);
+  bucket_prev(&node) = pred;
+  bucket_next(&node) = &successor;
+  bucket_next(pred) = &node;
+  bucket_prev(&successor) = &node;
+
+  if (take_over) {
+    this->bucket_take_over(successor, node);
+    mark_bucket_member(successor);
+  } else {
+    mark_bucket_member(node);
+  }
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <bool on_equality_prefer_left>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_below(Node &node, Node *start)
+{
+  this->set_key_prefix(node, this->get_query_prefix(node));
+  if (this->insert_leaf_base<on_equality_prefer_left>(node, start) != nullptr) {
+    return false;
+  }
+
+  this->s.add(1);
+  return true;
+}
+
+/*
+ * Walks up from <finger> until the subtree below it contains the position of <node>, which must
+ * lie to the right of <finger> if moving_right is set and to its left otherwise. Moving right,
+ * we need an ancestor larger than the node that we reach from the left. Moving left, we need an
+ * ancestor smaller than the node that we reach from the right. The other bound of the subtree
+ * is given by the finger itself.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::subtree_around(Node *finger, const Node &node,
+                                                                uint64_t prefix,
+                                                                bool moving_right)
+{
+  Node *start = finger;
+  while (start->NB::_rbt_parent != nullptr) {
+    Node *parent = start->NB::_rbt_parent;
+    bool from_left = (parent->NB::_rbt_left == start);
+    if (moving_right && from_left && this->query_less_node(node, prefix, *parent)) {
+      break;
+    }
+    if (!moving_right && !from_left && this->node_less_query(*parent, node, prefix)) {
+      break;
+    }
+    start = parent;
+  }
+
+  return start;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::reposition(Node &node)
+{
+  uint64_t prefix = this->get_query_prefix(node);
+  // Re-inserting must not drop a pending removal
+  bool marked = is_marked(node);
+  // Even if the node stays in place, it may now be the first of several equal elements
+  this->find_cache.invalidate();
+
+  // TODO constexpr - if
+  if (Options::equality_buckets && (bucket_next(&node) != &node)) {
+    // In a bucket, the node must still be equal to the other elements
+    Node *other = bucket_next(&node);
+    if (!this->query_less_node(node, prefix, *other) &&
+        !this->node_less_query(*other, node, prefix)) {
+      this->set_key_prefix(node, prefix);
+      NodeTraits::key_changed(node);
+      return true;
+    }
+
+    this->remove(node);
+    bool kept = this->insert_below(node, this->root);
+    if (kept && marked) {
+      this->mark_node(node);
+    }
+    return kept;
+  }
+
+  iterator<false> pred(&node);
+  --pred;
+  iterator<false> succ(&node);
+  ++succ;
+
+  // Without equal elements in the tree, the node may not be equal to its neighbors either
+  constexpr bool strict = Options::equality_buckets || !Options::multiple;
+  bool after_pred;
+  bool before_succ;
+  // TODO constexpr - if
+  if (strict) {
+    after_pred = (pred == this->end()) || this->node_less_query(*pred, node, prefix);
+    before_succ = (succ == this->end()) || this->query_less_node(node, prefix, *succ);
+  } else {
+    after_pred = (pred == this->end()) || !this->query_less_node(node, prefix, *pred);
+    before_succ = (succ == this->end()) || !this->node_less_query(*succ, node, prefix);
+  }
+
+  if (after_pred && before_succ) {
+    this->set_key_prefix(node, prefix);
+    NodeTraits::key_changed(node);
+    return true;
+  }
+
+  bool moving_right = !before_succ;
+  Node *finger = moving_right ? &(*succ) : &(*pred);
+  // TODO constexpr - if
+  if (Options::equality_buckets && is_bucket_member(finger)) {
+    // The predecessor is the last element of its bucket, so this is its representative
+    finger = bucket_next(finger);
+  }
+
+  this->remove(node);
+
+  bool kept = this->insert_below(node, this->subtree_around(finger, node, prefix, moving_right));
+  if (kept && marked) {
+    this->mark_node(node);
+  }
+  return kept;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::replace_node(Node &old_node, Node &new_node)
+{
+  assert(!utilities::compare_less(this->cmp, old_node, new_node) &&
+         !utilities::compare_less(this->cmp, new_node, old_node));
+  this->relocate(old_node, new_node);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::mark_for_removal(Node &node)
+{
+  static_assert(Options::deferred_removal,
+                "mark_for_removal() requires the DEFERRED_REMOVAL option");
+  this->mark_node(node);
+}
+
+/*
+ * Without DEFERRED_REMOVAL, nodes are never marked, and reposition() never calls this.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::mark_node(Node &node)
+{
+  if (!is_marked(node)) {
+    set_marked(node, true);
+    this->pending_removals.add(1);
+  }
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+size_t
+RBTree<Node, NodeTraits, Options, Tag, Compare>::flush_removals(double rebuild_fraction)
+{
+  static_assert(Options::deferred_removal,
+                "flush_removals() requires the DEFERRED_REMOVAL option");
+  size_t removed = this->pending_removals.get();
+  if (removed == 0) {
+    return 0;
+  }
+
+  if (static_cast<double>(removed) >=
+      rebuild_fraction * static_cast<double>(this->element_count())) {
+    this->rebuild_balanced(true);
+  } else {
+    this->remove_marked_individually();
+  }
+
+  return removed;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::remove_marked_individually()
+{
+  iterator<false> it = this->begin();
+  while (this->pending_removals.get() > 0) {
+    Node &node = *it;
+    // Advance first - removing a representative keeps the rest of its bucket in place
+    ++it;
+    if (is_marked(node)) {
+      this->remove(node);
+    }
+  }
+}
+
+/*
+ * Relinks all elements into a tree of minimum height in a single in-order pass. If drop_marked
+ * is set, all elements marked for removal are left out.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::rebuild_balanced(bool drop_marked)
+{
+  // Count the tree nodes to be built, i.e., the buckets with at least one remaining element
+  size_t count = 0;
+  // TODO constexpr - if
+  if (Options::constant_time_size && !Options::equality_buckets) {
+    count = this->element_count() - (drop_marked ? this->pending_removals.get() : 0);
+  } else {
+    bool counted = false;
+    for (const Node &n : *this) {
+      if (!is_bucket_member(&n)) {
+        counted = false;
+      }
+      if (!counted && (!drop_marked || !is_marked(n))) {
+        count++;
+        counted = true;
+      }
+    }
+  }
+
+  // The new tree overwrites the links of every node right after it has been visited
+  UnlinkingWalker walker(this->root);
+
+  auto next_survivor = [&]() -> Node * {
+    while (true) {
+      Node *cur = walker.next();
+      if (!drop_marked) {
+        return cur;
+      }
+
+      Node *survivor = is_marked(*cur) ? nullptr : cur;
+      set_marked(*cur, false);
+
+      // TODO constexpr - if
+      if (Options::equality_buckets) {
+        Node *member = bucket_next(cur);
+        while (member != cur) {
+          Node *next_member = bucket_next(member);
+          if (is_marked(*member)) {
+            set_marked(*member, false);
+            bucket_next(bucket_prev(member)) = next_member;
+            bucket_prev(next_member) = bucket_prev(member);
+          }
+          member = next_member;
+        }
+
+        if ((survivor == nullptr) && (bucket_next(cur) != cur)) {
+          // The first remaining member becomes the new representative
+          survivor = bucket_next(cur);
+          bucket_next(bucket_prev(cur)) = survivor;
+          bucket_prev(survivor) = bucket_prev(cur);
+          bucket_next(cur) = cur;
+          bucket_prev(cur) = cur;
+        }
+      }
+
+      if (survivor != nullptr) {
+        return survivor;
+      }
+    }
+  };
+
+  if (drop_marked) {
+    this->s.reduce(this->pending_removals.get());
+    this->pending_removals.set(0);
+    this->find_cache.invalidate();
+  }
+
+  this->root = this->build_balanced(next_survivor, count, 0, balanced_red_depth(count));
+  if (this->root != nullptr) {
+    this->root->NB::_rbt_parent = nullptr;
+  }
+}
+
+/*
+ * Returns the depth from which on build_balanced() must color nodes red. All levels above are
+ * complete, so coloring the nodes below red makes all paths contain the same number of black
+ * nodes.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+size_t
+RBTree<Node, NodeTraits, Options, Tag, Compare>::balanced_red_depth(size_t count)
+{
+  size_t red_depth = 0;
+  while (((static_cast<size_t>(1) << (red_depth + 1)) - 1) <= count) {
+    red_depth++;
+  }
+  return red_depth;
+}
+
+/*
+ * Builds a balanced tree from the next <count> nodes returned by next_node(). Nodes at depth
+ * red_depth or deeper are red.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class NextNodeFn>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::build_balanced(NextNodeFn &next_node,
+                                                                size_t count, size_t depth,
+                                                                size_t red_depth)
+{
+  if (count == 0) {
+    return nullptr;
+  }
+
+  size_t left_count = (count - 1) / 2;
+  Node *left = this->build_balanced(next_node, left_count, depth + 1, red_depth);
+  Node *node = next_node();
+  Node *right = this->build_balanced(next_node, count - 1 - left_count, depth + 1, red_depth);
+
+  node->NB::_rbt_left = left;
+  if (left != nullptr) {
+    left->NB::_rbt_parent = node;
+  }
+  node->NB::_rbt_right = right;
+  if (right != nullptr) {
+    right->NB::_rbt_parent = node;
+  }
+  node->NB::_rbt_color = (depth >= red_depth) ? Base::Color::RED : Base::Color::BLACK;
+
+  NodeTraits::subtree_rebuilt(*node);
+  return node;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::optimize()
+{
+  this->rebuild_balanced(false);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class WeightFn>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::optimize(WeightFn weight)
+{
+  // Chain the tree nodes into a list through _rbt_right
+  UnlinkingWalker walker(this->root);
+  Node *head = walker.next();
+  Node *tail = head;
+  size_t count = 0;
+  while (tail != nullptr) {
+    count++;
+    Node *next = walker.next();
+    tail->NB::_rbt_right = next;
+    tail = next;
+  }
+
+  /* A black-rooted tree with black height b has between 2^b - 1 and 4^b - 1 nodes. Choose b in
+   * the middle of the possible range, which leaves the most freedom for placing heavy nodes.
+   */
+  size_t min_black_height = 0;
+  while (full_tree_size(2 * min_black_height) < count) {
+    min_black_height++;
+  }
+  size_t max_black_height = min_black_height;
+  while (full_tree_size(max_black_height + 1) <= count) {
+    max_black_height++;
+  }
+
+  this->root = this->build_weighted(head, count, (min_black_height + max_black_height) / 2, true,
+                                    weight);
+  if (this->root != nullptr) {
+    this->root->NB::_rbt_parent = nullptr;
+  }
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::merge(RBTree &other)
+{
+  if ((&other == this) || (other.root == nullptr)) {
+    return;
+  }
+
+  constexpr bool track_equal = Options::equality_buckets || !Options::multiple;
+  size_t other_elements = 0;
+  // TODO constexpr - if
+  if (Options::constant_time_size) {
+    other_elements = other.element_count();
+  }
+
+  // Both sequences of tree nodes. Links may be overwritten as soon as a node has been returned.
+  UnlinkingWalker mine(this->root);
+  UnlinkingWalker theirs(other.root);
+  Node *a = mine.next();
+  Node *b = theirs.next();
+
+  // The merged sequence and the nodes that stay in <other>, both linked through _rbt_right
+  Node *merged = nullptr;
+  Node **merged_tail = &merged;
+  size_t merged_count = 0;
+  Node *kept = nullptr;
+  Node **kept_tail = &kept;
+  size_t kept_count = 0;
+  size_t kept_marked = 0;
+
+  auto append = [](Node *n, Node **&tail, size_t &count) {
+    *tail = n;
+    tail = &n->NB::_rbt_right;
+    count++;
+  };
+
+  while ((a != nullptr) && (b != nullptr)) {
+    uint64_t prefix = stored_key_prefix(*b);
+    bool b_first;
+    bool equal = false;
+    // TODO constexpr - if
+    if (uses_three_way_compare<Node>()) {
+      int c = this->node_cmp_query(*a, *b, prefix);
+      b_first = c > 0;
+      equal = c == 0;
+    } else {
+      b_first = this->query_less_node(*b, prefix, *a);
+      // TODO constexpr - if
+      if (track_equal && !b_first) {
+        equal = !this->node_less_query(*a, *b, prefix);
+      }
+    }
+
+    if (b_first) {
+      append(b, merged_tail, merged_count);
+      b = theirs.next();
+    } else if (track_equal && equal) {
+      // TODO constexpr - if
+      if (!Options::multiple) {
+        kept_marked += is_marked(*b) ? 1 : 0;
+        append(b, kept_tail, kept_count);
+      } else {
+        // Append the bucket of <b> to the bucket of <a>
+        Node *a_last = bucket_prev(a);
+        Node *b_last = bucket_prev(b);
+        bucket_next(a_last) = b;
+        bucket_prev(b) = a_last;
+        bucket_next(b_last) = a;
+        bucket_prev(a) = b_last;
+        mark_bucket_member(*b);
+      }
+      b = theirs.next();
+    } else {
+      append(a, merged_tail, merged_count);
+      a = mine.next();
+    }
+  }
+  for (; a != nullptr ; a = mine.next()) {
+    append(a, merged_tail, merged_count);
+  }
+  for (; b != nullptr ; b = theirs.next()) {
+    append(b, merged_tail, merged_count);
+  }
+
+  auto pop = [](Node *&list) {
+    Node *n = list;
+    list = n->NB::_rbt_right;
+    return n;
+  };
+  auto next_merged = [&]() { return pop(merged); };
+  auto next_kept = [&]() { return pop(kept); };
+
+  this->root = this->build_balanced(next_merged, merged_count, 0,
+                                    balanced_red_depth(merged_count));
+  this->root->NB::_rbt_parent = nullptr;
+  other.root = other.build_balanced(next_kept, kept_count, 0, balanced_red_depth(kept_count));
+  if (other.root != nullptr) {
+    other.root->NB::_rbt_parent = nullptr;
+  }
+
+  // Without MULTIPLE, every kept node is a single element
+  this->s.add(other_elements - kept_count);
+  other.s.set(kept_count);
+  this->pending_removals.add(other.pending_removals.get() - kept_marked);
+  other.pending_removals.set(kept_marked);
+
+  this->find_cache.invalidate();
+  other.find_cache.invalidate();
+  this->update_all_order_labels();
+  other.update_all_order_labels();
 }
 
+/*
+ * Returns 2^levels - 1, the number of nodes in a complete tree with <levels> levels, saturating
+ * at the largest size_t.
+ */
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::insert_right_leaning(Node &node){
-	this->s.add(1);
-	this->insert_leaf_base<false>(node, this->root);
+size_t
+RBTree<Node, NodeTraits, Options, Tag, Compare>::full_tree_size(size_t levels)
+{
+  if (levels >= 8 * sizeof(size_t)) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return (static_cast<size_t>(1) << levels) - 1;
 }
 
+/*
+ * Builds a red-black tree with the given black height from the first <count> nodes of <list>,
+ * which is linked through _rbt_right. Unless black_root is set, the root may be red. The caller
+ * must make sure that such a tree exists: It has between 2^b - 1 and 2 * 4^b - 1 nodes, or at
+ * most 4^b - 1 nodes if the root must be black.
+ */
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::insert(Node &node, Node &hint)
+template <class WeightFn>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::build_weighted(Node *list, size_t count,
+                                                                size_t black_height,
+                                                                bool black_root,
+                                                                WeightFn &weight)
 {
-  // find parent
-  Node *parent = &hint;
-
-  /* We need to walk up if:
-   *  - we're larger than the parent and in its left subtree
-   *  - we're smaller than the parent and in its right subtree
-   */
-  while ((parent->NB::_rbt_parent != nullptr) &&
-         (((parent->NB::_rbt_parent->NB::_rbt_left == parent) &&
-           (this->cmp(*parent->NB::_rbt_parent,
-                      node))) || // left subtree, parent should go before node
-          ((parent->NB::_rbt_parent->NB::_rbt_right == parent) && (this->cmp(node,
-                                                                             *parent->NB::_rbt_parent))))) { // right subtree, node should go before parent
-    parent = parent->NB::_rbt_parent;
+  if (count == 0) {
+    return nullptr;
   }
 
-  if (parent->NB::_rbt_left != nullptr) {
-    parent = parent->NB::_rbt_left;
-    this->insert_leaf_base<false>(node, parent);
+  // Prefer a black root, since it allows for more unbalanced subtrees
+  bool black = black_root ||
+               ((black_height > 0) && (count <= full_tree_size(2 * black_height)));
+  size_t child_black_height;
+  size_t min_child;
+  size_t max_child;
+  if (black) {
+    // The children may be red, and have a black height of one less
+    child_black_height = black_height - 1;
+    min_child = full_tree_size(child_black_height);
+    max_child = full_tree_size(2 * child_black_height + 1);
   } else {
-    this->insert_leaf_base<true>(node, parent);
+    // The children must be black, with the same black height
+    child_black_height = black_height;
+    min_child = full_tree_size(child_black_height);
+    max_child = full_tree_size(2 * child_black_height);
+  }
+
+  // The possible sizes of the left subtree
+  size_t min_left = std::max(min_child, (count - 1 > max_child) ? (count - 1 - max_child) : 0);
+  size_t max_left = std::min(max_child, count - 1 - min_child);
+  assert(min_left <= max_left);
+
+  size_t middle = (count - 1) / 2;
+  auto distance_to_middle = [&](size_t left) {
+    return (left > middle) ? (left - middle) : (middle - left);
+  };
+
+  Node *cur = list;
+  for (size_t i = 0 ; i < min_left ; ++i) {
+    cur = cur->NB::_rbt_right;
+  }
+  Node *best = cur;
+  size_t best_left = min_left;
+  auto best_weight = weight(*cur);
+  for (size_t left = min_left + 1 ; left <= max_left ; ++left) {
+    cur = cur->NB::_rbt_right;
+    auto cur_weight = weight(*cur);
+    // On equal weights, stay as balanced as possible
+    if ((best_weight < cur_weight) ||
+        (!(cur_weight < best_weight) &&
+         (distance_to_middle(left) < distance_to_middle(best_left)))) {
+      best = cur;
+      best_left = left;
+      best_weight = cur_weight;
+    }
+  }
+
+  Node *right_list = best->NB::_rbt_right;
+  Node *left = this->build_weighted(list, best_left, child_black_height, !black, weight);
+  Node *right = this->build_weighted(right_list, count - 1 - best_left, child_black_height,
+                                     !black, weight);
+
+  best->NB::_rbt_left = left;
+  if (left != nullptr) {
+    left->NB::_rbt_parent = best;
+  }
+  best->NB::_rbt_right = right;
+  if (right != nullptr) {
+    right->NB::_rbt_parent = best;
   }
+  best->NB::_rbt_color = black ? Base::Color::BLACK : Base::Color::RED;
+
+  NodeTraits::subtree_rebuilt(*best);
+  return best;
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::insert(Node &node,
-                                                        RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator<false> hint)
+RBTree<Node, NodeTraits, Options, Tag, Compare>::clear()
 {
-  if (hint == this->end()) {
-    // special case: insert at the end
-    Node *parent = this->root;
+  this->root = nullptr;
+  this->s.set(0);
+  this->pending_removals.set(0);
+  this->find_cache.invalidate();
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Callback>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::drain(Callback callback)
+{
+  Node *cur = this->root;
+
+  // Detach the nodes from the tree first, so that the callback sees an empty tree
+  this->root = nullptr;
+  this->s.set(0);
+  this->pending_removals.set(0);
+  this->find_cache.invalidate();
 
-    if (parent == nullptr) {
-      this->insert_leaf_base<false>(node, parent);
+  while (cur != nullptr) {
+    if (cur->NB::_rbt_left != nullptr) {
+      cur = cur->NB::_rbt_left;
+    } else if (cur->NB::_rbt_right != nullptr) {
+      cur = cur->NB::_rbt_right;
     } else {
-      while (parent->NB::_rbt_right != nullptr) {
-        parent = parent->NB::_rbt_right;
+      // cur is a leaf now. Unlink it and continue at its parent.
+      Node *parent = cur->NB::_rbt_parent;
+      if (parent != nullptr) {
+        if (parent->NB::_rbt_left == cur) {
+          parent->NB::_rbt_left = nullptr;
+        } else {
+          parent->NB::_rbt_right = nullptr;
+        }
       }
-      this->insert_leaf_base<false>(node, parent);
+
+      // TODO constexpr - if
+      if (Options::equality_buckets) {
+        Node *member = bucket_next(cur);
+        while (member != cur) {
+          Node *next_member = bucket_next(member);
+          member->NB::_rbt_left = nullptr;
+          set_marked(*member, false);
+          callback(*member);
+          member = next_member;
+        }
+        bucket_next(cur) = cur;
+        bucket_prev(cur) = cur;
+      }
+
+      cur->NB::_rbt_parent = nullptr;
+      set_marked(*cur, false);
+      callback(*cur);
+      cur = parent;
     }
-  } else {
-    this->insert(node, *hint);
   }
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Pool>
 void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::clear()
+RBTree<Node, NodeTraits, Options, Tag, Compare>::clear_and_release(Pool & pool)
 {
-  this->root = nullptr;
-  this->s.set(0);
+  this->drain([&pool](Node & node) { pool.destroy(&node); });
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
@@ -359,7 +1313,7 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_order() const
   for (const Node &n : *this) {
     if (n.NB::_rbt_left != nullptr) {
       // left may not be larger
-      if (this->cmp(n, *(n.NB::_rbt_left))) {
+      if (utilities::compare_less(this->cmp, n, *(n.NB::_rbt_left))) {
         assert(false);
         return false;
       }
@@ -367,7 +1321,7 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_order() const
 
     if (n.NB::_rbt_right != nullptr) {
       // right may not be smaller
-      if (this->cmp(*(n.NB::_rbt_right), n)) {
+      if (utilities::compare_less(this->cmp, *(n.NB::_rbt_right), n)) {
         assert(false);
         return false;
       }
@@ -377,6 +1331,42 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_order() const
   return true;
 }
 
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_buckets() const
+{
+  // TODO constexpr - if
+  if (!Options::equality_buckets) {
+    return true;
+  }
+
+  for (const Node &n : *this) {
+    if (is_bucket_member(&n)) {
+      continue;
+    }
+
+    const Node *prev = &n;
+    Node *member = bucket_next(&n);
+    while (member != &n) {
+      if (!is_bucket_member(member) || (bucket_prev(member) != prev) ||
+          utilities::compare_less(this->cmp, n, *member) ||
+          utilities::compare_less(this->cmp, *member, n)) {
+        assert(false);
+        return false;
+      }
+      prev = member;
+      member = bucket_next(member);
+    }
+
+    if (bucket_prev(&n) != prev) {
+      assert(false);
+      return false;
+    }
+  }
+
+  return true;
+}
+
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 bool
 RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_tree() const
@@ -394,14 +1384,42 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_tree() const
     }
   }
 
-  std::set<Node *> seen;
+  // find the next-largest vertex
+  auto next_in_order = [](Node *node) -> Node * {
+    if (node == nullptr) {
+      return nullptr;
+    }
+
+    if (node->NB::_rbt_right != nullptr) {
+      // go to smallest larger-or-equal child
+      node = node->NB::_rbt_right;
+      while (node->NB::_rbt_left != nullptr) {
+        node = node->NB::_rbt_left;
+      }
+      return node;
+    }
+
+    // skip over the nodes already visited
+    while ((node->NB::_rbt_parent != nullptr) && (node->NB::_rbt_parent->NB::_rbt_right ==
+                                                  node)) { // these are the nodes which are smaller and were already visited
+      node = node->NB::_rbt_parent;
+    }
+
+    // go one further up. If there is no parent, we're done.
+    return node->NB::_rbt_parent;
+  };
+
+  /*
+   * Detect cycles without allocating: a second cursor walks the same order at twice the speed.
+   * If the walk is cyclic, it must catch up with cur at some point.
+   */
+  Node *hare = next_in_order(cur);
 
   while (cur != nullptr) {
-    if (seen.find(cur) != seen.end()) {
+    if (cur == hare) {
       assert(false);
       return false;
     }
-    seen.insert(cur);
 
     if (cur->NB::_rbt_left != nullptr) {
       if (cur->NB::_rbt_left->NB::_rbt_parent != cur) {
@@ -425,37 +1443,8 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_tree() const
       }
     }
 
-
-    /*
-     * Begin: find the next-largest vertex
-     */
-    if (cur->NB::_rbt_right != nullptr) {
-      // go to smallest larger-or-equal child
-      cur = cur->NB::_rbt_right;
-      while (cur->NB::_rbt_left != nullptr) {
-        cur = cur->NB::_rbt_left;
-      }
-    } else {
-      // go up
-
-      // skip over the nodes already visited
-      while ((cur->NB::_rbt_parent != nullptr) && (cur->NB::_rbt_parent->NB::_rbt_right ==
-                                                   cur)) { // these are the nodes which are smaller and were already visited
-        cur = cur->NB::_rbt_parent;
-      }
-
-      // go one further up
-      if (cur->NB::_rbt_parent == nullptr) {
-        // done
-        cur = nullptr;
-      } else {
-        // go up
-        cur = cur->NB::_rbt_parent;
-      }
-    }
-    /*
-     * End: find the next-largest vertex
-     */
+    cur = next_in_order(cur);
+    hare = next_in_order(next_in_order(hare));
   }
 
   return true;
@@ -473,7 +1462,7 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_integrity() const
   bool paths_okay = (this->root == nullptr) || this->verify_black_paths(this->root, &dummy);
   bool children_okay = this->verify_red_black(this->root);
 
-  bool order_okay = this->verify_order();
+  bool order_okay = this->verify_order() && this->verify_buckets();
 
   //std::cout << "Root: " << root_okay << " Paths: " << paths_okay << " Children: " << children_okay << " Tree: " << tree_okay << "\n";
 
@@ -484,65 +1473,6 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::verify_integrity() const
   return root_okay && paths_okay && children_okay && tree_okay && order_okay;
 }
 
-template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-template <class NodeNameGetter>
-void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::dump_to_dot_base(const std::string &filename,
-                                                                  NodeNameGetter name_getter) const
-{
-  std::ofstream dotfile;
-  dotfile.open(filename);
-  dotfile << "digraph G {\n";
-  this->output_node_base(this->root, dotfile, name_getter);
-  dotfile << "}\n";
-}
-
-template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::dump_to_dot(const std::string &filename) const
-{
-  this->dump_to_dot_base(filename, [&](const Node *node) {
-    return NodeTraits::get_id(node);
-  });
-}
-
-template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-template <class NodeNameGetter>
-void
-RBTree<Node, NodeTraits, Options, Tag, Compare>::output_node_base(const Node *node,
-                                                                  std::ofstream &out,
-                                                                  NodeNameGetter name_getter) const
-{
-  if (node == nullptr) {
-    return;
-  }
-
-  std::string color;
-  if (node->NB::_rbt_color == Base::Color::BLACK) {
-    color = "black";
-  } else {
-    color = "red";
-  }
-
-  out << "  " << std::to_string((long unsigned int)node) << "[ color=" << color << " label=\""
-      << name_getter(node) << "\"]\n";
-
-  if (node->NB::_rbt_parent != nullptr) {
-    std::string label;
-    if (node->NB::_rbt_parent->NB::_rbt_left == node) {
-      label = std::string("L");
-    } else {
-      label = std::string("R");
-    }
-
-    out << "  " << std::to_string((long unsigned int)node->NB::_rbt_parent) << " -> "
-        << std::to_string((long unsigned int)node) << "[ label=\"" << label << "\"]\n";
-  }
-
-  this->output_node_base(node->NB::_rbt_left, out, name_getter);
-  this->output_node_base(node->NB::_rbt_right, out, name_getter);
-}
-
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 size_t
 RBTree<Node, NodeTraits, Options, Tag, Compare>::size() const
@@ -561,6 +1491,8 @@ template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::swap_nodes(Node *n1, Node *n2, bool swap_colors)
 {
+  this->stats.count_swap();
+
   if (n1->NB::_rbt_parent == n2) {
     this->swap_neighbors(n2, n1);
   } else if (n2->NB::_rbt_parent == n1) {
@@ -739,6 +1671,7 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::fixup_after_delete(Node *parent
   Node *sibling;
 
   while (propagating_up) {
+    this->stats.count_delete_fixup();
     //std::cout << "=> Parent has ID " << NodeTraits::get_id(parent) << " <= ";
     // We just deleted a black node from under parent.
     if (deleted_left) {
@@ -843,6 +1776,28 @@ void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::remove(Node &node)
 {
   this->s.reduce(1);
+  this->find_cache.invalidate();
+
+  if (is_marked(node)) {
+    set_marked(node, false);
+    this->pending_removals.reduce(1);
+  }
+
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    Node *next = bucket_next(&node);
+    if (next != &node) {
+      Node *prev = bucket_prev(&node);
+      bucket_next(prev) = next;
+      bucket_prev(next) = prev;
+
+      if (!is_bucket_member(&node)) {
+        // The first member of the bucket becomes the new representative
+        this->bucket_take_over(node, *next);
+      }
+      return;
+    }
+  }
 
   // TODO collapse this method
   this->remove_to_leaf(node);
@@ -855,6 +1810,16 @@ void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType,
                                                               reverse>::step_forward()
 {
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    // Walk through the bucket first. Its last element links back to the representative.
+    BaseType *next = bucket_next(this->n);
+    this->n = next;
+    if (is_bucket_member(next)) {
+      return;
+    }
+  }
+
   // No more equal elements
   if (this->n->NB::_rbt_right != nullptr) {
     // go to smallest larger-or-equal child
@@ -888,6 +1853,12 @@ void
 RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType,
                                                               reverse>::step_back()
 {
+  // TODO constexpr - if
+  if (Options::equality_buckets && is_bucket_member(this->n)) {
+    this->n = bucket_prev(this->n);
+    return;
+  }
+
   if (this->n->NB::_rbt_left != nullptr) {
     // go to largest smaller child
     this->n = this->n->NB::_rbt_left;
@@ -912,6 +1883,12 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator,
       this->n = this->n->NB::_rbt_parent;
     }
   }
+
+  // TODO constexpr - if
+  if (Options::equality_buckets && (this->n != nullptr)) {
+    // Arrive at the last element of the predecessor's bucket
+    this->n = bucket_prev(this->n);
+  }
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
@@ -1067,71 +2044,242 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator,
                                                               reverse>::operator-(
         size_t steps) const
 {
-  ConcreteIterator cpy(this->n);
-  cpy -= steps;
+  ConcreteIterator cpy(this->n);
+  cpy -= steps;
+  return cpy;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class ConcreteIterator, class BaseType, bool reverse>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template IteratorBase<ConcreteIterator, BaseType, reverse>::reference
+RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType, reverse>::operator*() const
+{
+  return *(this->n);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class ConcreteIterator, class BaseType, bool reverse>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template IteratorBase<ConcreteIterator, BaseType, reverse>::pointer
+RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType, reverse>::operator->() const
+{
+  return this->n;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::get_smallest() const
+{
+  Node *smallest = this->root;
+  if (smallest == nullptr) {
+    return nullptr;
+  }
+
+  while (smallest->NB::_rbt_left != nullptr) {
+    smallest = smallest->NB::_rbt_left;
+  }
+
+  return smallest;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::get_largest() const
+{
+  Node *largest = this->root;
+  if (largest == nullptr) {
+    return nullptr;
+  }
+
+  while (largest->NB::_rbt_right != nullptr) {
+    largest = largest->NB::_rbt_right;
+  }
+
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    largest = bucket_prev(largest);
+  }
+
+  return largest;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template const_iterator<false>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator_to(const Node &node) const
+{
+  return const_iterator<false>(&node);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<false>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator_to(Node &node)
+{
+  return iterator<false>(&node);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::ScanIterator()
+    : head(0), queued(0), walker(nullptr)
+{}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::ScanIterator(const Node *start)
+    : head(0), queued(0), walker(start)
+{
+  // The subtrees right of the ancestors are visited later on
+  for (const Node *ancestor = start; ancestor != nullptr;
+       ancestor = ancestor->NB::_rbt_parent) {
+    prefetch_below(ancestor);
+  }
+
+  while ((this->queued < lookahead) && (this->walker != nullptr)) {
+    this->enqueue_next();
+  }
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator==(const ScanIterator &other) const
+{
+  const Node *mine = (this->queued > 0) ? this->queue[this->head] : nullptr;
+  const Node *theirs = (other.queued > 0) ? other.queue[other.head] : nullptr;
+  return mine == theirs;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator!=(const ScanIterator &other) const
+{
+  return !(*this == other);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead> &
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator++()
+{
+  this->head = (this->head + 1) % lookahead;
+  this->queued--;
+  if (this->walker != nullptr) {
+    this->enqueue_next();
+  }
+  return *this;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator++(int)
+{
+  ScanIterator cpy = *this;
+  ++(*this);
   return cpy;
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-template <class ConcreteIterator, class BaseType, bool reverse>
-typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template IteratorBase<ConcreteIterator, BaseType, reverse>::reference
-RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType, reverse>::operator*() const
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>::reference
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator*() const
 {
-  return *(this->n);
+  return *this->queue[this->head];
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-template <class ConcreteIterator, class BaseType, bool reverse>
-typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template IteratorBase<ConcreteIterator, BaseType, reverse>::pointer
-RBTree<Node, NodeTraits, Options, Tag, Compare>::IteratorBase<ConcreteIterator, BaseType, reverse>::operator->() const
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>::pointer
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::operator->() const
 {
-  return this->n;
+  return this->queue[this->head];
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-Node *
-RBTree<Node, NodeTraits, Options, Tag, Compare>::get_smallest() const
+template <size_t lookahead>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::enqueue_next()
 {
-  Node *smallest = this->root;
-  if (smallest == nullptr) {
-    return nullptr;
+  this->queue[(this->head + this->queued) % lookahead] = this->walker;
+  this->queued++;
+  this->walker = step_prefetching(this->walker);
+}
+
+/*
+ * Same as IteratorBase::step_forward(), but prefetches everything below the nodes it descends to
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+const Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::step_prefetching(const Node *n)
+{
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    const Node *next = bucket_next(n);
+    if (is_bucket_member(next)) {
+      utilities::prefetch(bucket_next(next));
+      return next;
+    }
+    n = next;
   }
 
-  while (smallest->NB::_rbt_left != nullptr) {
-    smallest = smallest->NB::_rbt_left;
+  if (n->NB::_rbt_right != nullptr) {
+    n = n->NB::_rbt_right;
+    prefetch_below(n);
+    while (n->NB::_rbt_left != nullptr) {
+      n = n->NB::_rbt_left;
+      prefetch_below(n);
+    }
+    return n;
   }
 
-  return smallest;
+  while ((n->NB::_rbt_parent != nullptr) && (n->NB::_rbt_parent->NB::_rbt_right == n)) {
+    n = n->NB::_rbt_parent;
+  }
+  return n->NB::_rbt_parent;
 }
 
+/*
+ * Prefetches what is needed after <n> has been visited: its right child and its bucket
+ */
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-Node *
-RBTree<Node, NodeTraits, Options, Tag, Compare>::get_largest() const
+template <size_t lookahead>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::ScanIterator<lookahead>::prefetch_below(const Node *n)
 {
-  Node *largest = this->root;
-  if (largest == nullptr) {
-    return nullptr;
-  }
-
-  while (largest->NB::_rbt_right != nullptr) {
-    largest = largest->NB::_rbt_right;
+  // Prefetching a null pointer is harmless
+  utilities::prefetch(n->NB::_rbt_right);
+  // TODO constexpr - if
+  if (Options::equality_buckets) {
+    utilities::prefetch(bucket_next(n));
   }
+}
 
-  return largest;
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::scan_begin() const
+{
+  return ScanIterator<lookahead>(this->get_smallest());
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template const_iterator<false>
-RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator_to(const Node &node) const
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::scan_begin(const_iterator<false> from) const
 {
-  return const_iterator<false>(&node);
+  if (from == this->cend()) {
+    return ScanIterator<lookahead>();
+  }
+  return ScanIterator<lookahead>(&(*from));
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
-typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<false>
-RBTree<Node, NodeTraits, Options, Tag, Compare>::iterator_to(Node &node)
+template <size_t lookahead>
+typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template ScanIterator<lookahead>
+RBTree<Node, NodeTraits, Options, Tag, Compare>::scan_end() const
 {
-  return iterator<false>(&node);
+  return ScanIterator<lookahead>();
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
@@ -1244,13 +2392,26 @@ typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<fals
 RBTree<Node, NodeTraits, Options, Tag, Compare>::find(const Comparable &query, Callbacks * cbs)
 {
 	Node *cur = this->root;
+	uint64_t prefix = this->get_query_prefix(query);
 	cbs->init_root(cur);
 
+	this->stats.count_descent();
 	while (cur != nullptr) {
-		if (this->cmp(*cur, query)) {
+		this->stats.count_descent_step();
+		int c;
+		// TODO constexpr - if
+		if (uses_three_way_compare<Comparable>()) {
+			c = this->node_cmp_query(*cur, query, prefix);
+		} else if (this->node_less_query(*cur, query, prefix)) {
+			c = -1;
+		} else {
+			c = this->query_less_node(query, prefix, *cur) ? 1 : 0;
+		}
+
+		if (c < 0) {
 			cur = cur->NB::_rbt_right;
 			cbs->descend_right(cur);
-		} else if (this->cmp(query, *cur)) {
+		} else if (c > 0) {
 			cur = cur->NB::_rbt_left;
 			cbs->descend_left(cur);
 		} else {
@@ -1267,23 +2428,56 @@ template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 template <class Comparable>
 typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template iterator<false>
 RBTree<Node, NodeTraits, Options, Tag, Compare>::find(const Comparable &query)
+{
+  return iterator<false>(this->find_cached(query));
+}
+
+/*
+ * Descends the tree to find the first element equal to <query>, returns nullptr if there is none
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Comparable>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::find_in_tree(const Comparable &query) const
 {
   Node *cur = this->root;
   Node *last_left = nullptr;
+  bool last_left_equal = false;
+  uint64_t prefix = this->get_query_prefix(query);
 
+  this->stats.count_descent();
   while (cur != nullptr) {
-    if (this->cmp(*cur, query)) {
-      cur = cur->NB::_rbt_right;
+    this->stats.count_descent_step();
+
+    // TODO constexpr - if
+    if (uses_three_way_compare<Comparable>()) {
+      int c = this->node_cmp_query(*cur, query, prefix);
+      if (c < 0) {
+        cur = cur->NB::_rbt_right;
+      } else {
+        last_left = cur;
+        last_left_equal = (c == 0);
+        cur = cur->NB::_rbt_left;
+      }
     } else {
-      last_left = cur;
-      cur = cur->NB::_rbt_left;
+      if (this->node_less_query(*cur, query, prefix)) {
+        cur = cur->NB::_rbt_right;
+      } else {
+        last_left = cur;
+        cur = cur->NB::_rbt_left;
+      }
     }
   }
 
-  if ((last_left != nullptr) && (!this->cmp(query, *last_left))) {
-    return iterator<false>(last_left);
+  // TODO constexpr - if
+  if (!uses_three_way_compare<Comparable>() && (last_left != nullptr)) {
+    last_left_equal = !this->query_less_node(query, prefix, *last_left);
+  }
+
+  if ((last_left != nullptr) && last_left_equal) {
+    return last_left;
   } else {
-    return this->end();
+    return nullptr;
   }
 }
 
@@ -1292,7 +2486,8 @@ template <class Comparable>
 typename RBTree<Node, NodeTraits, Options, Tag, Compare>::template const_iterator<false>
 RBTree<Node, NodeTraits, Options, Tag, Compare>::find(const Comparable &query) const
 {
-  return const_iterator<false>(const_cast<decltype(this)>(this)->find(query));
+  // Bypasses the find() cache, so that concurrent const lookups do not write to the tree
+  return const_iterator<false>(this->find_in_tree(query));
 }
 
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
@@ -1302,9 +2497,12 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::lower_bound(const Comparable &q
 {
   Node *cur = this->root;
   Node *last_left = nullptr;
+  uint64_t prefix = this->get_query_prefix(query);
 
+  this->stats.count_descent();
   while (cur != nullptr) {
-    if (this->cmp(*cur, query)) {
+    this->stats.count_descent_step();
+    if (this->node_less_query(*cur, query, prefix)) {
       cur = cur->NB::_rbt_right;
     } else {
       last_left = cur;
@@ -1326,9 +2524,12 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::upper_bound(const Comparable &q
 {
   Node *cur = this->root;
   Node *last_left = nullptr;
+  uint64_t prefix = this->get_query_prefix(query);
 
+  this->stats.count_descent();
   while (cur != nullptr) {
-    if (this->cmp(query, *cur)) {
+    this->stats.count_descent_step();
+    if (this->query_less_node(query, prefix, *cur)) {
       last_left = cur;
       cur = cur->_rbt_left;
     } else {
@@ -1381,6 +2582,592 @@ RBTree<Node, NodeTraits, Options, Tag, Compare>::get_right_child(Node *n){
 	return n->NB::_rbt_right;
 }
 
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::relocate(Node & from, Node & to)
+{
+	if (&from == &to) {
+		return;
+	}
+
+	// A pending removal moves along with the node
+	set_marked(to, is_marked(from));
+	set_marked(from, false);
+	this->find_cache.invalidate();
+
+	// TODO constexpr - if
+	if (Options::equality_buckets) {
+		Node * next = bucket_next(&from);
+		if (next == &from) {
+			bucket_next(&to) = &to;
+			bucket_prev(&to) = &to;
+		} else {
+			Node * prev = bucket_prev(&from);
+			bucket_next(&to) = next;
+			bucket_prev(&to) = prev;
+			bucket_next(prev) = &to;
+			bucket_prev(next) = &to;
+		}
+
+		if (is_bucket_member(&from)) {
+			mark_bucket_member(to);
+			copy_order_label(from, to);
+			NodeTraits::relocated(from, to);
+			return;
+		}
+	}
+
+	this->relocate_links(from, to);
+	copy_order_label(from, to);
+	NodeTraits::relocated(from, to);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::is_before(const Node & a, const Node & b) const
+{
+	static_assert(Options::order_queries, "is_before() requires the ORDER_QUERIES option");
+	return a.NB::_rbt_order_label < b.NB::_rbt_order_label;
+}
+
+/*
+ * Order labels are kept in [0, 2^63) and increase along the iteration order. A new node gets
+ * the label in the middle between its neighbors. If there is no free label between them, we
+ * relabel the smallest aligned label range around the node that is not too dense, as described
+ * by Bender et al. ("Two Simplified Algorithms for Maintaining Order in a List"). A range of
+ * 2^i labels may hold at most (2/T)^i nodes.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::assign_order_label(Node & node)
+{
+	constexpr unsigned int LABEL_BITS = 63;
+	constexpr double T = 1.3;
+
+	iterator<false> pred(&node);
+	--pred;
+	iterator<false> succ(&node);
+	++succ;
+
+	uint64_t low = (pred != this->end()) ? pred->NB::_rbt_order_label + 1 : 0;
+	uint64_t high = (succ != this->end()) ? succ->NB::_rbt_order_label
+	                                      : (static_cast<uint64_t>(1) << LABEL_BITS);
+	if (low < high) {
+		node.NB::_rbt_order_label = low + (high - low) / 2;
+		return;
+	}
+
+	// No free label. Grow a range around the predecessor's label until it is sparse enough.
+	uint64_t base = (pred != this->end()) ? pred->NB::_rbt_order_label : 0;
+	iterator<false> first(&node);
+	iterator<false> before = pred;
+	iterator<false> after = succ;
+	uint64_t count = 1;
+	uint64_t range_start = base;
+	unsigned int bits = 0;
+	double limit = 1;
+
+	do {
+		bits++;
+		limit *= 2 / T;
+		range_start = base & ~((static_cast<uint64_t>(1) << bits) - 1);
+		uint64_t range_end = range_start + ((static_cast<uint64_t>(1) << bits) - 1);
+
+		while ((before != this->end()) && (before->NB::_rbt_order_label >= range_start)) {
+			first = before;
+			--before;
+			count++;
+		}
+		while ((after != this->end()) && (after->NB::_rbt_order_label <= range_end)) {
+			++after;
+			count++;
+		}
+	} while ((bits < LABEL_BITS) && (static_cast<double>(count) > limit));
+
+	// Spread the nodes in the range evenly, leaving room at both ends
+	uint64_t spacing = (static_cast<uint64_t>(1) << bits) / count;
+	uint64_t label = range_start + spacing / 2;
+	for (iterator<false> it = first ; it != after ; ++it) {
+		it->NB::_rbt_order_label = label;
+		label += spacing;
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::assign_all_order_labels()
+{
+	uint64_t count = 0;
+	for (auto it = this->begin() ; it != this->end() ; ++it) {
+		count++;
+	}
+	if (count == 0) {
+		return;
+	}
+
+	uint64_t spacing = (static_cast<uint64_t>(1) << 63) / (count + 1);
+	uint64_t label = spacing;
+	for (auto it = this->begin() ; it != this->end() ; ++it) {
+		it->NB::_rbt_order_label = label;
+		label += spacing;
+	}
+}
+
+/*
+ * Only transfers the tree links, without calling any hooks
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::relocate_links(Node & from, Node & to)
+{
+	Node * parent = from.NB::_rbt_parent;
+	to.NB::_rbt_parent = parent;
+	to.NB::_rbt_left = from.NB::_rbt_left;
+	to.NB::_rbt_right = from.NB::_rbt_right;
+	to.NB::_rbt_color = from.NB::_rbt_color;
+	this->set_key_prefix(to, this->stored_key_prefix(from));
+
+	if (parent == nullptr) {
+		this->root = &to;
+	} else if (parent->NB::_rbt_left == &from) {
+		parent->NB::_rbt_left = &to;
+	} else {
+		parent->NB::_rbt_right = &to;
+	}
+
+	if (to.NB::_rbt_left != nullptr) {
+		to.NB::_rbt_left->NB::_rbt_parent = &to;
+	}
+	if (to.NB::_rbt_right != nullptr) {
+		to.NB::_rbt_right->NB::_rbt_parent = &to;
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::defragment(Node * arena,
+                                                            DefragmentationOrder order)
+{
+	static_assert(std::is_move_assignable<Node>::value,
+	              "defragment() requires a move-assignable Node!");
+
+	if (this->root == nullptr) {
+		return;
+	}
+
+	if (order == DefragmentationOrder::VAN_EMDE_BOAS) {
+		this->defragment_veb(this->root, this->get_height(this->root), arena);
+		return;
+	}
+
+	Node * cur = this->get_smallest();
+	while (cur != nullptr) {
+		// Find the successor while cur is still linked into the tree
+		iterator<false> next(cur);
+		++next;
+
+		*arena = std::move(*cur);
+		this->relocate(*cur, *arena);
+		arena++;
+
+		cur = (next != this->end()) ? &(*next) : nullptr;
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+size_t
+RBTree<Node, NodeTraits, Options, Tag, Compare>::get_height(Node * node) const
+{
+	if (node == nullptr) {
+		return 0;
+	}
+
+	size_t left_height = this->get_height(node->NB::_rbt_left);
+	size_t right_height = this->get_height(node->NB::_rbt_right);
+
+	return 1 + ((left_height > right_height) ? left_height : right_height);
+}
+
+/*
+ * Places the top <height> levels of the subtree below <node> in van Emde Boas layout: first the
+ * upper half of the levels, then every subtree hanging off the upper half, left to right. Returns
+ * the new address of <node>.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+Node *
+RBTree<Node, NodeTraits, Options, Tag, Compare>::defragment_veb(Node * node, size_t height,
+                                                                Node *& arena)
+{
+	if (height == 1) {
+		Node * to = arena++;
+		*to = std::move(*node);
+		this->relocate(*node, *to);
+
+		// TODO constexpr - if
+		if (Options::equality_buckets) {
+			// Keep the bucket right behind its representative
+			Node * member = bucket_next(to);
+			while (member != to) {
+				Node * next = bucket_next(member);
+				*arena = std::move(*member);
+				this->relocate(*member, *arena);
+				arena++;
+				member = next;
+			}
+		}
+
+		return to;
+	}
+
+	size_t top_height = height / 2;
+	node = this->defragment_veb(node, top_height, arena);
+	this->defragment_veb_bottom(node, top_height, height - top_height, arena);
+
+	return node;
+}
+
+/*
+ * Places every subtree rooted <depth> levels below <node> via defragment_veb()
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::defragment_veb_bottom(Node * node, size_t depth,
+                                                                       size_t height,
+                                                                       Node *& arena)
+{
+	if (depth == 0) {
+		this->defragment_veb(node, height, arena);
+		return;
+	}
+
+	if (node->NB::_rbt_left != nullptr) {
+		this->defragment_veb_bottom(node->NB::_rbt_left, depth - 1, height, arena);
+	}
+	// Must be read only now, since <node>'s children are relocated
+	if (node->NB::_rbt_right != nullptr) {
+		this->defragment_veb_bottom(node->NB::_rbt_right, depth - 1, height, arena);
+	}
+}
+
+/*
+ * Shape format: the number of nodes, followed by one record per node in pre-order. A record is a
+ * tag byte (bit 0: black, bit 1: has left child, bit 2: has right child) followed by the node's
+ * ID. All words are 64 bit little endian.
+ *
+ * With EQUALITY_BUCKETS, bit 3 of the tag marks a representative with a non-empty bucket. Its
+ * record is followed by the number of further elements in the bucket and their IDs, in order.
+ * The number of nodes at the beginning counts these elements, too.
+ */
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Stream>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::write_shape_word(Stream & stream, uint64_t word)
+{
+	char buf[8];
+	for (unsigned int i = 0 ; i < 8 ; ++i) {
+		buf[i] = static_cast<char>((word >> (8 * i)) & 0xFF);
+	}
+	stream.write(buf, 8);
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Stream>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::read_shape_word(Stream & stream, uint64_t & word)
+{
+	char buf[8];
+	stream.read(buf, 8);
+	if (!stream) {
+		return false;
+	}
+
+	word = 0;
+	for (unsigned int i = 0 ; i < 8 ; ++i) {
+		word |= static_cast<uint64_t>(static_cast<unsigned char>(buf[i])) << (8 * i);
+	}
+	return true;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Stream, class NodeIdFn>
+void
+RBTree<Node, NodeTraits, Options, Tag, Compare>::serialize_shape(Stream & stream,
+                                                                 NodeIdFn node_id_fn) const
+{
+	uint64_t count = 0;
+	for (auto it = this->begin() ; it != this->end() ; ++it) {
+		count++;
+	}
+	write_shape_word(stream, count);
+
+	Node * cur = this->root;
+	while (cur != nullptr) {
+		char tag = 0;
+		if (cur->NB::_rbt_color == Base::Color::BLACK) {
+			tag |= 1;
+		}
+		if (cur->NB::_rbt_left != nullptr) {
+			tag |= 2;
+		}
+		if (cur->NB::_rbt_right != nullptr) {
+			tag |= 4;
+		}
+
+		uint64_t members = 0;
+		// TODO constexpr - if
+		if (Options::equality_buckets) {
+			for (Node * m = bucket_next(cur) ; m != cur ; m = bucket_next(m)) {
+				members++;
+			}
+			if (members > 0) {
+				tag |= 8;
+			}
+		}
+
+		stream.write(&tag, 1);
+		write_shape_word(stream, static_cast<uint64_t>(node_id_fn(static_cast<const Node &>(*cur))));
+
+		if (members > 0) {
+			write_shape_word(stream, members);
+			for (Node * m = bucket_next(cur) ; m != cur ; m = bucket_next(m)) {
+				write_shape_word(stream, static_cast<uint64_t>(node_id_fn(static_cast<const Node &>(*m))));
+			}
+		}
+
+		// Advance in pre-order
+		if (cur->NB::_rbt_left != nullptr) {
+			cur = cur->NB::_rbt_left;
+		} else if (cur->NB::_rbt_right != nullptr) {
+			cur = cur->NB::_rbt_right;
+		} else {
+			// Go up until we find a right subtree that we have not visited yet
+			while ((cur->NB::_rbt_parent != nullptr) &&
+			       ((cur->NB::_rbt_parent->NB::_rbt_right == cur) ||
+			        (cur->NB::_rbt_parent->NB::_rbt_right == nullptr))) {
+				cur = cur->NB::_rbt_parent;
+			}
+
+			if (cur->NB::_rbt_parent != nullptr) {
+				cur = cur->NB::_rbt_parent->NB::_rbt_right;
+			} else {
+				cur = nullptr;
+			}
+		}
+	}
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+template <class Stream, class IdToNodeFn>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::deserialize_shape(Stream & stream,
+                                                                   IdToNodeFn id_to_node_fn,
+                                                                   bool verify)
+{
+	this->root = nullptr;
+	this->s.set(0);
+	this->pending_removals.set(0);
+	this->find_cache.invalidate();
+
+	uint64_t count;
+	if (!read_shape_word(stream, count)) {
+		return false;
+	}
+
+	/*
+	 * While a node's subtrees are being restored, a child pointer pointing to the node itself
+	 * marks a child that is yet to be read. This way, no additional memory is needed.
+	 */
+	Node * parent = nullptr;
+	// Every node is finished exactly once. More finishes mean that an ID was repeated.
+	uint64_t finished = 0;
+	const char valid_tags = Options::equality_buckets ? 15 : 7;
+	for (uint64_t i = 0 ; i < count ; ++i) {
+		char tag;
+		uint64_t id;
+		stream.read(&tag, 1);
+		if ((!stream) || ((tag & ~valid_tags) != 0) || (!read_shape_word(stream, id))) {
+			this->root = nullptr;
+			return false;
+		}
+
+		Node * node = id_to_node_fn(id);
+		if ((node == nullptr) || ((i > 0) && (parent == nullptr))) {
+			// Unknown ID or more than one tree in the data
+			this->root = nullptr;
+			return false;
+		}
+
+		node->NB::_rbt_parent = parent;
+		node->NB::_rbt_color = (tag & 1) ? Base::Color::BLACK : Base::Color::RED;
+		node->NB::_rbt_left = (tag & 2) ? node : nullptr;
+		node->NB::_rbt_right = (tag & 4) ? node : nullptr;
+		set_marked(*node, false);
+		this->set_key_prefix(*node, this->get_query_prefix(*node));
+
+		// TODO constexpr - if
+		if (Options::equality_buckets) {
+			bucket_next(node) = node;
+			bucket_prev(node) = node;
+
+			uint64_t members = 0;
+			if ((tag & 8) && (!read_shape_word(stream, members) || (members == 0) ||
+			                  (members > count - i - 1))) {
+				this->root = nullptr;
+				return false;
+			}
+
+			for (uint64_t j = 0 ; j < members ; ++j) {
+				uint64_t member_id;
+				Node * member = nullptr;
+				if (read_shape_word(stream, member_id)) {
+					member = id_to_node_fn(member_id);
+				}
+				if ((member == nullptr) || (member == node)) {
+					this->root = nullptr;
+					return false;
+				}
+				this->insert_into_bucket(*member, *node, false);
+				this->set_key_prefix(*member, this->get_query_prefix(*member));
+			}
+			i += members;
+		}
+
+		if (parent == nullptr) {
+			this->root = node;
+		} else if (parent->NB::_rbt_left == parent) {
+			parent->NB::_rbt_left = node;
+		} else {
+			parent->NB::_rbt_right = node;
+		}
+
+		// Find the next node that is still missing a child, finishing all subtrees on the way
+		Node * cur = node;
+		while ((cur != nullptr) && (cur->NB::_rbt_left != cur) && (cur->NB::_rbt_right != cur)) {
+			if (++finished > count) {
+				// A repeated ID has linked the nodes into a cycle
+				this->root = nullptr;
+				return false;
+			}
+			NodeTraits::subtree_rebuilt(*cur);
+			cur = cur->NB::_rbt_parent;
+		}
+		parent = cur;
+	}
+
+	if ((parent != nullptr) || !this->shape_is_tree(count)) {
+		// Data ended before all announced children were read, or an ID was repeated
+		this->root = nullptr;
+		return false;
+	}
+
+	this->s.set(static_cast<size_t>(count));
+	this->update_all_order_labels();
+
+	if (verify && !this->verify_integrity()) {
+		this->root = nullptr;
+		this->s.set(0);
+		return false;
+	}
+
+	return true;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+bool
+RBTree<Node, NodeTraits, Options, Tag, Compare>::shape_is_tree(uint64_t count) const
+{
+	/*
+	 * A node that was handed out twice has been linked at two places, but its own links only
+	 * point to one of them. Thus, we follow a link only if it is mirrored, and then count the
+	 * distinct nodes that we reach.
+	 */
+	Node * cur = this->root;
+	if ((cur != nullptr) && (cur->NB::_rbt_parent != nullptr)) {
+		return false;
+	}
+
+	uint64_t seen = 0;
+	while (cur != nullptr) {
+		if (++seen > count) {
+			return false;
+		}
+
+		// TODO constexpr - if
+		if (Options::equality_buckets) {
+			Node * m = cur;
+			do {
+				if ((bucket_prev(bucket_next(m)) != m) || ((m != cur) && !is_bucket_member(m))) {
+					return false;
+				}
+				m = bucket_next(m);
+				if ((m != cur) && (++seen > count)) {
+					return false;
+				}
+			} while (m != cur);
+		}
+
+		Node * left = cur->NB::_rbt_left;
+		Node * right = cur->NB::_rbt_right;
+		if (((left != nullptr) && ((left == right) || (left->NB::_rbt_parent != cur))) ||
+		    ((right != nullptr) && (right->NB::_rbt_parent != cur))) {
+			return false;
+		}
+
+		// Advance in pre-order
+		if (left != nullptr) {
+			cur = left;
+		} else if (right != nullptr) {
+			cur = right;
+		} else {
+			while ((cur->NB::_rbt_parent != nullptr) &&
+			       ((cur->NB::_rbt_parent->NB::_rbt_right == cur) ||
+			        (cur->NB::_rbt_parent->NB::_rbt_right == nullptr))) {
+				cur = cur->NB::_rbt_parent;
+			}
+
+			if (cur->NB::_rbt_parent != nullptr) {
+				cur = cur->NB::_rbt_parent->NB::_rbt_right;
+			} else {
+				cur = nullptr;
+			}
+		}
+	}
+
+	return seen == count;
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+TreeStatistics
+RBTree<Node, NodeTraits, Options, Tag, Compare>::get_statistics() const
+{
+	return this->stats.get();
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+TreeStatistics
+RBTree<Node, NodeTraits, Options, Tag, Compare>::reset_statistics()
+{
+	return this->stats.reset();
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+FindCacheStatistics
+RBTree<Node, NodeTraits, Options, Tag, Compare>::get_find_cache_statistics() const
+{
+	static_assert(Options::find_cache_slots > 0,
+	              "get_find_cache_statistics() requires the FIND_CACHE option");
+	return this->find_cache.get_statistics();
+}
+
+template <class Node, class NodeTraits, class Options, class Tag, class Compare>
+FindCacheStatistics
+RBTree<Node, NodeTraits, Options, Tag, Compare>::reset_find_cache_statistics()
+{
+	static_assert(Options::find_cache_slots > 0,
+	              "reset_find_cache_statistics() requires the FIND_CACHE option");
+	return this->find_cache.reset_statistics();
+}
+
 template <class Node, class NodeTraits, class Options, class Tag, class Compare>
 Node *
 RBTree<Node, NodeTraits, Options, Tag, Compare>::get_root() const
@@ -1,18 +1,19 @@
 #ifndef RBTREE_HPP
 #define RBTREE_HPP
 
+#include <algorithm>
 #include <cstddef>
-#include <set>
+#include <cstdint>
 #include <cassert>
+#include <limits>
 #include <type_traits>
+#include <utility>
 
 #include "size_holder.hpp"
+#include "statistics_holder.hpp"
+#include "find_cache.hpp"
 #include "options.hpp"
 
-// Only for debugging purposes
-#include <fstream>
-#include <vector>
-
 namespace ygg {
   namespace utilities {
 	  /// @cond INTERNAL
@@ -26,6 +27,56 @@ namespace ygg {
 		  Node *                      _rbt_right = nullptr;
 		  RBTreeNodeBaseImpl::Color   _rbt_color;
 	  };
+
+		  template<class Tag, bool enable>
+		  class RBTreeKeyPrefixHolder {};
+
+		  template<class Tag>
+		  class RBTreeKeyPrefixHolder<Tag, true> {
+		  public:
+			  uint64_t                    _rbt_key_prefix;
+		  };
+
+		  template<class Tag, bool enable>
+		  class RBTreeOrderLabelHolder {};
+
+		  template<class Tag>
+		  class RBTreeOrderLabelHolder<Tag, true> {
+		  public:
+			  uint64_t                    _rbt_order_label;
+		  };
+
+		  template<class Tag, bool enable>
+		  class RBTreeRemovalMarkHolder {};
+
+		  template<class Tag>
+		  class RBTreeRemovalMarkHolder<Tag, true> {
+		  public:
+			  bool                        _rbt_marked = false;
+		  };
+
+		  // Counts the nodes marked for removal
+		  template<bool enable>
+		  class RBTreeRemovalCounter {
+		  public:
+			  void add(size_t i) { (void)i; }
+			  void reduce(size_t i) { (void)i; }
+			  void set(size_t i) { (void)i; }
+			  size_t get() const { return 0; }
+		  };
+
+		  template<>
+		  class RBTreeRemovalCounter<true> : public SizeHolder<true> {};
+
+		  template<class Node, class Tag, bool enable>
+		  class RBTreeEqualityBucketHolder {};
+
+		  template<class Node, class Tag>
+		  class RBTreeEqualityBucketHolder<Node, Tag, true> {
+		  public:
+			  Node *                      _rbt_bucket_prev;
+			  Node *                      _rbt_bucket_next;
+		  };
 	  /// @endcond
   } // namespace utilities
 
@@ -43,6 +94,16 @@ public:
 	static DefaultFindCallbacks<Node> dummy;
 };
 
+/**
+ * @brief The order in which RBTree::defragment() places the nodes in the arena
+ */
+enum class DefragmentationOrder {
+	/// Nodes are placed in sorted order. Best for scans over the tree.
+	IN_ORDER,
+	/// Nodes are placed in van Emde Boas layout. Best for lookups.
+	VAN_EMDE_BOAS
+};
+
 /**
  * @brief Base class (template) to supply your node class with metainformation
  *
@@ -58,7 +119,12 @@ public:
  * RBTree for details.
  */
 template<class Node, class Options = DefaultOptions, class Tag = int>
-class RBTreeNodeBase : public utilities::RBTreeNodeBaseImpl<Node, Tag> {};
+class RBTreeNodeBase : public utilities::RBTreeNodeBaseImpl<Node, Tag>,
+                       public utilities::RBTreeKeyPrefixHolder<Tag, Options::key_prefix_cache>,
+                       public utilities::RBTreeOrderLabelHolder<Tag, Options::order_queries>,
+                       public utilities::RBTreeRemovalMarkHolder<Tag, Options::deferred_removal>,
+                       public utilities::RBTreeEqualityBucketHolder<Node, Tag,
+                                                                    Options::equality_buckets> {};
 
 /**
  * @brief   Helper base class for the NodeTraits you need to implement
@@ -81,6 +147,11 @@ public:
   static void swapped(Node & old_ancestor, Node & old_descendant) {
 	  (void)old_ancestor; (void)old_descendant;
   };
+	static void relocated(Node & from, Node & to) {
+		(void)from; (void)to;
+	};
+	static void subtree_rebuilt(Node & node) { (void)node; };
+	static void key_changed(Node & node) { (void)node; };
 };
 
 /**
@@ -110,6 +181,11 @@ public:
 	// Node Base
 	using NB = RBTreeNodeBase<Node, Options, Tag>;
 	static_assert(std::is_base_of<NB, Node>::value, "Node class not properly derived from RBTreeNodeBase");
+	static_assert(Options::multiple || !Options::equality_buckets,
+	              "EQUALITY_BUCKETS requires MULTIPLE");
+
+	/// Whether the tree can contain several elements that compare equally, see TreeFlags::MULTIPLE
+	static constexpr bool allows_equal_elements = Options::multiple;
 
 	/**
  * @brief Iterator over elements in the tree
@@ -201,6 +277,7 @@ public:
 		iterator(const iterator<reverse> & orig)
 		: IteratorBase<iterator<reverse>, Node, reverse>(orig.n) {};
 		iterator() : IteratorBase<iterator<reverse>, Node, reverse>() {};
+		iterator & operator=(const iterator<reverse> & other) = default;
 	private:
 		friend class const_iterator<reverse>;
 	};
@@ -214,6 +291,64 @@ public:
 		const_iterator(const iterator<reverse> & orig)
 		: IteratorBase<const_iterator<reverse>, const Node, reverse>(orig.n) {};
 		const_iterator() : IteratorBase<const_iterator<reverse>, const Node, reverse>() {};
+		const_iterator & operator=(const const_iterator<reverse> & other) = default;
+	};
+
+	/**
+	 * @brief Forward iterator for long scans, loading nodes ahead of time
+	 *
+	 * Walking from a node to its successor usually means loading a node that is not in the cache
+	 * yet, and a plain iterator stalls on every such load. A ScanIterator runs <lookahead> steps
+	 * ahead of the element it points to and keeps the nodes in between in a small queue. Whenever
+	 * it descends into a subtree, it prefetches the right children of all nodes on the way down,
+	 * because those are visited next after the respective node. Thus, several loads are in flight
+	 * at once, and the nodes are in the cache by the time the scan reaches them.
+	 *
+	 * A ScanIterator is larger than a plain iterator and only goes forward. The tree must not be
+	 * modified while scanning. Get one from scan_begin() and compare it against scan_end().
+	 *
+	 * @tparam lookahead 	The number of nodes to walk ahead. Must be at least 1.
+	 */
+	template<size_t lookahead>
+	class ScanIterator {
+	public:
+		static_assert(lookahead > 0, "A ScanIterator must look ahead at least one node");
+
+		/// @cond INTERNAL
+		typedef ptrdiff_t                         difference_type;
+		typedef const Node                        value_type;
+		typedef const Node &                      reference;
+		typedef const Node *                      pointer;
+		typedef std::forward_iterator_tag         iterator_category;
+		/// @endcond
+
+		/// Creates an iterator pointing behind the last element
+		ScanIterator();
+
+		bool operator==(const ScanIterator & other) const;
+		bool operator!=(const ScanIterator & other) const;
+
+		ScanIterator & operator++();
+		ScanIterator operator++(int);
+
+		reference operator*() const;
+		pointer operator->() const;
+
+	private:
+		explicit ScanIterator(const Node * start);
+
+		// Takes the next node from the walker into the queue
+		void enqueue_next();
+		static const Node * step_prefetching(const Node * n);
+		static void prefetch_below(const Node * n);
+
+		const Node * queue[lookahead];
+		size_t head;
+		size_t queued;
+		// The next node to be queued, or nullptr
+		const Node * walker;
+
+		friend class RBTree;
 	};
 
 	/**
@@ -226,6 +361,9 @@ public:
    * pitfall is to store nodes in a std::vector (or other STL container), which
    * reallocates (and thereby moves objecs around).
    *
+   * If MULTIPLE is not set and the tree already contains an element comparing equally to
+   * <node>, <node> is not inserted. Use insert_unique() to find out whether this happened.
+   *
    * @warning Not available for explicitly ordered trees
    *
    * @param   Node  The node to be inserted.
@@ -238,6 +376,68 @@ public:
 	void insert_left_leaning(Node & node);
 	void insert_right_leaning(Node & node);
 
+	/**
+	 * @brief The result of insert_check()
+	 *
+	 * Holds either the element that prevents an insertion, or the position at which a new
+	 * element can be linked in by insert_commit().
+	 */
+	class InsertCommitData {
+	public:
+		/// The element comparing equally to the checked key, or nullptr if there is none
+		Node * existing = nullptr;
+
+	private:
+		Node * parent = nullptr;
+		bool left = false;
+
+		friend class RBTree;
+	};
+
+	/**
+	 * @brief Inserts <node> if no element comparing equally to it exists
+	 *
+	 * Like insert(), but tells you whether <node> was inserted. This takes a single descent.
+	 *
+	 * @warning Only available if MULTIPLE is not set
+	 *
+	 * @param node  The node to be inserted
+	 * @return An iterator to the inserted node or to the element that prevented the insertion,
+	 * and whether <node> was inserted
+	 */
+	std::pair<iterator<false>, bool> insert_unique(Node & node);
+
+	/**
+	 * @brief Checks whether an element with a certain key could be inserted
+	 *
+	 * This descends the tree once and remembers where an element comparing equally to <key>
+	 * would be linked in. If no such element exists yet (i.e., the existing member of the
+	 * result is nullptr), you can create your node and pass the result to insert_commit(),
+	 * which inserts the node without comparing any keys.
+	 *
+	 * Note that <key> does not have to be a Node, but can be anything that can be compared to
+	 * a Node, just like for find().
+	 *
+	 * @warning Only available if MULTIPLE is not set
+	 *
+	 * @param key   The key to check
+	 * @return The data to be passed to insert_commit()
+	 */
+	template<class Comparable>
+	InsertCommitData insert_check(const Comparable & key) const;
+
+	/**
+	 * @brief Inserts <node> at a position found by insert_check()
+	 *
+	 * No keys are compared. The tree must not have been modified since insert_check() was
+	 * called, and <node> must compare equally to the key passed to it.
+	 *
+	 * @param node          The node to be inserted
+	 * @param commit_data   The result of insert_check(). Its existing member must be nullptr.
+	 * @return An iterator to the inserted node
+	 */
+	iterator<false> insert_commit(Node & node, const InsertCommitData & commit_data);
+
 	/**
 	 * @brief Finds an element in the tree
 	 *
@@ -250,6 +450,9 @@ public:
 	 * are defined and implemented. In the case of using the default ygg::utilities::flexible_less as
 	 * Compare, that means you have to implement operator<() for both types.
 	 *
+	 * If the FIND_CACHE option is set, the non-const version takes the result from the cache if
+	 * possible and updates the cache. The const version never touches the cache.
+	 *
 	 * @warning Not available for explicitly ordered trees
 	 *
 	 * @param query An object comparing equally to the element that should be found.
@@ -324,6 +527,124 @@ public:
    */
   void remove(Node & node);
 
+  /**
+   * @brief Restores the order after the key of <node> has changed
+   *
+   * Call this after changing the key of a node that is in the tree. If <node> is still
+   * ordered correctly with respect to its neighbors, nothing is changed. Otherwise, <node> is
+   * removed and re-inserted, searching for its new position upwards from its old neighbor.
+   * Thus, small changes of a key take O(1) amortized plus O(log d) time, where d is the
+   * number of elements <node> moves past.
+   *
+   * If <node> stays in place, NodeTraits::key_changed(node) is called, so that data derived
+   * from the key (e.g., subtree aggregates) can be updated. Otherwise, the usual removal and
+   * insertion hooks are called.
+   *
+   * If MULTIPLE is not set and another element with the new key exists, <node> is removed from
+   * the tree.
+   *
+   * @param node  The node whose key has changed
+   * @return false if <node> was removed because of an element with an equal key, true otherwise
+   */
+  bool reposition(Node & node);
+
+  /**
+   * @brief Replaces <old_node> by <new_node>, which must compare equally to it
+   *
+   * <new_node> takes the exact place of <old_node> in the tree in O(1), without comparing any
+   * keys. See relocate() for details.
+   *
+   * @param old_node  The node that is currently in the tree
+   * @param new_node  The node to take its place. Must not be in the tree.
+   */
+  void replace_node(Node & old_node, Node & new_node);
+
+  /**
+   * @brief Marks <node> to be removed by the next call to flush_removals()
+   *
+   * The node stays in the tree (and is found, iterated over etc.) until flush_removals() is
+   * called. Marking a node twice has no further effect. If a marked node is removed via
+   * remove() before the flush, its mark is dropped.
+   *
+   * @warning Requires the DEFERRED_REMOVAL option
+   *
+   * @param node  The node to mark. Must be in the tree.
+   */
+  void mark_for_removal(Node & node);
+
+  /**
+   * @brief Removes all nodes marked by mark_for_removal()
+   *
+   * If only few nodes are marked, they are removed one by one, just like remove() would do.
+   * If at least a fraction of rebuild_fraction of all elements is marked, the surviving nodes are
+   * instead relinked into a balanced tree in a single in-order pass, which takes O(n) time no
+   * matter how many nodes are removed. In that case, NodeTraits::subtree_rebuilt(node) is called
+   * for every surviving node after both of its subtrees have been rebuilt, just like
+   * deserialize_shape() does. Otherwise, the usual hooks of remove() are called.
+   *
+   * Both ways need no additional memory. Finding the marked nodes takes O(n) time.
+   *
+   * @warning Requires the DEFERRED_REMOVAL option
+   *
+   * @param rebuild_fraction 	The fraction of marked elements from which on the tree is rebuilt
+   * @return The number of removed nodes
+   */
+  size_t flush_removals(double rebuild_fraction = 0.1);
+
+  /**
+   * @brief Relinks the tree into a shape of minimum height
+   *
+   * Insertions and removals keep the tree balanced, but a tree built from random insertions
+   * can be up to twice as deep as necessary. This relinks all nodes into a red-black tree of
+   * minimum height in a single in-order pass, without comparing keys or allocating memory. Use it
+   * before phases in which the tree is mostly searched.
+   *
+   * NodeTraits::subtree_rebuilt(node) is called for every node after both of its subtrees have
+   * been rebuilt. This runs in O(n).
+   */
+  void optimize();
+
+  /**
+   * @brief Relinks the tree so that heavy nodes are close to the root
+   *
+   * Like optimize(), but instead of minimizing the height, every subtree is rooted at its
+   * heaviest node among those that still allow a valid red-black tree. Thus, frequently accessed
+   * nodes can be put close to the root by using access counts as weights, while the height stays
+   * in O(log n). With EQUALITY_BUCKETS, only representatives are weighed.
+   *
+   * This runs in O(n log n) and needs no additional memory.
+   *
+   * @param weight  Called as weight(const Node &). Must return something that can be compared
+   * with operator<, e.g., an access count.
+   */
+  template<class WeightFn>
+  void optimize(WeightFn weight);
+
+  /**
+   * @brief Moves all elements of another tree into this tree
+   *
+   * Both trees are walked in order once, and the merged sequence is relinked into a tree of
+   * minimum height, just like optimize() does. Thus, this takes O(n + m) time, which pays off
+   * over inserting the elements one by one if the keys of both trees interleave. No memory is
+   * allocated.
+   *
+   * With MULTIPLE (and without EQUALITY_BUCKETS) or a three-way comparator, every step of the
+   * merge takes one comparison, i.e., n + m - 1 comparisons at most. Otherwise, equal keys must
+   * be detected, and a step may take two comparisons, i.e., up to 2(n + m) comparisons.
+   *
+   * With MULTIPLE, the order of equal elements is stable: All elements of this tree come before
+   * the equal elements of <other>. Without MULTIPLE, elements of <other> whose key is already
+   * present in this tree stay in <other>, just like with std::set::merge(). Elements marked for
+   * removal stay marked.
+   *
+   * NodeTraits::subtree_rebuilt(node) is called for every node of both resulting trees after
+   * both of its subtrees have been rebuilt.
+   *
+   * @param other 	The tree to take the elements from. Must use the same Compare class. Will be
+   * empty afterwards, except for the elements mentioned above.
+   */
+  void merge(RBTree & other);
+
   /**
    * @brief Removes all elements from the tree.
    *
@@ -331,21 +652,37 @@ public:
    */
   void clear();
 
+	/**
+	 * @brief Removes all elements from the tree, calling a callback on every node
+	 *
+	 * This walks the tree once in post order, using the tree's own links, and calls
+	 * callback(node) for every node, without any rebalancing. Every node is completely unlinked
+	 * from the tree before the callback is called on it, so the callback may free the node. The
+	 * tree is empty afterwards. This runs in O(n) and needs no additional memory.
+	 *
+	 * @warning The callback must not modify the tree.
+	 *
+	 * @param callback  Called as callback(Node &) on every node of the tree.
+	 */
+	template<class Callback>
+	void drain(Callback callback);
+
+	/**
+	 * @brief Removes all elements from the tree and hands every node to a pool
+	 *
+	 * This is drain(), calling pool.destroy(node) for every node.
+	 *
+	 * @param pool  The pool to return the nodes to. Must offer a destroy(Node *) method, like
+	 * NodePool does.
+	 */
+	template<class Pool>
+	void clear_and_release(Pool & pool);
+
   // Mainly debugging methods
   /// @cond INTERNAL
   bool verify_integrity() const;
   /// @endcond
 
-  /**
-   * @brief Debugging Method: Draw the Tree as a .dot file
-   *
-   * Outputs the current tree as a .dot file which can be drawn using
-   * graphviz.
-   *
-   * @param filename  The file path where to write the .dot file.
-   */
-  void dump_to_dot(const std::string & filename) const;
-
   // Iteration
   /**
    * Returns an iterator pointing to the smallest element in the tree.
@@ -367,6 +704,35 @@ public:
   const_iterator<false> end() const;
 	iterator<false> end();
 
+	/**
+	 * @brief Returns a ScanIterator pointing to the smallest element in the tree
+	 *
+	 * Use it instead of begin() for long scans. See ScanIterator for details.
+	 *
+	 * @tparam lookahead 	The number of nodes to walk ahead
+	 */
+	template<size_t lookahead = 8>
+	ScanIterator<lookahead> scan_begin() const;
+
+	/**
+	 * @brief Returns a ScanIterator pointing to the same element as <from>
+	 *
+	 * Use it to scan a range starting at, e.g., lower_bound(). See ScanIterator for details.
+	 *
+	 * @tparam lookahead 	The number of nodes to walk ahead
+	 * @param from 				The element to start the scan at
+	 */
+	template<size_t lookahead = 8>
+	ScanIterator<lookahead> scan_begin(const_iterator<false> from) const;
+
+	/**
+	 * @brief Returns a ScanIterator pointing behind the largest element in the tree
+	 *
+	 * @tparam lookahead 	The number of nodes to walk ahead
+	 */
+	template<size_t lookahead = 8>
+	ScanIterator<lookahead> scan_end() const;
+
 	/**
    * Returns an reverse iterator pointing to the largest element in the tree.
    */
@@ -415,6 +781,143 @@ public:
 	 */
 	bool empty() const;
 
+	/**
+	 * @brief Returns a snapshot of the operation counters
+	 *
+	 * Returns the counters for comparisons, descents, rotations, swaps and rebalancing
+	 * iterations accumulated since the tree was created or the counters were last reset.
+	 *
+	 * @warning This method is only available if STATISTICS is set as option!
+	 *
+	 * @return A snapshot of the operation counters
+	 */
+	TreeStatistics get_statistics() const;
+
+	/**
+	 * @brief Returns a snapshot of the operation counters and resets them
+	 *
+	 * @warning This method is only available if STATISTICS is set as option!
+	 *
+	 * @return A snapshot of the operation counters taken just before resetting them
+	 */
+	TreeStatistics reset_statistics();
+
+	/**
+	 * @brief Returns the hit and miss counts of the find() cache
+	 *
+	 * @warning This method is only available if FIND_CACHE is set as option!
+	 *
+	 * @return A snapshot of the hit and miss counts
+	 */
+	FindCacheStatistics get_find_cache_statistics() const;
+
+	/**
+	 * @brief Returns the hit and miss counts of the find() cache and resets them
+	 *
+	 * @warning This method is only available if FIND_CACHE is set as option!
+	 *
+	 * @return A snapshot of the counts taken just before resetting them
+	 */
+	FindCacheStatistics reset_find_cache_statistics();
+
+	/**
+	 * @brief Returns whether <a> comes before <b> in the tree
+	 *
+	 * Answers the question by comparing two labels stored in the nodes, i.e., in O(1) and
+	 * without looking at the keys or walking the tree. This also works for elements that
+	 * compare equally. Both nodes must be in this tree.
+	 *
+	 * @warning This method is only available if ORDER_QUERIES is set as option!
+	 *
+	 * @param a   The first node
+	 * @param b   The second node
+	 * @return true if <a> comes before <b> in the iteration order of the tree
+	 */
+	bool is_before(const Node & a, const Node & b) const;
+
+	/**
+	 * @brief Moves a node's position in the tree to a different node object
+	 *
+	 * After this, <to> takes the place of <from> in the tree: it has the same parent, children
+	 * and color, and all links pointing to <from> are rewritten to point to <to>. <from> is not
+	 * part of the tree anymore afterwards. Only the tree's links are transferred - moving the
+	 * payload of your node is up to you. NodeTraits::relocated(from, to) is called afterwards.
+	 *
+	 * This runs in O(1).
+	 *
+	 * With EQUALITY_BUCKETS, <from> may also be an element of a bucket. <to> then takes its place
+	 * in the bucket.
+	 *
+	 * @param from 	The node that is currently in the tree
+	 * @param to 		The node that should take its place. Must not be in the tree.
+	 */
+	void relocate(Node & from, Node & to);
+
+	/**
+	 * @brief Moves all nodes of the tree into a contiguous arena
+	 *
+	 * Every node of the tree is move-assigned to a slot in the arena and then relocated there
+	 * (see relocate()). The nodes are placed at arena[0] through arena[n-1], either in sorted
+	 * order or in van Emde Boas layout, depending on the order parameter. The old node objects
+	 * are not part of the tree afterwards and may be freed.
+	 *
+	 * @warning Only this tree is updated. The nodes must not be part of any other tree (e.g.,
+	 * one with a different Tag) - those trees would still point to the old node objects.
+	 *
+	 * Node must be move-assignable. The payload is moved by Node's move assignment, the tree
+	 * links are set up by relocate() afterwards.
+	 *
+	 * In-order placement runs in O(n), van Emde Boas placement in O(n log log n).
+	 *
+	 * @param arena 	Pointer to at least size() nodes, none of which may be in any tree
+	 * @param order 	The order in which nodes are placed in the arena
+	 */
+	void defragment(Node * arena,
+	                DefragmentationOrder order = DefragmentationOrder::IN_ORDER);
+
+	/**
+	 * @brief Writes the exact shape of the tree to a stream
+	 *
+	 * Writes the structure and the colors of the tree in a compact binary format. The nodes
+	 * themselves are not written, but identified by a 64-bit ID that you supply. Together with
+	 * deserialize_shape(), this allows you to restore a tree without comparing any keys.
+	 *
+	 * This runs in O(n) and needs no additional memory.
+	 *
+	 * @param stream      The stream to write to. Must offer write(const char *, size_t), like
+	 * std::ostream does.
+	 * @param node_id_fn  Called as node_id_fn(const Node &) to retrieve the ID of a node. Must
+	 * return something convertible to uint64_t.
+	 */
+	template<class Stream, class NodeIdFn>
+	void serialize_shape(Stream & stream, NodeIdFn node_id_fn) const;
+
+	/**
+	 * @brief Restores a tree shape written by serialize_shape()
+	 *
+	 * Replaces the contents of this tree by the tree written to the stream. Nodes are looked up by
+	 * their IDs and linked exactly as they were in the serialized tree. No keys are compared and no
+	 * rebalancing takes place. For every restored node, NodeTraits::subtree_rebuilt(node) is
+	 * called after both of its subtrees have been restored.
+	 *
+	 * This runs in O(n) and needs no additional memory. If verify is set, verify_integrity()
+	 * is run on the restored tree, which costs additional time and comparisons.
+	 *
+	 * If reading fails, the data is malformed, an ID is unknown or repeated, or the verification
+	 * fails, the tree is left empty and false is returned. The nodes that have been read so far
+	 * are in an unspecified state in this case. Repeated IDs are always rejected. Setting verify
+	 * additionally checks the order of the keys and the colors.
+	 *
+	 * @param stream          The stream to read from. Must offer read(char *, size_t) and be
+	 * convertible to bool to indicate success, like std::istream.
+	 * @param id_to_node_fn   Called as id_to_node_fn(uint64_t) to retrieve the node of an ID.
+	 * Must return a Node *, or nullptr if the ID is unknown. The node must not be in any tree.
+	 * @param verify          If true, the integrity of the restored tree is verified
+	 * @return true if the tree was restored successfully
+	 */
+	template<class Stream, class IdToNodeFn>
+	bool deserialize_shape(Stream & stream, IdToNodeFn id_to_node_fn, bool verify = false);
+
 	// TODO document
 	Node * get_root() const;
 	static Node * get_parent(Node * n);
@@ -424,29 +927,328 @@ public:
 protected:
 	Node *root;
 
-  template<class NodeNameGetter>
-  void dump_to_dot_base(const std::string & filename, NodeNameGetter name_getter) const;
-
-  template<class NodeNameGetter>
-  void output_node_base(const Node * node, std::ofstream & out, NodeNameGetter name_getter) const;
-
-  using Path = std::vector<Node *>;
+  template<class Comparable>
+  Node * find_in_tree(const Comparable & query) const;
 
   Node * get_smallest() const;
   Node * get_largest() const;
 
   void remove_to_leaf(Node & node);
+  void relocate_links(Node & from, Node & to);
+  void assign_order_label(Node & node);
+  void assign_all_order_labels();
+  void insert_into_bucket(Node & node, Node & successor, bool take_over);
   void fixup_after_delete(Node * parent, bool deleted_left);
 
   template<bool on_equality_prefer_left>
-  void insert_leaf_base(Node & node, Node * start);
+  Node * insert_leaf_base(Node & node, Node * start);
+  template<bool on_equality_prefer_left>
+  Node * last_equal_ancestor(Node * cur, const Node & node, uint64_t prefix);
+  bool split_four_node(Node * node);
+  void link_leaf(Node & node, Node * parent, bool left);
+  template<bool on_equality_prefer_left = true>
+  bool insert_below(Node & node, Node * start);
+  bool insert_hinted(Node & node, Node & hint);
+  bool insert_hinted(Node & node, iterator<false> hint);
+  Node * subtree_around(Node * finger, const Node & node, uint64_t prefix, bool moving_right);
+
+  void mark_node(Node & node);
+  void remove_marked_individually();
+  void rebuild_balanced(bool drop_marked);
+  template<class NextNodeFn>
+  Node * build_balanced(NextNodeFn & next_node, size_t count, size_t depth, size_t red_depth);
+  template<class WeightFn>
+  Node * build_weighted(Node * list, size_t count, size_t black_height, bool black_root,
+                        WeightFn & weight);
+  static size_t full_tree_size(size_t levels);
+  static size_t balanced_red_depth(size_t count);
+
+  /*
+   * Walks the tree nodes in order, using a stack of ancestors instead of parent pointers. Thus,
+   * the links of a node may be overwritten as soon as it has been returned. A red-black tree of
+   * 2^64 nodes is at most 128 levels deep.
+   */
+  class UnlinkingWalker {
+  public:
+	  explicit UnlinkingWalker(Node * root) : depth(0) {
+		  this->push_left_path(root);
+	  }
+
+	  // Returns nullptr after the last node
+	  Node * next() {
+		  if (this->depth == 0) {
+			  return nullptr;
+		  }
+		  Node * cur = this->ancestors[--this->depth];
+		  this->push_left_path(cur->NB::_rbt_right);
+		  return cur;
+	  }
+
+  private:
+	  void push_left_path(Node * n) {
+		  while (n != nullptr) {
+			  this->ancestors[this->depth++] = n;
+			  n = n->NB::_rbt_left;
+		  }
+	  }
+
+	  Node * ancestors[128];
+	  size_t depth;
+  };
 
   void fixup_after_insert(Node * node);
+  void rotate_red_pair(Node * node);
   void rotate_left(Node * parent);
   void rotate_right(Node * parent);
 
   Node * get_uncle(Node * node) const;
 
+  template<class Stream>
+  static void write_shape_word(Stream & stream, uint64_t word);
+  template<class Stream>
+  static bool read_shape_word(Stream & stream, uint64_t & word);
+  // Checks that the restored links form a tree of exactly <count> distinct nodes
+  bool shape_is_tree(uint64_t count) const;
+
+  size_t get_height(Node * node) const;
+  Node * defragment_veb(Node * node, size_t height, Node *& arena);
+  void defragment_veb_bottom(Node * node, size_t depth, size_t height, Node *& arena);
+
+  /*
+   * Dispatch methods for the key prefix cache (see TreeFlags::KEY_PREFIX_CACHE). Without the
+   * cache, all prefixes are 0 and every comparison goes to the Compare class.
+   */
+  template<bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<enable, uint64_t>::type stored_key_prefix(const Node & node) {
+	  return node.NB::_rbt_key_prefix;
+  }
+  template<bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<!enable, uint64_t>::type stored_key_prefix(const Node & node) {
+	  (void)node;
+	  return 0;
+  }
+
+  template<bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<enable, void>::type set_key_prefix(Node & node, uint64_t prefix) {
+	  node.NB::_rbt_key_prefix = prefix;
+  }
+  template<bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<!enable, void>::type set_key_prefix(Node & node, uint64_t prefix) {
+	  (void)node;
+	  (void)prefix;
+  }
+
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<enable, uint64_t>::type
+  get_query_prefix(const Comparable & query) {
+	  return NodeTraits::get_key_prefix(query);
+  }
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  static typename std::enable_if<!enable, uint64_t>::type
+  get_query_prefix(const Comparable & query) {
+	  (void)query;
+	  return 0;
+  }
+
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  typename std::enable_if<enable, bool>::type
+  node_less_query(const Node & node, const Comparable & query, uint64_t query_prefix) const {
+	  if (node.NB::_rbt_key_prefix != query_prefix) {
+		  return node.NB::_rbt_key_prefix < query_prefix;
+	  }
+	  this->stats.count_comparison();
+	  return utilities::compare_less(this->cmp, node, query);
+  }
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  typename std::enable_if<!enable, bool>::type
+  node_less_query(const Node & node, const Comparable & query, uint64_t query_prefix) const {
+	  (void)query_prefix;
+	  this->stats.count_comparison();
+	  return utilities::compare_less(this->cmp, node, query);
+  }
+
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  typename std::enable_if<enable, bool>::type
+  query_less_node(const Comparable & query, uint64_t query_prefix, const Node & node) const {
+	  if (node.NB::_rbt_key_prefix != query_prefix) {
+		  return query_prefix < node.NB::_rbt_key_prefix;
+	  }
+	  this->stats.count_comparison();
+	  return utilities::compare_greater(this->cmp, node, query);
+  }
+  template<class Comparable, bool enable = Options::key_prefix_cache>
+  typename std::enable_if<!enable, bool>::type
+  query_less_node(const Comparable & query, uint64_t query_prefix, const Node & node) const {
+	  (void)query_prefix;
+	  this->stats.count_comparison();
+	  return utilities::compare_greater(this->cmp, node, query);
+  }
+
+  /*
+   * Three-way comparison of node and query: <0 if node is smaller, 0 if both are equal, >0 if
+   * node is larger. Only used with three-way comparators, see utilities::is_three_way_compare.
+   */
+  template<class Comparable>
+  int node_cmp_query(const Node & node, const Comparable & query, uint64_t query_prefix) const {
+	  uint64_t node_prefix = stored_key_prefix(node);
+	  if (node_prefix != query_prefix) {
+		  return (node_prefix < query_prefix) ? -1 : 1;
+	  }
+	  this->stats.count_comparison();
+	  return utilities::compare_three_way(this->cmp, node, query);
+  }
+
+  template<class Comparable>
+  static constexpr bool uses_three_way_compare() {
+	  return utilities::is_three_way_compare<Compare, Node, Comparable>();
+  }
+
+  /*
+   * Dispatch methods for the order labels (see TreeFlags::ORDER_QUERIES)
+   */
+  template<bool enable = Options::order_queries>
+  typename std::enable_if<enable, void>::type update_order_label(Node & node) {
+	  this->assign_order_label(node);
+  }
+  template<bool enable = Options::order_queries>
+  typename std::enable_if<!enable, void>::type update_order_label(Node & node) {
+	  (void)node;
+  }
+
+  template<bool enable = Options::order_queries>
+  typename std::enable_if<enable, void>::type update_all_order_labels() {
+	  this->assign_all_order_labels();
+  }
+  template<bool enable = Options::order_queries>
+  typename std::enable_if<!enable, void>::type update_all_order_labels() {}
+
+  template<bool enable = Options::order_queries>
+  static typename std::enable_if<enable, void>::type copy_order_label(const Node & from,
+                                                                     Node & to) {
+	  to.NB::_rbt_order_label = from.NB::_rbt_order_label;
+  }
+  template<bool enable = Options::order_queries>
+  static typename std::enable_if<!enable, void>::type copy_order_label(const Node & from,
+                                                                      Node & to) {
+	  (void)from;
+	  (void)to;
+  }
+
+  /*
+   * Dispatch methods for the removal marks (see TreeFlags::DEFERRED_REMOVAL). Without that
+   * option, no node is ever marked.
+   */
+  template<bool enable = Options::deferred_removal>
+  static typename std::enable_if<enable, bool>::type is_marked(const Node & node) {
+	  return node.NB::_rbt_marked;
+  }
+  template<bool enable = Options::deferred_removal>
+  static typename std::enable_if<!enable, bool>::type is_marked(const Node & node) {
+	  (void)node;
+	  return false;
+  }
+  template<bool enable = Options::deferred_removal>
+  static typename std::enable_if<enable, void>::type set_marked(Node & node, bool marked) {
+	  node.NB::_rbt_marked = marked;
+  }
+  template<bool enable = Options::deferred_removal>
+  static typename std::enable_if<!enable, void>::type set_marked(Node & node, bool marked) {
+	  (void)node;
+	  (void)marked;
+  }
+
+  /*
+   * Dispatch methods for the equality buckets (see TreeFlags::EQUALITY_BUCKETS). Every bucket is
+   * a circular list that starts at its representative, i.e., the tree node. All other elements of
+   * the bucket are marked by a left child pointing to themselves. Without buckets, these methods
+   * are never called.
+   */
+  template<bool enable = Options::equality_buckets>
+  static typename std::enable_if<enable, Node *&>::type bucket_next(const Node * node) {
+	  return const_cast<Node *>(node)->NB::_rbt_bucket_next;
+  }
+  template<bool enable = Options::equality_buckets>
+  static typename std::enable_if<!enable, Node *&>::type bucket_next(const Node * node) {
+	  (void)node;
+	  static Node * dummy = nullptr;
+	  return dummy;
+  }
+
+  template<bool enable = Options::equality_buckets>
+  static typename std::enable_if<enable, Node *&>::type bucket_prev(const Node * node) {
+	  return const_cast<Node *>(node)->NB::_rbt_bucket_prev;
+  }
+  template<bool enable = Options::equality_buckets>
+  static typename std::enable_if<!enable, Node *&>::type bucket_prev(const Node * node) {
+	  (void)node;
+	  static Node * dummy = nullptr;
+	  return dummy;
+  }
+
+  static bool is_bucket_member(const Node * node) {
+	  return node->NB::_rbt_left == node;
+  }
+
+  // Makes <to> the representative in place of <from>
+  template<bool enable = Options::equality_buckets>
+  typename std::enable_if<enable, void>::type bucket_take_over(Node & from, Node & to) {
+	  this->relocate_links(from, to);
+	  NodeTraits::relocated(from, to);
+  }
+  template<bool enable = Options::equality_buckets>
+  typename std::enable_if<!enable, void>::type bucket_take_over(Node & from, Node & to) {
+	  (void)from;
+	  (void)to;
+  }
+
+  static void mark_bucket_member(Node & node) {
+	  node.NB::_rbt_parent = nullptr;
+	  node.NB::_rbt_left = &node;
+	  node.NB::_rbt_right = nullptr;
+  }
+
+  /*
+   * Returns the number of elements, counting them if the size is not kept
+   */
+  template<bool enable = Options::constant_time_size>
+  typename std::enable_if<enable, size_t>::type element_count() const {
+	  return this->s.get();
+  }
+  template<bool enable = Options::constant_time_size>
+  typename std::enable_if<!enable, size_t>::type element_count() const {
+	  size_t count = 0;
+	  for (auto it = this->cbegin() ; it != this->cend() ; ++it) {
+		  count++;
+	  }
+	  return count;
+  }
+
+  /*
+   * Dispatch methods for the find() cache (see TreeFlags::FIND_CACHE). A cached node is only
+   * returned if it still compares equally to the query, so hash collisions are harmless.
+   */
+  template<class Comparable, size_t slots = Options::find_cache_slots>
+  typename std::enable_if<(slots > 0), Node *>::type find_cached(const Comparable & query) {
+	  size_t hash = NodeTraits::get_key_hash(query);
+	  Node * node = this->find_cache.get(hash);
+	  if ((node != nullptr) &&
+	      (this->node_cmp_query(*node, query, this->get_query_prefix(query)) == 0)) {
+		  this->find_cache.count_hit();
+		  return node;
+	  }
+
+	  this->find_cache.count_miss();
+	  node = this->find_in_tree(query);
+	  if (node != nullptr) {
+		  this->find_cache.put(hash, node);
+	  }
+	  return node;
+  }
+  template<class Comparable, size_t slots = Options::find_cache_slots>
+  typename std::enable_if<(slots == 0), Node *>::type find_cached(const Comparable & query) {
+	  return this->find_in_tree(query);
+  }
+
   void swap_nodes(Node * n1, Node * n2, bool swap_colors = true);
   void swap_unrelated_nodes(Node * n1, Node * n2);
   void swap_neighbors(Node * parent, Node * child);
@@ -456,9 +1258,14 @@ protected:
   bool verify_red_black(const Node * node) const;
   bool verify_tree() const;
   bool verify_order() const;
+  bool verify_buckets() const;
 
 	Compare cmp;
 
+	// Keep the holders that are empty by default next to cmp, so they share its padding
+	utilities::RBTreeRemovalCounter<Options::deferred_removal> pending_removals;
+	mutable utilities::StatisticsHolder<Options::statistics> stats;
+	utilities::FindCacheHolder<Node, Options::find_cache_slots> find_cache;
 	SizeHolder<Options::constant_time_size> s;
 };
 
@@ -5,6 +5,8 @@
 #ifndef YGG_SIZE_HOLDER_HPP
 #define YGG_SIZE_HOLDER_HPP
 
+#include <cstddef>
+
 template<bool enable>
 class SizeHolder {};
 
@@ -0,0 +1,102 @@
+#ifndef YGG_STATISTICS_HOLDER_HPP
+#define YGG_STATISTICS_HOLDER_HPP
+
+#include <cstddef>
+
+namespace ygg {
+
+/**
+ * @brief Operation counters of an RBTree
+ *
+ * A snapshot of the counters an RBTree keeps if the TreeFlags::STATISTICS option is set. See
+ * RBTree::get_statistics() and RBTree::reset_statistics().
+ */
+class TreeStatistics {
+public:
+	/// Number of calls to the Compare class
+	size_t comparisons = 0;
+	/// Number of descents from the root (insertions and searches)
+	size_t descents = 0;
+	/// Total number of levels descended over all descents
+	size_t descent_depth = 0;
+	/// Number of left and right rotations
+	size_t rotations = 0;
+	/// Number of node swaps (performed when removing inner nodes)
+	size_t swaps = 0;
+	/// Number of iterations of the rebalancing loop after insertions
+	size_t insert_fixup_iterations = 0;
+	/// Number of iterations of the rebalancing loop after deletions
+	size_t delete_fixup_iterations = 0;
+};
+
+namespace utilities {
+
+/// @cond INTERNAL
+template<bool enable>
+class StatisticsHolder {};
+
+template<>
+class StatisticsHolder<true> {
+public:
+	void count_comparison(size_t i = 1) {
+		this->stats.comparisons += i;
+	}
+
+	void count_descent() {
+		this->stats.descents++;
+	}
+
+	void count_descent_step() {
+		this->stats.descent_depth++;
+	}
+
+	void count_rotation() {
+		this->stats.rotations++;
+	}
+
+	void count_swap() {
+		this->stats.swaps++;
+	}
+
+	void count_insert_fixup() {
+		this->stats.insert_fixup_iterations++;
+	}
+
+	void count_delete_fixup() {
+		this->stats.delete_fixup_iterations++;
+	}
+
+	TreeStatistics get() const {
+		return this->stats;
+	}
+
+	TreeStatistics reset() {
+		TreeStatistics old = this->stats;
+		this->stats = TreeStatistics();
+		return old;
+	}
+
+private:
+	TreeStatistics stats;
+};
+
+template<>
+class StatisticsHolder<false> {
+public:
+	void count_comparison(size_t i = 1) {
+		(void)i;
+	}
+
+	void count_descent() {}
+	void count_descent_step() {}
+	void count_rotation() {}
+	void count_swap() {}
+	void count_insert_fixup() {}
+	void count_delete_fixup() {}
+};
+/// @endcond
+
+} // namespace utilities
+} // namespace ygg
+
+#endif //YGG_STATISTICS_HOLDER_HPP
@@ -4,7 +4,10 @@
 
 #ifndef YGG_UTIL_HPP
 
+#include <cstddef>
+#include <cstdint>
 #include <type_traits>
+#include <utility>
 
 namespace ygg {
 namespace utilities {
@@ -27,6 +30,109 @@ public:
 template<class ... Ts>
 void throw_away(Ts ...) {}
 
+/*
+ * Asks the CPU to load the cache line containing <addr>. Does nothing on compilers without a
+ * prefetch builtin.
+ */
+inline void prefetch(const void * addr) {
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(addr);
+#else
+	(void)addr;
+#endif
+}
+
+/*
+ * Support for three-way comparators. A Compare class is a three-way comparator for T1 and T2 if
+ * Compare(T1, T2) returns anything but bool. The result r must then be comparable to 0: r < 0 means
+ * "smaller", r == 0 means "equal" and r > 0 means "larger". This is the case for int as well as
+ * for the orderings returned by C++20's operator<=>.
+ */
+template<class Compare, class T1, class T2>
+using compare_result_t = decltype(std::declval<const Compare &>()(std::declval<const T1 &>(),
+                                                                  std::declval<const T2 &>()));
+
+template<class Compare, class T1, class T2>
+constexpr bool is_three_way_compare() {
+	return !std::is_same<typename std::decay<compare_result_t<Compare, T1, T2>>::type, bool>::value;
+}
+
+/*
+ * Returns whether lhs < rhs, for both kinds of comparators.
+ */
+template<class Compare, class T1, class T2>
+typename std::enable_if<!is_three_way_compare<Compare, T1, T2>(), bool>::type
+compare_less(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	return cmp(lhs, rhs);
+}
+template<class Compare, class T1, class T2>
+typename std::enable_if<is_three_way_compare<Compare, T1, T2>(), bool>::type
+compare_less(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	return cmp(lhs, rhs) < 0;
+}
+
+/*
+ * Returns whether rhs < lhs, for both kinds of comparators. Three-way comparators are always called
+ * as cmp(lhs, rhs).
+ */
+template<class Compare, class T1, class T2>
+typename std::enable_if<!is_three_way_compare<Compare, T1, T2>(), bool>::type
+compare_greater(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	return cmp(rhs, lhs);
+}
+template<class Compare, class T1, class T2>
+typename std::enable_if<is_three_way_compare<Compare, T1, T2>(), bool>::type
+compare_greater(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	return cmp(lhs, rhs) > 0;
+}
+
+/*
+ * Returns -1, 0 or 1 if lhs is smaller than, equal to or larger than rhs. This calls a three-way
+ * comparator once and a boolean comparator up to twice.
+ */
+template<class Compare, class T1, class T2>
+typename std::enable_if<!is_three_way_compare<Compare, T1, T2>(), int>::type
+compare_three_way(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	if (cmp(lhs, rhs)) {
+		return -1;
+	}
+	return cmp(rhs, lhs) ? 1 : 0;
+}
+template<class Compare, class T1, class T2>
+typename std::enable_if<is_three_way_compare<Compare, T1, T2>(), int>::type
+compare_three_way(const Compare & cmp, const T1 & lhs, const T2 & rhs) {
+	auto result = cmp(lhs, rhs);
+	if (result < 0) {
+		return -1;
+	}
+	return (result == 0) ? 0 : 1;
+}
+
+/**
+ * @brief Creates an order-preserving 64-bit prefix from a byte string
+ *
+ * The first eight bytes of the string are packed in big-endian order, padded with zeroes. For
+ * two strings a and b that are compared lexicographically by unsigned bytes (as std::string does),
+ * make_key_prefix(a) < make_key_prefix(b) implies a < b. Use this to implement
+ * get_key_prefix() for TreeFlags::KEY_PREFIX_CACHE.
+ *
+ * @param data 		The bytes of the string
+ * @param length 	The length of the string
+ * @return The prefix of the string
+ */
+inline uint64_t
+make_key_prefix(const char * data, size_t length)
+{
+	uint64_t prefix = 0;
+	for (size_t i = 0 ; i < 8 ; ++i) {
+		prefix <<= 8;
+		if (i < length) {
+			prefix |= static_cast<unsigned char>(data[i]);
+		}
+	}
+	return prefix;
+}
+
 /*
  * This is inspired by
  *
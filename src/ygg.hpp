@@ -1,6 +1,8 @@
 #include "options.hpp"
 #include "list.hpp"
 #include "rbtree.hpp"
+#include "multi_index.hpp"
+#include "const_table.hpp"
 #include "intervaltree.hpp"
 #include "intervalmap.hpp"
 #include "dynamic_segment_tree.hpp"
\ No newline at end of file
@@ -6,6 +6,12 @@
 #include "test_intervalmap.hpp"
 #include "test_list.hpp"
 #include "test_dynamic_segment_tree.hpp"
+#include "test_flat_combining.hpp"
+#include "test_profiling.hpp"
+#include "test_node_pool.hpp"
+#include "test_const_table.hpp"
+#include "test_multi_index.hpp"
+#include "test_allocation.hpp"
 
 //#include "test_orderlist.hpp"
 
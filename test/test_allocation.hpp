@@ -0,0 +1,269 @@
+#ifndef TEST_ALLOCATION_HPP
+#define TEST_ALLOCATION_HPP
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "../src/rbtree.hpp"
+#include "../src/intervaltree.hpp"
+#include "../src/list.hpp"
+
+/*
+ * Counts every allocation of the test binary, so that we can make sure that none of the
+ * containers ever allocate.
+ */
+namespace alloctest {
+std::atomic<size_t> allocations(0);
+} // namespace alloctest
+
+void *
+operator new(std::size_t size)
+{
+	alloctest::allocations++;
+	void * mem = std::malloc(size > 0 ? size : 1);
+	if (mem == nullptr) {
+		throw std::bad_alloc();
+	}
+	return mem;
+}
+
+void
+operator delete(void * mem) noexcept
+{
+	std::free(mem);
+}
+
+void
+operator delete(void * mem, std::size_t size) noexcept
+{
+	(void)size;
+	std::free(mem);
+}
+
+using namespace ygg;
+
+namespace alloctest {
+
+#define ALLOC_TESTSIZE 2000
+
+using RemovalOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                   TreeFlags::DEFERRED_REMOVAL>;
+using BucketOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                  TreeFlags::ORDER_QUERIES, TreeFlags::EQUALITY_BUCKETS,
+                                  TreeFlags::DEFERRED_REMOVAL>;
+
+template<class Options>
+class Node : public RBTreeNodeBase<Node<Options>, Options> {
+public:
+	int data;
+
+	Node() : data(0) {};
+	explicit Node(int data_in) : data(data_in) {};
+
+	bool operator<(const Node & other) const {
+		return this->data < other.data;
+	}
+};
+
+template<class Options>
+bool operator<(const Node<Options> & lhs, int rhs) {
+	return lhs.data < rhs;
+}
+
+template<class Options>
+bool operator<(int lhs, const Node<Options> & rhs) {
+	return lhs < rhs.data;
+}
+
+template<class Node>
+class ITTraits : public ITreeNodeTraits<Node> {
+public:
+	using key_type = int;
+
+	static int get_lower(const Node & node) {
+		return node.lower;
+	}
+
+	static int get_upper(const Node & node) {
+		return node.upper;
+	}
+};
+
+class ITNode : public ITreeNodeBase<ITNode, ITTraits<ITNode>> {
+public:
+	int lower;
+	int upper;
+
+	ITNode() : lower(0), upper(0) {};
+	ITNode(int lower_in, int upper_in) : lower(lower_in), upper(upper_in) {};
+};
+
+class LNode : public ListNodeBase<LNode> {
+public:
+	int data;
+};
+
+template<class Options>
+void
+exercise_rbtree()
+{
+	using Tree = RBTree<Node<Options>, RBDefaultNodeTraits<Node<Options>>, Options>;
+
+	std::mt19937 rng(4);
+	std::uniform_int_distribution<int> distr(0, ALLOC_TESTSIZE / 4);
+
+	// Everything the test needs is allocated up front
+	std::vector<Node<Options>> nodes(ALLOC_TESTSIZE);
+	std::vector<Node<Options>> other_nodes(ALLOC_TESTSIZE);
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; ++i) {
+		nodes[i] = Node<Options>(distr(rng));
+		other_nodes[i] = Node<Options>(distr(rng));
+	}
+	Tree t;
+	Tree other;
+
+	size_t before = allocations.load();
+
+	for (auto & n : nodes) {
+		t.insert(n);
+	}
+	for (auto & n : other_nodes) {
+		other.insert(n);
+	}
+
+	long sum = 0;
+	for (int q = 0 ; q < ALLOC_TESTSIZE / 4 ; ++q) {
+		auto it = t.find(q);
+		if (it != t.end()) {
+			sum += it->data;
+		}
+		sum += t.lower_bound(q)->data;
+		if (t.upper_bound(q) != t.end()) {
+			sum += t.upper_bound(q)->data;
+		}
+	}
+	for (const auto & n : t) {
+		sum += n.data;
+	}
+	for (auto it = t.rbegin() ; it != t.rend() ; ++it) {
+		sum -= it->data;
+	}
+	for (auto it = t.scan_begin() ; it != t.scan_end() ; ++it) {
+		sum += it->data;
+	}
+
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; i += 7) {
+		nodes[i].data = distr(rng);
+		t.reposition(nodes[i]);
+	}
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; i += 5) {
+		t.mark_for_removal(nodes[i]);
+	}
+	t.flush_removals();
+	for (size_t i = 1 ; i < ALLOC_TESTSIZE ; i += 5) {
+		t.remove(nodes[i]);
+	}
+
+	t.merge(other);
+	t.optimize();
+	bool valid = t.verify_integrity() && other.verify_integrity();
+
+	t.clear();
+	other.clear();
+
+	size_t after = allocations.load();
+
+	ASSERT_TRUE(valid);
+	ASSERT_EQ(before, after);
+	(void)sum;
+}
+
+TEST(AllocationTest, CounterTest) {
+	size_t before = allocations.load();
+	int * i = new int(42);
+	ASSERT_EQ(allocations.load(), before + 1);
+	delete i;
+}
+
+TEST(AllocationTest, RBTreeTest) {
+	exercise_rbtree<RemovalOptions>();
+	exercise_rbtree<BucketOptions>();
+}
+
+TEST(AllocationTest, IntervalTreeTest) {
+	using Tree = IntervalTree<ITNode, ITTraits<ITNode>>;
+
+	std::mt19937 rng(4);
+	std::uniform_int_distribution<int> distr(0, 10 * ALLOC_TESTSIZE);
+
+	std::vector<ITNode> nodes(ALLOC_TESTSIZE);
+	for (auto & n : nodes) {
+		int lower = distr(rng);
+		n = ITNode(lower, lower + distr(rng) / 100);
+	}
+	Tree t;
+
+	size_t before = allocations.load();
+
+	for (auto & n : nodes) {
+		t.insert(n);
+	}
+
+	size_t hits = 0;
+	for (int q = 0 ; q < 10 * ALLOC_TESTSIZE ; q += 100) {
+		ITNode query(q, q + 10);
+		for (const auto & n : t.query(query)) {
+			(void)n;
+			hits++;
+		}
+	}
+
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; i += 3) {
+		t.remove(nodes[i]);
+	}
+	bool valid = t.verify_integrity();
+	t.clear();
+
+	size_t after = allocations.load();
+
+	ASSERT_TRUE(valid);
+	ASSERT_GT(hits, 0);
+	ASSERT_EQ(before, after);
+}
+
+TEST(AllocationTest, ListTest) {
+	std::vector<LNode> nodes(ALLOC_TESTSIZE);
+	List<LNode> l;
+
+	size_t before = allocations.load();
+
+	for (auto & n : nodes) {
+		l.insert(nullptr, &n);
+	}
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; i += 2) {
+		l.remove(&nodes[i]);
+	}
+	for (size_t i = 0 ; i < ALLOC_TESTSIZE ; i += 2) {
+		l.insert(&nodes[i + 1], &nodes[i]);
+	}
+
+	size_t count = 0;
+	for (auto & n : l) {
+		(void)n;
+		count++;
+	}
+	l.clear();
+
+	size_t after = allocations.load();
+
+	ASSERT_EQ(count, ALLOC_TESTSIZE);
+	ASSERT_EQ(before, after);
+}
+
+} // namespace alloctest
+
+#endif // TEST_ALLOCATION_HPP
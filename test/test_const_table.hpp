@@ -0,0 +1,140 @@
+#ifndef TEST_CONST_TABLE_HPP
+#define TEST_CONST_TABLE_HPP
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../src/const_table.hpp"
+
+using namespace ygg;
+
+namespace consttabletest {
+
+constexpr ConstTableEntry<int, const char *> codes[] = {
+	{404, "Not Found"}, {200, "OK"}, {500, "Internal Server Error"}, {301, "Moved Permanently"},
+	{204, "No Content"}, {403, "Forbidden"}, {302, "Found"}, {201, "Created"}, {400, "Bad Request"},
+	{503, "Service Unavailable"}};
+
+constexpr auto code_table = make_const_table(codes);
+
+// Everything must work at compile time
+static_assert(code_table.size() == 10, "");
+static_assert(code_table.find(403)->value[0] == 'F', "");
+static_assert(code_table.find(402) == code_table.end(), "");
+static_assert(code_table.lower_bound(402)->key == 403, "");
+static_assert(code_table.upper_bound(403)->key == 404, "");
+static_assert(code_table.upper_bound(503) == code_table.end(), "");
+static_assert(code_table.begin()->key == 200, "");
+
+constexpr int
+count_entries()
+{
+	int count = 0;
+	for (auto it = code_table.begin() ; it != code_table.end() ; ++it) {
+		count++;
+	}
+	return count;
+}
+static_assert(count_entries() == 10, "");
+
+class Reversed {
+public:
+	constexpr bool operator()(int lhs, int rhs) const {
+		return lhs > rhs;
+	}
+};
+
+TEST(ConstTableTest, CompileTimeTest) {
+	std::vector<int> keys;
+	for (const auto & e : code_table) {
+		keys.push_back(e.key);
+	}
+	ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+	ASSERT_EQ(keys.size(), 10u);
+
+	auto it = code_table.end();
+	for (size_t i = keys.size() ; i > 0 ; --i) {
+		--it;
+		ASSERT_EQ(it->key, keys[i - 1]);
+	}
+	ASSERT_EQ(it, code_table.begin());
+
+	constexpr ConstTableEntry<int, int> entries[] = {{1, 1}, {3, 3}, {2, 2}};
+	constexpr ConstTable<int, int, 3, Reversed> reversed(entries);
+	static_assert(reversed.begin()->key == 3, "");
+	static_assert(reversed.lower_bound(2)->key == 2, "");
+}
+
+template<size_t N>
+void
+check_table_size(std::mt19937 & rng)
+{
+	ConstTableEntry<int, int> entries[N];
+	std::uniform_int_distribution<int> key_dist(0, 2 * static_cast<int>(N));
+	std::vector<int> keys;
+	for (size_t i = 0 ; i < N ; ++i) {
+		entries[i].key = key_dist(rng);
+		entries[i].value = static_cast<int>(i);
+		keys.push_back(entries[i].key);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	ConstTable<int, int, N> table(entries);
+
+	size_t i = 0;
+	for (const auto & e : table) {
+		ASSERT_EQ(e.key, keys[i]);
+		ASSERT_EQ(entries[e.value].key, e.key);
+		i++;
+	}
+	ASSERT_EQ(i, N);
+
+	for (int query = -1 ; query <= 2 * static_cast<int>(N) + 1 ; ++query) {
+		auto lb = std::lower_bound(keys.begin(), keys.end(), query);
+		auto ub = std::upper_bound(keys.begin(), keys.end(), query);
+
+		auto table_lb = table.lower_bound(query);
+		auto table_ub = table.upper_bound(query);
+		auto table_find = table.find(query);
+
+		if (lb == keys.end()) {
+			ASSERT_EQ(table_lb, table.end());
+		} else {
+			ASSERT_EQ(table_lb->key, *lb);
+			// Must be the first of several equal entries
+			if (table_lb != table.begin()) {
+				auto before = table_lb;
+				--before;
+				ASSERT_LT(before->key, query);
+			}
+		}
+		if (ub == keys.end()) {
+			ASSERT_EQ(table_ub, table.end());
+		} else {
+			ASSERT_EQ(table_ub->key, *ub);
+		}
+		if ((lb != keys.end()) && (*lb == query)) {
+			ASSERT_EQ(table_find, table_lb);
+		} else {
+			ASSERT_EQ(table_find, table.end());
+		}
+	}
+}
+
+TEST(ConstTableTest, RandomTest) {
+	std::mt19937 rng(4);
+	for (int round = 0 ; round < 10 ; ++round) {
+		check_table_size<1>(rng);
+		check_table_size<2>(rng);
+		check_table_size<7>(rng);
+		check_table_size<8>(rng);
+		check_table_size<100>(rng);
+		check_table_size<1000>(rng);
+	}
+}
+
+} // namespace consttabletest
+
+#endif // TEST_CONST_TABLE_HPP
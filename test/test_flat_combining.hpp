@@ -0,0 +1,156 @@
+#ifndef TEST_FLAT_COMBINING_HPP
+#define TEST_FLAT_COMBINING_HPP
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "../src/flat_combining.hpp"
+
+using namespace ygg;
+
+#define FC_THREADS 4
+#define FC_TESTSIZE 2000
+
+namespace fctest {
+
+class Node : public RBTreeNodeBase<Node, TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>> {
+public:
+	int data;
+
+	Node() : data(0) {};
+	explicit Node(int data_in) : data(data_in) {};
+
+	bool operator<(const Node & other) const {
+		return this->data < other.data;
+	}
+};
+
+using Tree = FlatCombiningRBTree<Node, RBDefaultNodeTraits<Node>,
+                                 TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>>;
+
+TEST(FlatCombiningTest, ConcurrentInsertionTest) {
+	Tree fc;
+	std::vector<Node> nodes(FC_THREADS * FC_TESTSIZE);
+	for (unsigned int i = 0 ; i < nodes.size() ; ++i) {
+		nodes[i] = Node(static_cast<int>(i));
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<unsigned int> rejected(FC_THREADS, 0);
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		threads.emplace_back([&, t]() {
+			size_t slot = fc.register_thread();
+			// interleave the values of all threads
+			for (unsigned int i = 0 ; i < FC_TESTSIZE ; ++i) {
+				if (!fc.insert(slot, nodes[i * FC_THREADS + t])) {
+					rejected[t]++;
+				}
+			}
+		});
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		ASSERT_EQ(rejected[t], 0);
+	}
+
+	ASSERT_TRUE(fc.get_tree().verify_integrity());
+	ASSERT_EQ(fc.get_tree().size(), FC_THREADS * FC_TESTSIZE);
+
+	int i = 0;
+	for (const auto & n : fc.get_tree()) {
+		ASSERT_EQ(n.data, i);
+		i++;
+	}
+}
+
+TEST(FlatCombiningTest, DuplicateRejectionTest) {
+	Tree fc;
+	std::vector<Node> nodes(FC_THREADS * FC_TESTSIZE);
+
+	// every thread inserts the same values
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		for (unsigned int i = 0 ; i < FC_TESTSIZE ; ++i) {
+			nodes[t * FC_TESTSIZE + i] = Node(static_cast<int>(i));
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<unsigned int> inserted(FC_THREADS, 0);
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		threads.emplace_back([&, t]() {
+			size_t slot = fc.register_thread();
+			for (unsigned int i = 0 ; i < FC_TESTSIZE ; ++i) {
+				if (fc.insert(slot, nodes[t * FC_TESTSIZE + i])) {
+					inserted[t]++;
+				}
+			}
+		});
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+
+	unsigned int total = 0;
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		total += inserted[t];
+	}
+
+	ASSERT_EQ(total, FC_TESTSIZE);
+	ASSERT_EQ(fc.get_tree().size(), FC_TESTSIZE);
+	ASSERT_TRUE(fc.get_tree().verify_integrity());
+}
+
+TEST(FlatCombiningTest, ConcurrentInsertionRemovalTest) {
+	Tree fc;
+	std::vector<Node> nodes(FC_THREADS * FC_TESTSIZE);
+	for (unsigned int i = 0 ; i < nodes.size() ; ++i) {
+		nodes[i] = Node(static_cast<int>(i));
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 0 ; t < FC_THREADS ; ++t) {
+		threads.emplace_back([&, t]() {
+			size_t slot = fc.register_thread();
+			for (unsigned int i = 0 ; i < FC_TESTSIZE ; ++i) {
+				fc.insert(slot, nodes[t * FC_TESTSIZE + i]);
+			}
+			// remove every other node again
+			for (unsigned int i = 0 ; i < FC_TESTSIZE ; i += 2) {
+				fc.remove(slot, nodes[t * FC_TESTSIZE + i]);
+			}
+		});
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+
+	ASSERT_TRUE(fc.get_tree().verify_integrity());
+	ASSERT_EQ(fc.get_tree().size(), FC_THREADS * FC_TESTSIZE / 2);
+
+	for (const auto & n : fc.get_tree()) {
+		ASSERT_EQ(n.data % 2, 1);
+	}
+}
+
+TEST(FlatCombiningTest, RegistrationOverflowTest) {
+	FlatCombiningRBTree<Node, RBDefaultNodeTraits<Node>, TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>,
+	                    int, utilities::flexible_less, 2> fc;
+
+	ASSERT_EQ(fc.register_thread(), 0u);
+	ASSERT_EQ(fc.register_thread(), 1u);
+	ASSERT_THROW(fc.register_thread(), std::length_error);
+
+	// The registered slots keep working
+	Node n(1);
+	ASSERT_TRUE(fc.insert(1, n));
+	ASSERT_TRUE(fc.get_tree().verify_integrity());
+}
+
+} // namespace fctest
+
+#endif // TEST_FLAT_COMBINING_HPP
@@ -2,6 +2,7 @@
 #define TEST_INTERVALTREE_HPP
 
 #include "../src/intervaltree.hpp"
+#include "../src/debug_dot.hpp"
 
 using namespace ygg;
 
@@ -35,6 +36,7 @@ public:
   ITNode () : data(0), lower(0), upper(0) {};
   explicit ITNode(unsigned int lower_in, unsigned int upper_in, int data_in) : data(data_in), lower(lower_in), upper(upper_in) {};
   ITNode(const ITNode &other) : data(other.data), lower(other.lower), upper(other.upper) {};
+  ITNode & operator=(const ITNode &other) = default;
 };
 
 TEST(ITreeTest, TrivialInsertionTest) {
@@ -48,6 +50,13 @@ TEST(ITreeTest, TrivialInsertionTest) {
   ASSERT_TRUE(tree.verify_integrity());
 }
 
+TEST(ITreeTest, ObjectSizeTest) {
+  // Without OVERLAP_COUNTING and ENDPOINT_CACHE, an IntervalTree is exactly as large as an RBTree
+  using Tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>;
+  ASSERT_EQ(sizeof(Tree), sizeof(Tree::BaseTree));
+  ASSERT_EQ(sizeof(Tree), sizeof(ITNode *) + 2 * sizeof(size_t));
+}
+
 TEST(ITreeTest, RandomInsertionTest) {
   auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
 
@@ -63,12 +72,12 @@ TEST(ITreeTest, RandomInsertionTest) {
     nodes[i] = ITNode(lower, upper, i);
 
     std::string fname = std::string("/tmp/trees/before-") + std::to_string(i) + std::string(".dot");
-    tree.dump_to_dot(fname);
+    debug::dump_to_dot(tree, fname);
 
     tree.insert(nodes[i]);
 
     fname = std::string("/tmp/trees/after-") + std::to_string(i) + std::string(".dot");
-    tree.dump_to_dot(fname);
+    debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
 
@@ -104,12 +113,12 @@ TEST(ITreeTest, RandomInsertionRandomDeletionTest) {
 
   for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
     std::string fname = std::string("/tmp/trees/before-") + std::to_string(i) + std::string(".dot");
-    tree.dump_to_dot(fname);
+    debug::dump_to_dot(tree, fname);
 
     tree.remove(nodes[indices[i]]);
 
     fname = std::string("/tmp/trees/after-") + std::to_string(i) + std::string(".dot");
-    tree.dump_to_dot(fname);
+    debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
   }
@@ -300,7 +309,7 @@ TEST(ITreeTest, ComprehensiveTest) {
   ASSERT_TRUE(tree.verify_integrity());
 
 //std::string fname = std::string("/tmp/trees/comprehensive.dot");
-  //tree.dump_to_dot(fname);
+  //debug::dump_to_dot(tree, fname);
 
   // Query prefixes
   for (int i = 0 ; i < IT_TESTSIZE ; ++i) {
@@ -351,14 +360,643 @@ TEST(ITreeTest, RandomEqualInsertionRandomDeletionTest) {
 
   for (unsigned int i = 0 ; i < 5*IT_TESTSIZE ; ++i) {
     //std::string fname = std::string("/tmp/trees/before-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     tree.remove(nodes[indices[i]]);
 
     //fname = std::string("/tmp/trees/after-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
+
+    ASSERT_TRUE(tree.verify_integrity());
+  }
+}
+TEST(ITreeTest, RelocationTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  ITNode nodes[IT_TESTSIZE];
+  ITNode moved[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    unsigned int upper = lower + bounds_distr(rng);
+    nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    tree.insert(nodes[i]);
+  }
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    // A fresh node does not carry the tree's data, relocate() must transfer it
+    moved[i] = ITNode(nodes[i].lower, nodes[i].upper, nodes[i].data);
+    tree.relocate(nodes[i], moved[i]);
+  }
+
+  ASSERT_TRUE(tree.verify_integrity());
+  for (auto & n : tree) {
+    ASSERT_GE(&n, &moved[0]);
+    ASSERT_LT(&n, &moved[0] + IT_TESTSIZE);
+  }
+}
+
+TEST(ITreeTest, InPlaceRepositionTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  // Changing only the upper bound keeps the node in place, but changes the maxima
+  ITNode a(0, 1, 0);
+  ITNode b(10, 11, 1);
+  ITNode c(20, 21, 2);
+  tree.insert(a);
+  tree.insert(b);
+  tree.insert(c);
+
+  a.upper = 100;
+  ASSERT_TRUE(tree.reposition(a));
+  ASSERT_TRUE(tree.verify_integrity());
+  ITNode q(50, 60, -1);
+  size_t hits = 0;
+  for (const auto & n : tree.query(q)) {
+    ASSERT_EQ(&n, &a);
+    hits++;
+  }
+  ASSERT_EQ(hits, 1u);
+
+  a.upper = 1;
+  ASSERT_TRUE(tree.reposition(a));
+  ASSERT_TRUE(tree.verify_integrity());
+  auto result = tree.query(q);
+  ASSERT_TRUE(result.begin() == result.end());
+
+  ITNode nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  tree.clear();
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    nodes[i] = ITNode(lower, lower + bounds_distr(rng), static_cast<int>(i));
+    tree.insert(nodes[i]);
+  }
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; i += 3) {
+    nodes[i].upper = nodes[i].lower + bounds_distr(rng);
+    ASSERT_TRUE(tree.reposition(nodes[i]));
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+}
+
+TEST(ITreeTest, ShapeSerializationTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+  auto restored = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  ITNode nodes[IT_TESTSIZE];
+  ITNode restored_nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    unsigned int upper = lower + bounds_distr(rng);
+    nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    restored_nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    tree.insert(nodes[i]);
+  }
+
+  std::stringstream buf;
+  tree.serialize_shape(buf, [](const ITNode & n) { return n.data; });
+  ASSERT_TRUE(restored.deserialize_shape(buf, [&](uint64_t id) { return &restored_nodes[id]; }));
+
+  // The maxima have been recomputed
+  ASSERT_TRUE(restored.verify_integrity());
+  ASSERT_EQ(restored.get_root()->_it_max_upper, tree.get_root()->_it_max_upper);
+}
+
+using RemovalOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                   TreeFlags::DEFERRED_REMOVAL>;
+
+class RemovalITNode : public ITreeNodeBase<RemovalITNode, MyNodeTraits<RemovalITNode>,
+                                           RemovalOptions> {
+public:
+  int data;
+  unsigned int lower;
+  unsigned int upper;
+
+  RemovalITNode () : data(0), lower(0), upper(0) {};
+  explicit RemovalITNode(unsigned int lower_in, unsigned int upper_in, int data_in) : data(data_in), lower(lower_in), upper(upper_in) {};
+};
+
+TEST(ITreeTest, DeferredRemovalTest) {
+  for (double rebuild_fraction : {2.0, 0.0}) {
+    auto tree = IntervalTree<RemovalITNode, MyNodeTraits<RemovalITNode>, RemovalOptions>();
+
+    RemovalITNode nodes[IT_TESTSIZE];
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+    for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+      unsigned int lower = bounds_distr(rng);
+      unsigned int upper = lower + bounds_distr(rng);
+      nodes[i] = RemovalITNode(lower, upper, static_cast<int>(i));
+      tree.insert(nodes[i]);
+    }
+
+    // Remove every node with a large interval, so that the maxima must change
+    for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+      if (nodes[i].upper - nodes[i].lower > 5 * IT_TESTSIZE) {
+        tree.mark_for_removal(nodes[i]);
+      }
+    }
+    tree.flush_removals(rebuild_fraction);
 
     ASSERT_TRUE(tree.verify_integrity());
+    for (auto & n : tree) {
+      ASSERT_LE(n.upper - n.lower, 5 * IT_TESTSIZE);
+    }
+  }
+}
+
+TEST(ITreeTest, OptimizeTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  ITNode nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    unsigned int upper = lower + bounds_distr(rng);
+    nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    tree.insert(nodes[i]);
+  }
+
+  tree.optimize();
+  ASSERT_TRUE(tree.verify_integrity());
+
+  // Long intervals close to the root
+  tree.optimize([](const ITNode & n) { return n.upper - n.lower; });
+  ASSERT_TRUE(tree.verify_integrity());
+}
+
+class TopDownITNode : public ITreeNodeBase<TopDownITNode, MyNodeTraits<TopDownITNode>,
+                                           TreeOptions<TreeFlags::MULTIPLE,
+                                                       TreeFlags::TOP_DOWN>> {
+public:
+  int data;
+  unsigned int lower;
+  unsigned int upper;
+};
+
+TEST(ITreeTest, TopDownInsertionTest) {
+  auto tree = IntervalTree<TopDownITNode, MyNodeTraits<TopDownITNode>,
+                           TreeOptions<TreeFlags::MULTIPLE, TreeFlags::TOP_DOWN>>();
+
+  TopDownITNode nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  // The maxima must survive the rotations done while descending
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    nodes[i].lower = bounds_distr(rng);
+    nodes[i].upper = nodes[i].lower + bounds_distr(rng);
+    nodes[i].data = static_cast<int>(i);
+    tree.insert(nodes[i]);
+    ASSERT_TRUE(tree.verify_integrity());
+  }
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; i += 2) {
+    tree.remove(nodes[i]);
   }
+  ASSERT_TRUE(tree.verify_integrity());
 }
+
+TEST(ITreeTest, MergeTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+  auto other = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  ITNode nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    unsigned int upper = lower + bounds_distr(rng);
+    nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    if (i % 3 == 0) {
+      other.insert(nodes[i]);
+    } else {
+      tree.insert(nodes[i]);
+    }
+  }
+
+  tree.merge(other);
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_TRUE(other.empty());
+  ASSERT_EQ(tree.size(), static_cast<size_t>(IT_TESTSIZE));
+}
+
+TEST(ITreeTest, PointQueryTest) {
+  auto tree = IntervalTree<ITNode, MyNodeTraits<ITNode>>();
+
+  ASSERT_EQ(tree.query_point(0).begin(), tree.query_point(0).end());
+
+  ITNode nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+  std::uniform_int_distribution<unsigned int> length_distr(0, 50);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng);
+    unsigned int upper = lower + length_distr(rng);
+    nodes[i] = ITNode(lower, upper, static_cast<int>(i));
+    tree.insert(nodes[i]);
+  }
+
+  for (unsigned int x = 0 ; x <= 10 * IT_TESTSIZE + 60 ; ++x) {
+    size_t expected = 0;
+    for (const auto & n : nodes) {
+      if ((n.lower <= x) && (n.upper >= x)) {
+        expected++;
+      }
+    }
+
+    // Both forms must report the same intervals as a range query, in the same order
+    std::vector<const ITNode *> range_hits;
+    for (const auto & n : tree.query(ITNode(x, x, 0))) {
+      range_hits.push_back(&n);
+    }
+
+    std::vector<const ITNode *> point_hits;
+    for (const auto & n : tree.query_point(x)) {
+      ASSERT_LE(n.lower, x);
+      ASSERT_GE(n.upper, x);
+      point_hits.push_back(&n);
+    }
+
+    std::vector<const ITNode *> visited;
+    tree.query_point(x, [&](const ITNode & n) { visited.push_back(&n); });
+
+    ASSERT_EQ(point_hits.size(), expected);
+    ASSERT_EQ(point_hits, range_hits);
+    ASSERT_EQ(visited, range_hits);
+  }
+}
+
+using CountingOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                    TreeFlags::OVERLAP_COUNTING, TreeFlags::DEFERRED_REMOVAL>;
+
+class CountingITNode : public ITreeNodeBase<CountingITNode, MyNodeTraits<CountingITNode>,
+                                            CountingOptions> {
+public:
+  int data;
+  unsigned int lower;
+  unsigned int upper;
+
+  CountingITNode () : data(0), lower(0), upper(0) {};
+  explicit CountingITNode(unsigned int lower_in, unsigned int upper_in, int data_in) : data(data_in), lower(lower_in), upper(upper_in) {};
+};
+
+template<class Tree>
+void
+check_overlap_counts(const Tree & tree)
+{
+  ASSERT_TRUE(tree.verify_integrity());
+
+  for (unsigned int lower = 0 ; lower <= 11 * IT_TESTSIZE ; lower += 97) {
+    for (unsigned int length : {0u, 1u, 30u, 1000u}) {
+      CountingITNode q(lower, lower + length, 0);
+
+      size_t expected = 0;
+      for (const auto & n : tree.query(q)) {
+        (void)n;
+        expected++;
+      }
+
+      ASSERT_EQ(tree.count_overlapping(q), expected);
+    }
+  }
+}
+
+TEST(ITreeTest, OverlapCountingTest) {
+  using Tree = IntervalTree<CountingITNode, MyNodeTraits<CountingITNode>, CountingOptions>;
+  auto tree = Tree();
+  auto other = Tree();
+
+  CountingITNode q(0, 100, 0);
+  ASSERT_EQ(tree.count_overlapping(q), 0u);
+
+  CountingITNode nodes[IT_TESTSIZE];
+  CountingITNode moved[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+  std::uniform_int_distribution<unsigned int> length_distr(0, 200);
+
+  // Many equal intervals
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    unsigned int lower = bounds_distr(rng) / 10 * 10;
+    unsigned int upper = lower + length_distr(rng) / 50 * 50;
+    nodes[i] = CountingITNode(lower, upper, static_cast<int>(i));
+    if (i % 4 == 0) {
+      other.insert(nodes[i]);
+    } else {
+      tree.insert(nodes[i]);
+    }
+  }
+  check_overlap_counts(tree);
+
+  tree.merge(other);
+  ASSERT_TRUE(other.empty());
+  check_overlap_counts(tree);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; i += 7) {
+    nodes[i].lower = bounds_distr(rng);
+    nodes[i].upper = nodes[i].lower + length_distr(rng);
+    tree.reposition(nodes[i]);
+  }
+  check_overlap_counts(tree);
+
+  // Only the upper bounds change, so most nodes stay in place
+  for (unsigned int i = 3 ; i < IT_TESTSIZE ; i += 7) {
+    nodes[i].upper = nodes[i].lower + length_distr(rng);
+    tree.reposition(nodes[i]);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  check_overlap_counts(tree);
+
+  for (unsigned int i = 1 ; i < IT_TESTSIZE ; i += 5) {
+    tree.remove(nodes[i]);
+  }
+  for (unsigned int i = 2 ; i < IT_TESTSIZE ; i += 5) {
+    tree.mark_for_removal(nodes[i]);
+  }
+  tree.flush_removals();
+  check_overlap_counts(tree);
+
+  tree.optimize();
+  check_overlap_counts(tree);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    if ((i % 5 != 1) && (i % 5 != 2)) {
+      moved[i] = CountingITNode(nodes[i].lower, nodes[i].upper, nodes[i].data);
+      tree.relocate(nodes[i], moved[i]);
+    }
+  }
+  check_overlap_counts(tree);
+
+  tree.clear();
+  ASSERT_EQ(tree.count_overlapping(q), 0u);
+}
+
+/*
+ * The bounds live in a separate record, and every read of them is counted.
+ */
+class Record {
+public:
+  unsigned int lower;
+  unsigned int upper;
+};
+
+class CachedITNode;
+
+class CachedNodeTraits : public ITreeNodeTraits<CachedITNode> {
+public:
+  using key_type = unsigned int;
+
+  static size_t reads;
+
+  static unsigned int get_lower(const CachedITNode & node);
+  static unsigned int get_upper(const CachedITNode & node);
+};
+
+size_t CachedNodeTraits::reads = 0;
+
+using CachedOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::ENDPOINT_CACHE,
+                                  TreeFlags::DEFERRED_REMOVAL>;
+
+class CachedITNode : public ITreeNodeBase<CachedITNode, CachedNodeTraits, CachedOptions> {
+public:
+  Record * record;
+
+  CachedITNode() : record(nullptr) {};
+  explicit CachedITNode(Record * record_in) : record(record_in) {};
+};
+
+unsigned int CachedNodeTraits::get_lower(const CachedITNode & node) {
+  reads++;
+  return node.record->lower;
+}
+
+unsigned int CachedNodeTraits::get_upper(const CachedITNode & node) {
+  reads++;
+  return node.record->upper;
+}
+
+template<class Tree>
+void
+check_cached_queries(const Tree & tree, const Record * records)
+{
+  ASSERT_TRUE(tree.verify_integrity());
+
+  for (unsigned int x = 0 ; x <= 10 * IT_TESTSIZE + 250 ; x += 13) {
+    Record r{x, x + 20};
+    CachedITNode q(&r);
+
+    size_t expected = 0;
+    for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+      if ((records[i].lower <= x + 20) && (records[i].upper >= x)) {
+        expected++;
+      }
+    }
+
+    size_t found = 0;
+    for (const auto & n : tree.query(q)) {
+      ASSERT_LE(n.record->lower, x + 20);
+      ASSERT_GE(n.record->upper, x);
+      found++;
+    }
+    ASSERT_EQ(found, expected);
+  }
+}
+
+TEST(ITreeTest, EndpointCacheTest) {
+  using Tree = IntervalTree<CachedITNode, CachedNodeTraits, CachedOptions>;
+  auto tree = Tree();
+
+  Record records[IT_TESTSIZE];
+  CachedITNode nodes[IT_TESTSIZE];
+  CachedITNode moved[IT_TESTSIZE];
+  CachedITNode restored_nodes[IT_TESTSIZE];
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<unsigned int> bounds_distr(0, 10 * IT_TESTSIZE);
+  std::uniform_int_distribution<unsigned int> length_distr(0, 200);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    records[i].lower = bounds_distr(rng);
+    records[i].upper = records[i].lower + length_distr(rng);
+    nodes[i] = CachedITNode(&records[i]);
+    tree.insert(nodes[i]);
+  }
+  check_cached_queries(tree, records);
+
+  // Queries with a point only touch cached bounds
+  CachedNodeTraits::reads = 0;
+  size_t hits = 0;
+  for (unsigned int x = 0 ; x <= 10 * IT_TESTSIZE ; x += 7) {
+    for (const auto & n : tree.query_point(x)) {
+      (void)n;
+      hits++;
+    }
+  }
+  ASSERT_GT(hits, 0u);
+  ASSERT_EQ(CachedNodeTraits::reads, 0u);
+
+  // A copy of a node is not in the tree, so it must not use a cache
+  CachedITNode copy = nodes[0];
+  Record other_record{records[0].lower + 1, records[0].upper + 1};
+  copy.record = &other_record;
+  auto it = tree.find(copy);
+  if (it != tree.end()) {
+    ASSERT_EQ(it->record->lower, other_record.lower);
+    ASSERT_EQ(it->record->upper, other_record.upper);
+  }
+  for (const auto & n : tree.query(copy)) {
+    ASSERT_GE(n.record->upper, other_record.lower);
+  }
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; i += 7) {
+    records[i].lower = bounds_distr(rng);
+    records[i].upper = records[i].lower + length_distr(rng);
+    tree.reposition(nodes[i]);
+  }
+  check_cached_queries(tree, records);
+
+  // Removed nodes may change, and are read freshly when they come back
+  for (unsigned int i = 1 ; i < IT_TESTSIZE ; i += 5) {
+    tree.remove(nodes[i]);
+    records[i].upper = records[i].lower;
+  }
+  for (unsigned int i = 2 ; i < IT_TESTSIZE ; i += 5) {
+    tree.mark_for_removal(nodes[i]);
+  }
+  tree.flush_removals(0.0);
+  for (unsigned int i = 2 ; i < IT_TESTSIZE ; i += 5) {
+    records[i].lower += 1;
+    records[i].upper += 1;
+  }
+  for (unsigned int i = 1 ; i < IT_TESTSIZE ; i += 5) {
+    tree.insert(nodes[i]);
+    tree.insert(nodes[i + 1]);
+  }
+  check_cached_queries(tree, records);
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    moved[i] = CachedITNode(&records[i]);
+    tree.relocate(nodes[i], moved[i]);
+  }
+  check_cached_queries(tree, records);
+
+  tree.optimize();
+  check_cached_queries(tree, records);
+
+  std::stringstream buf;
+  tree.serialize_shape(buf, [&](const CachedITNode & n) {
+    return static_cast<uint64_t>(n.record - records);
+  });
+  auto restored = Tree();
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    restored_nodes[i] = CachedITNode(&records[i]);
+  }
+  ASSERT_TRUE(restored.deserialize_shape(buf, [&](uint64_t id) { return &restored_nodes[id]; }));
+  check_cached_queries(restored, records);
+
+  // After clear(), the nodes may change and be used as queries
+  tree.clear();
+  Record far_away{20 * IT_TESTSIZE, 20 * IT_TESTSIZE + 5};
+  moved[0].record = &far_away;
+  ASSERT_EQ(restored.query(moved[0]).begin(), restored.query(moved[0]).end());
+  ASSERT_EQ(restored.find(moved[0]), restored.end());
+}
+
+class UniqueCachedITNode;
+
+class UniqueCachedNodeTraits : public ITreeNodeTraits<UniqueCachedITNode> {
+public:
+  using key_type = unsigned int;
+
+  static unsigned int get_lower(const UniqueCachedITNode & node);
+  static unsigned int get_upper(const UniqueCachedITNode & node);
+};
+
+using UniqueCachedOptions = TreeOptions<TreeFlags::ENDPOINT_CACHE>;
+
+class UniqueCachedITNode : public ITreeNodeBase<UniqueCachedITNode, UniqueCachedNodeTraits,
+                                                UniqueCachedOptions> {
+public:
+  Record * record;
+
+  UniqueCachedITNode() : record(nullptr) {};
+  explicit UniqueCachedITNode(Record * record_in) : record(record_in) {};
+};
+
+unsigned int UniqueCachedNodeTraits::get_lower(const UniqueCachedITNode & node) {
+  return node.record->lower;
+}
+
+unsigned int UniqueCachedNodeTraits::get_upper(const UniqueCachedITNode & node) {
+  return node.record->upper;
+}
+
+TEST(ITreeTest, RejectedEndpointCacheTest) {
+  using Tree = IntervalTree<UniqueCachedITNode, UniqueCachedNodeTraits, UniqueCachedOptions>;
+  auto tree = Tree();
+
+  Record records[IT_TESTSIZE];
+  Record duplicate_records[IT_TESTSIZE];
+  UniqueCachedITNode nodes[IT_TESTSIZE];
+  UniqueCachedITNode duplicates[IT_TESTSIZE];
+
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    records[i] = Record{10 * i, 10 * i + 5};
+    duplicate_records[i] = records[i];
+    nodes[i] = UniqueCachedITNode(&records[i]);
+    duplicates[i] = UniqueCachedITNode(&duplicate_records[i]);
+    tree.insert(nodes[i]);
+  }
+
+  // Every insertion variant must reject the duplicates
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    switch (i % 6) {
+    case 0:
+      tree.insert(duplicates[i]);
+      break;
+    case 1:
+      tree.insert(duplicates[i], nodes[(i * 7) % IT_TESTSIZE]);
+      break;
+    case 2:
+      tree.insert(duplicates[i], tree.lower_bound(duplicates[i]));
+      break;
+    case 3:
+      tree.insert_left_leaning(duplicates[i]);
+      break;
+    case 4:
+      tree.insert_right_leaning(duplicates[i]);
+      break;
+    default:
+      ASSERT_FALSE(tree.insert_unique(duplicates[i]).second);
+    }
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  size_t count = 0;
+  for (const auto & n : tree) {
+    ASSERT_EQ(n.record, &records[count]);
+    count++;
+  }
+  ASSERT_EQ(count, IT_TESTSIZE);
+
+  // The rejected nodes are not in the tree, so they may change and be used as queries
+  for (unsigned int i = 0 ; i < IT_TESTSIZE ; ++i) {
+    duplicate_records[i] = Record{20 * IT_TESTSIZE + i, 20 * IT_TESTSIZE + i};
+    ASSERT_EQ(tree.find(duplicates[i]), tree.end());
+    ASSERT_EQ(tree.query(duplicates[i]).begin(), tree.query(duplicates[i]).end());
+  }
+}
+
 #endif // TEST_INTERVALTREE_HPP
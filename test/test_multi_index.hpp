@@ -0,0 +1,200 @@
+#ifndef TEST_MULTI_INDEX_HPP
+#define TEST_MULTI_INDEX_HPP
+
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/multi_index.hpp"
+
+using namespace ygg;
+
+namespace multiindextest {
+
+class ById {};
+class ByName {};
+class ByAge {};
+
+using IdOptions = TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>;
+using NameOptions = TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>;
+using AgeOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                               TreeFlags::STATISTICS>;
+
+class Person : public RBTreeNodeBase<Person, IdOptions, ById>,
+               public RBTreeNodeBase<Person, NameOptions, ByName>,
+               public RBTreeNodeBase<Person, AgeOptions, ByAge> {
+public:
+	int id = 0;
+	std::string name;
+	int age = 0;
+};
+
+class IdCompare {
+public:
+	bool operator()(const Person & lhs, const Person & rhs) const {
+		return lhs.id < rhs.id;
+	}
+};
+
+class NameCompare {
+public:
+	bool operator()(const Person & lhs, const Person & rhs) const {
+		return lhs.name < rhs.name;
+	}
+};
+
+class AgeCompare {
+public:
+	bool operator()(const Person & lhs, const Person & rhs) const {
+		return lhs.age < rhs.age;
+	}
+};
+
+using IdTree = RBTree<Person, RBDefaultNodeTraits<Person>, IdOptions, ById, IdCompare>;
+using NameTree = RBTree<Person, RBDefaultNodeTraits<Person>, NameOptions, ByName, NameCompare>;
+using AgeTree = RBTree<Person, RBDefaultNodeTraits<Person>, AgeOptions, ByAge, AgeCompare>;
+using Persons = MultiIndex<Person, IdTree, NameTree, AgeTree>;
+
+void
+check_indexes(const Persons & persons)
+{
+	ASSERT_TRUE(persons.get<0>().verify_integrity());
+	ASSERT_TRUE(persons.get<1>().verify_integrity());
+	ASSERT_TRUE(persons.get<2>().verify_integrity());
+	ASSERT_EQ(persons.get<0>().size(), persons.size());
+	ASSERT_EQ(persons.get<1>().size(), persons.size());
+	ASSERT_EQ(persons.get<2>().size(), persons.size());
+}
+
+TEST(MultiIndexTest, InsertRemoveTest) {
+	Persons persons;
+	std::mt19937 rng(4);
+	std::uniform_int_distribution<int> key_dist(0, 500);
+	std::vector<Person> nodes(1000);
+
+	// Models of the unique indexes
+	std::map<int, Person *> by_id;
+	std::map<std::string, Person *> by_name;
+
+	for (Person & p : nodes) {
+		p.id = key_dist(rng);
+		p.name = "person" + std::to_string(key_dist(rng));
+		p.age = key_dist(rng) % 100;
+
+		bool accepted = (by_id.find(p.id) == by_id.end()) &&
+		                (by_name.find(p.name) == by_name.end());
+		ASSERT_EQ(persons.insert(p), accepted);
+		if (accepted) {
+			by_id[p.id] = &p;
+			by_name[p.name] = &p;
+		}
+	}
+	check_indexes(persons);
+	ASSERT_EQ(persons.size(), by_id.size());
+
+	auto it = persons.get<0>().begin();
+	for (const auto & entry : by_id) {
+		ASSERT_EQ(&(*it), entry.second);
+		++it;
+	}
+	auto name_it = persons.get<1>().begin();
+	for (const auto & entry : by_name) {
+		ASSERT_EQ(&(*name_it), entry.second);
+		++name_it;
+	}
+	int last_age = 0;
+	for (const Person & p : persons.get<2>()) {
+		ASSERT_LE(last_age, p.age);
+		last_age = p.age;
+	}
+
+	// Remove every other person
+	bool remove = false;
+	for (const auto & entry : by_id) {
+		if (remove) {
+			persons.remove(*entry.second);
+		}
+		remove = !remove;
+	}
+	check_indexes(persons);
+	ASSERT_EQ(persons.size(), (by_id.size() + 1) / 2);
+
+	persons.clear();
+	ASSERT_TRUE(persons.empty());
+	check_indexes(persons);
+}
+
+TEST(MultiIndexTest, RejectedInsertionTest) {
+	Persons persons;
+	std::vector<Person> nodes(100);
+	for (size_t i = 0 ; i < nodes.size() ; ++i) {
+		nodes[i].id = static_cast<int>(i);
+		nodes[i].name = "person" + std::to_string(i);
+		nodes[i].age = static_cast<int>(i % 10);
+		ASSERT_TRUE(persons.insert(nodes[i]));
+	}
+
+	persons.get<2>().reset_statistics();
+
+	// Passes the ID index, but collides in the name index
+	Person collision;
+	collision.id = 1000;
+	collision.name = "person42";
+	ASSERT_FALSE(persons.insert(collision));
+	check_indexes(persons);
+	ASSERT_EQ(persons.size(), nodes.size());
+	ASSERT_EQ(persons.get<0>().find(collision), persons.get<0>().end());
+
+	// The non-unique index is never touched for a rejected node
+	ASSERT_EQ(persons.get<2>().get_statistics().comparisons, 0u);
+
+	collision.name = "someone else";
+	ASSERT_TRUE(persons.insert(collision));
+	check_indexes(persons);
+	ASSERT_EQ(&(*persons.get<0>().find(collision)), &collision);
+	ASSERT_EQ(&(*persons.get<1>().find(collision)), &collision);
+}
+
+TEST(MultiIndexTest, ModifyTest) {
+	Persons persons;
+	std::vector<Person> nodes(100);
+	for (size_t i = 0 ; i < nodes.size() ; ++i) {
+		nodes[i].id = static_cast<int>(2 * i);
+		nodes[i].name = "person" + std::to_string(2 * i);
+		nodes[i].age = static_cast<int>(i % 10);
+		ASSERT_TRUE(persons.insert(nodes[i]));
+	}
+
+	// Changing only the age leaves the other indexes alone
+	ASSERT_TRUE(persons.modify(nodes[10], [](Person & p) { p.age = 99; }));
+	check_indexes(persons);
+	ASSERT_EQ(&(*persons.get<2>().rbegin()), &nodes[10]);
+
+	// Changing a unique key to a free one moves the node in that index
+	ASSERT_TRUE(persons.modify(nodes[10], [](Person & p) {
+		p.id = 1001;
+		p.name = "aaa";
+	}));
+	check_indexes(persons);
+	ASSERT_EQ(&(*persons.get<0>().rbegin()), &nodes[10]);
+	ASSERT_EQ(&(*persons.get<1>().begin()), &nodes[10]);
+
+	// A collision removes the node from all indexes
+	ASSERT_FALSE(persons.modify(nodes[20], [](Person & p) { p.id = 1001; }));
+	check_indexes(persons);
+	ASSERT_EQ(persons.size(), nodes.size() - 1);
+	for (const Person & p : persons.get<2>()) {
+		ASSERT_NE(&p, &nodes[20]);
+	}
+
+	// The node can be inserted again once it has a free key
+	nodes[20].id = 1003;
+	ASSERT_TRUE(persons.insert(nodes[20]));
+	check_indexes(persons);
+}
+
+} // namespace multiindextest
+
+#endif // TEST_MULTI_INDEX_HPP
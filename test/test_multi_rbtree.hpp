@@ -34,6 +34,8 @@ public:
 	Node(const Node &other)
 					: dataA(other.dataA), dataB(other.dataB)
 	{};
+
+	Node & operator=(const Node &other) = default;
 };
 
 using NodeBaseA = RBTreeNodeBase<Node, TreeOptions<TreeFlags::MULTIPLE>, TAG_A>;
@@ -162,7 +164,7 @@ TEST(MultiRBTreeTest, RandomInsertionTest) {
 		tb.insert(nodes[i]);
 
     //std::string fname = std::string("/tmp/trees/tree-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(ta.verify_integrity());
 	  ASSERT_TRUE(tb.verify_integrity());
@@ -195,7 +197,7 @@ TEST(MultiRBTreeTest, LinearInsertionTest)
 		tb.insert(nodes[i]);
 
 		//std::string fname = std::string("/tmp/trees/tree-") + std::to_string(i) + std::string(".dot");
-		//tree.dump_to_dot(fname);
+		//debug::dump_to_dot(tree, fname);
 
 		ASSERT_TRUE(ta.verify_integrity());
 		ASSERT_TRUE(ta.verify_integrity());
@@ -467,12 +469,12 @@ TEST(RBTreeTest, LinearInsertionRandomDeletionTest) {
 
   for (unsigned int i = 0 ; i < TESTSIZE ; ++i) {
     //std::string fname = std::string("/tmp/trees/before-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     tree.remove(nodes[indices[i]]);
 
     //fname = std::string("/tmp/trees/after-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
   }
@@ -657,7 +659,7 @@ TEST(RBTreeTest, ComprehensiveTest) {
   ASSERT_TRUE(tree.verify_integrity());
 
   //std::string fname_before = std::string("/tmp/trees/rbt-comprehensive-before.dot");
-  //tree.dump_to_dot(fname_before);
+  //debug::dump_to_dot(tree, fname_before);
 
   for (int i = 0 ; i < TESTSIZE ; ++i) {
     tree.remove(transient_nodes[i]);
@@ -665,12 +667,12 @@ TEST(RBTreeTest, ComprehensiveTest) {
 
     //std::string rem_fname = std::string("/tmp/trees/removed-") + std::to_string(i) + std::string(".dot");
     //std::cout << "Step " << i << ": removing data " << transient_nodes[i].data << "\n";
-    //tree.dump_to_dot(rem_fname);
+    //debug::dump_to_dot(tree, rem_fname);
     ASSERT_TRUE(tree.verify_integrity());
   }
 
   //std::string fname = std::string("/tmp/trees/rbt-comprehensive.dot");
-  //tree.dump_to_dot(fname);
+  //debug::dump_to_dot(tree, fname);
 
   // Query elements
   for (int i = 0 ; i < TESTSIZE ; ++i) {
@@ -729,20 +731,20 @@ TEST(RBTreeTest, ComprehensiveMultipleTest) {
   ASSERT_TRUE(tree.verify_integrity());
 
   //std::string fname_before = std::string("/tmp/trees/rbt-comprehensive-before.dot");
-  //tree.dump_to_dot(fname_before);
+  //debug::dump_to_dot(tree, fname_before);
 
   for (int i = 0 ; i < TESTSIZE ; ++i) {
     tree.remove(transient_nodes[i]);
 
     //std::string rem_fname = std::string("/tmp/trees/removed-") + std::to_string(i) + std::string(".dot");
     //std::cout << "Step " << i << ": removing data " << transient_nodes[i].data << "\n";
-    //tree.dump_to_dot(rem_fname);
+    //debug::dump_to_dot(tree, rem_fname);
     ASSERT_TRUE(tree.verify_integrity());
   }
 
 
   //std::string fname = std::string("/tmp/trees/rbt-comprehensive.dot");
-  //tree.dump_to_dot(fname);
+  //debug::dump_to_dot(tree, fname);
 
   // Query elements
   for (int i = 0 ; i < TESTSIZE ; ++i) {
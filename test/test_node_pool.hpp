@@ -0,0 +1,156 @@
+#ifndef TEST_NODE_POOL_HPP
+#define TEST_NODE_POOL_HPP
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "../src/rbtree.hpp"
+#include "../src/node_pool.hpp"
+
+using namespace ygg;
+
+#define POOL_TESTSIZE 5000
+
+namespace pooltest {
+
+static std::atomic<int> destructed(0);
+
+class Node : public RBTreeNodeBase<Node, TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>> {
+public:
+	int data;
+
+	explicit Node(int data_in) : data(data_in) {};
+	~Node() { destructed++; };
+
+	bool operator<(const Node & other) const {
+		return this->data < other.data;
+	}
+};
+
+using Tree = RBTree<Node, RBDefaultNodeTraits<Node>, TreeOptions<TreeFlags::CONSTANT_TIME_SIZE>>;
+
+TEST(NodePoolTest, AllocationTest) {
+	NodePool<Node> pool(128);
+
+	std::vector<Node *> nodes;
+	std::set<Node *> addresses;
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		Node * n = pool.construct(i);
+		ASSERT_EQ(reinterpret_cast<uintptr_t>(n) % alignof(Node), 0);
+		nodes.push_back(n);
+		addresses.insert(n);
+	}
+
+	ASSERT_EQ(addresses.size(), POOL_TESTSIZE);
+	ASSERT_EQ(pool.get_slab_count(), (POOL_TESTSIZE + 127) / 128);
+
+	// Addresses are stable
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		ASSERT_EQ(nodes[i]->data, i);
+	}
+
+	destructed = 0;
+	for (Node * n : nodes) {
+		pool.destroy(n);
+	}
+	ASSERT_EQ(destructed.load(), POOL_TESTSIZE);
+
+	// Freed nodes are reused
+	size_t slabs = pool.get_slab_count();
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		nodes[i] = pool.construct(i);
+	}
+	ASSERT_EQ(pool.get_slab_count(), slabs);
+
+	for (Node * n : nodes) {
+		pool.destroy(n);
+	}
+}
+
+TEST(NodePoolTest, HugePageTest) {
+	// Falls back to regular pages if no huge pages are available
+	NodePool<Node> pool(1024, true);
+
+	std::vector<Node *> nodes;
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		nodes.push_back(pool.construct(i));
+	}
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		ASSERT_EQ(nodes[i]->data, i);
+		pool.destroy(nodes[i]);
+	}
+}
+
+TEST(NodePoolTest, ConcurrentAllocationTest) {
+	NodePool<Node> pool(64);
+
+	std::vector<std::thread> threads;
+	for (int t = 0 ; t < 4 ; ++t) {
+		threads.emplace_back([&pool, t]() {
+			std::vector<Node *> nodes;
+			for (size_t round = 0 ; round < 10 ; ++round) {
+				for (size_t i = 0 ; i < POOL_TESTSIZE / 10 ; ++i) {
+					nodes.push_back(pool.construct(t));
+				}
+				// Free some of them, the rest survives into the next round
+				size_t keep = round * (POOL_TESTSIZE / 20);
+				while (nodes.size() > keep) {
+					ASSERT_EQ(nodes.back()->data, t);
+					pool.destroy(nodes.back());
+					nodes.pop_back();
+				}
+			}
+			for (Node * n : nodes) {
+				ASSERT_EQ(n->data, t);
+				pool.destroy(n);
+			}
+		});
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+}
+
+TEST(NodePoolTest, ClearAndReleaseTest) {
+	NodePool<Node> pool;
+	Tree t;
+
+	std::vector<int> values(POOL_TESTSIZE);
+	for (int i = 0 ; i < POOL_TESTSIZE ; ++i) {
+		values[i] = i;
+	}
+	std::mt19937 rng(4);
+	std::shuffle(values.begin(), values.end(), rng);
+
+	for (int value : values) {
+		t.insert(*pool.construct(value));
+	}
+	ASSERT_EQ(t.size(), POOL_TESTSIZE);
+
+	destructed = 0;
+	t.clear_and_release(pool);
+
+	ASSERT_EQ(destructed.load(), POOL_TESTSIZE);
+	ASSERT_TRUE(t.empty());
+	ASSERT_EQ(t.size(), 0);
+	ASSERT_TRUE(t.verify_integrity());
+
+	// The tree is usable again, and the pool hands out the released nodes
+	size_t slabs = pool.get_slab_count();
+	for (int value : values) {
+		t.insert(*pool.construct(value));
+	}
+	ASSERT_EQ(pool.get_slab_count(), slabs);
+	ASSERT_TRUE(t.verify_integrity());
+
+	t.clear_and_release(pool);
+}
+
+} // namespace pooltest
+
+#endif // TEST_NODE_POOL_HPP
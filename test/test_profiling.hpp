@@ -0,0 +1,85 @@
+#ifndef TEST_PROFILING_HPP
+#define TEST_PROFILING_HPP
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+#include "../src/rbtree.hpp"
+#include "../src/profiling.hpp"
+
+using namespace ygg;
+
+namespace proftest {
+
+class Node : public RBTreeNodeBase<Node, TreeOptions<>> {
+public:
+	int data;
+
+	Node() : data(0) {};
+	explicit Node(int data_in) : data(data_in) {};
+
+	bool operator<(const Node & other) const {
+		return this->data < other.data;
+	}
+};
+
+using Tree = RBTree<Node, RBDefaultNodeTraits<Node>, TreeOptions<>>;
+
+TEST(ProfilingTest, EmptyTreeTest) {
+	Tree t;
+	debug::TreeProfile p = debug::profile_tree(t);
+
+	ASSERT_EQ(p.node_count, 0);
+	ASSERT_EQ(p.height, 0);
+	ASSERT_EQ(p.edges, 0);
+
+	std::stringstream json;
+	p.to_json(json);
+	ASSERT_EQ(json.str().front(), '{');
+	ASSERT_EQ(json.str().back(), '}');
+}
+
+TEST(ProfilingTest, ShapeTest) {
+	Tree t;
+	// 2^10 - 1 nodes, inserted linearly
+	std::vector<Node> nodes(1023);
+	for (unsigned int i = 0 ; i < nodes.size() ; ++i) {
+		nodes[i] = Node(static_cast<int>(i));
+		t.insert(nodes[i]);
+	}
+
+	debug::TreeProfile p = debug::profile_tree(t);
+
+	ASSERT_EQ(p.node_count, nodes.size());
+	ASSERT_EQ(p.edges, nodes.size() - 1);
+	ASSERT_GE(p.height, 10);
+	ASSERT_LE(p.height, 20);
+	ASSERT_EQ(p.depth_histogram.size(), p.height);
+	ASSERT_EQ(p.depth_histogram[0], 1);
+
+	size_t histogram_sum = 0;
+	for (size_t count : p.depth_histogram) {
+		histogram_sum += count;
+	}
+	ASSERT_EQ(histogram_sum, nodes.size());
+
+	ASSERT_GE(p.black_height, 5);
+	ASSERT_LE(p.black_height, p.height);
+	ASSERT_GT(p.average_path_length(), 1.0);
+	ASSERT_LE(p.average_path_length(), static_cast<double>(p.height));
+
+	// The nodes live in one contiguous array
+	ASSERT_LT(p.max_distance, nodes.size() * sizeof(Node));
+	ASSERT_LE(p.page_crossings, p.edges);
+	ASSERT_LE(p.page_crossings, p.cache_line_crossings);
+
+	std::stringstream json;
+	p.to_json(json);
+	ASSERT_NE(json.str().find("\"node_count\":1023"), std::string::npos);
+	ASSERT_NE(json.str().find("\"depth_histogram\":[1,2,"), std::string::npos);
+}
+
+} // namespace proftest
+
+#endif // TEST_PROFILING_HPP
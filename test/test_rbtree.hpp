@@ -2,9 +2,15 @@
 #define TEST_RBTREE_HPP
 
 #include <gtest/gtest.h>
+#include <deque>
+#include <map>
 #include <random>
+#include <set>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <algorithm>
+#include <iterator>
 
 #include "../src/rbtree.hpp"
 
@@ -19,6 +25,7 @@ public:
   Node () : data(0) {};
   explicit Node(int data_in) : data(data_in) {};
   Node(const Node &other) : data(other.data) {};
+  Node & operator=(const Node &other) = default;
 
   bool operator<(const Node & other) const {
     return this->data < other.data;
@@ -33,6 +40,7 @@ public:
   EqualityNode () : data(0) {};
   explicit EqualityNode(int data_in, int sub_data_in = 0) : data(data_in), sub_data(sub_data_in) {};
   EqualityNode(const EqualityNode &other) : data(other.data), sub_data(other.sub_data) {};
+  EqualityNode & operator=(const EqualityNode &other) = default;
 
   bool operator<(const EqualityNode & other) const {
     return this->data < other.data;
@@ -82,6 +90,14 @@ TEST(RBTreeTest, TrivialSizeTest) {
 	ASSERT_TRUE(tree.empty());
 }
 
+TEST(RBTreeTest, ObjectSizeTest) {
+  // Disabled features must not take any space: The root, the (empty) comparator padded to a
+  // word and, if CONSTANT_TIME_SIZE is set, the size
+  ASSERT_EQ(sizeof(RBTree<EqualityNode, EqualityNodeTraits>),
+            sizeof(EqualityNode *) + 2 * sizeof(size_t));
+  ASSERT_EQ(sizeof(RBTree<Node, NodeTraits, TreeOptions<>>), sizeof(Node *) + sizeof(size_t));
+}
+
 TEST(RBTreeTest, RandomInsertionTest) {
   auto tree = RBTree<Node, NodeTraits, TreeOptions<>>();
 
@@ -103,7 +119,7 @@ TEST(RBTreeTest, RandomInsertionTest) {
     tree.insert(nodes[i]);
 
     //std::string fname = std::string("/tmp/trees/tree-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
   }
@@ -120,7 +136,7 @@ TEST(RBTreeTest, LinearInsertionTest) {
     tree.insert(nodes[i]);
 
     //std::string fname = std::string("/tmp/trees/tree-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
   }
@@ -425,12 +441,12 @@ TEST(RBTreeTest, LinearInsertionRandomDeletionTest) {
 
   for (unsigned int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
     //std::string fname = std::string("/tmp/trees/before-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     tree.remove(nodes[indices[i]]);
 
     //fname = std::string("/tmp/trees/after-") + std::to_string(i) + std::string(".dot");
-    //tree.dump_to_dot(fname);
+    //debug::dump_to_dot(tree, fname);
 
     ASSERT_TRUE(tree.verify_integrity());
   }
@@ -615,7 +631,7 @@ TEST(RBTreeTest, ComprehensiveTest) {
   ASSERT_TRUE(tree.verify_integrity());
 
   //std::string fname_before = std::string("/tmp/trees/rbt-comprehensive-before.dot");
-  //tree.dump_to_dot(fname_before);
+  //debug::dump_to_dot(tree, fname_before);
 
   for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
     tree.remove(transient_nodes[i]);
@@ -623,12 +639,12 @@ TEST(RBTreeTest, ComprehensiveTest) {
 
     //std::string rem_fname = std::string("/tmp/trees/removed-") + std::to_string(i) + std::string(".dot");
     //std::cout << "Step " << i << ": removing data " << transient_nodes[i].data << "\n";
-    //tree.dump_to_dot(rem_fname);
+    //debug::dump_to_dot(tree, rem_fname);
     ASSERT_TRUE(tree.verify_integrity());
   }
 
   //std::string fname = std::string("/tmp/trees/rbt-comprehensive.dot");
-  //tree.dump_to_dot(fname);
+  //debug::dump_to_dot(tree, fname);
 
   // Query elements
   for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
@@ -691,21 +707,21 @@ TEST(RBTreeTest, ComprehensiveMultipleTest) {
   ASSERT_TRUE(tree.verify_integrity());
 
   //std::string fname_before = std::string("/tmp/trees/rbt-comprehensive-before.dot");
-  //tree.dump_to_dot(fname_before);
+  //debug::dump_to_dot(tree, fname_before);
 
   for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
     tree.remove(transient_nodes[i]);
     size--;
     //std::string rem_fname = std::string("/tmp/trees/removed-") + std::to_string(i) + std::string(".dot");
     //std::cout << "Step " << i << ": removing data " << transient_nodes[i].data << "\n";
-    //tree.dump_to_dot(rem_fname);
+    //debug::dump_to_dot(tree, rem_fname);
     ASSERT_TRUE(tree.verify_integrity());
     ASSERT_EQ(tree.size(), size);
   }
 
 
   //std::string fname = std::string("/tmp/trees/rbt-comprehensive.dot");
-  //tree.dump_to_dot(fname);
+  //debug::dump_to_dot(tree, fname);
 
   // Query elements
   for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
@@ -716,6 +732,1542 @@ TEST(RBTreeTest, ComprehensiveMultipleTest) {
   }
 
 }
+
+class StatisticsNode : public RBTreeNodeBase<StatisticsNode, TreeOptions<TreeFlags::STATISTICS>> {
+public:
+  int data;
+
+  StatisticsNode () : data(0) {};
+  explicit StatisticsNode(int data_in) : data(data_in) {};
+
+  bool operator<(const StatisticsNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+TEST(RBTreeTest, StatisticsTest) {
+  auto tree = RBTree<StatisticsNode, RBDefaultNodeTraits<StatisticsNode>,
+                     TreeOptions<TreeFlags::STATISTICS>>();
+
+  std::vector<StatisticsNode> nodes(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = StatisticsNode(i);
+  }
+
+  // Linear insertion forces rebalancing
+  for (auto & n : nodes) {
+    tree.insert(n);
+  }
+
+  TreeStatistics after_insert = tree.get_statistics();
+  ASSERT_EQ(after_insert.descents, RBTREE_TESTSIZE);
+  ASSERT_GE(after_insert.comparisons, after_insert.descent_depth);
+  ASSERT_GT(after_insert.rotations, 0);
+  ASSERT_GT(after_insert.insert_fixup_iterations, 0);
+  ASSERT_EQ(after_insert.swaps, 0);
+  ASSERT_EQ(after_insert.delete_fixup_iterations, 0);
+
+  TreeStatistics old = tree.reset_statistics();
+  ASSERT_EQ(old.comparisons, after_insert.comparisons);
+  ASSERT_EQ(tree.get_statistics().comparisons, 0);
+  ASSERT_EQ(tree.get_statistics().descents, 0);
+
+  for (auto & n : nodes) {
+    ASSERT_EQ(&(*tree.find(n)), &n);
+  }
+
+  TreeStatistics after_find = tree.get_statistics();
+  ASSERT_EQ(after_find.descents, RBTREE_TESTSIZE);
+  // A red-black tree has height at most 2 log(n+1)
+  ASSERT_LE(after_find.descent_depth, RBTREE_TESTSIZE * 2 * 11);
+  ASSERT_EQ(after_find.rotations, 0);
+
+  tree.reset_statistics();
+  for (auto & n : nodes) {
+    tree.remove(n);
+  }
+
+  TreeStatistics after_remove = tree.get_statistics();
+  ASSERT_GT(after_remove.swaps, 0);
+  ASSERT_GT(after_remove.delete_fixup_iterations, 0);
+  ASSERT_TRUE(tree.empty());
+}
+
+TEST(RBTreeTest, RelocationTest) {
+  auto tree = RBTree<Node, NodeTraits, TreeOptions<>>();
+
+  Node nodes[RBTREE_TESTSIZE];
+  Node moved[RBTREE_TESTSIZE];
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = Node(i);
+    tree.insert(nodes[i]);
+  }
+
+  // Relocate every second node, including the root at some point
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; i += 2) {
+    moved[i] = Node(i);
+    tree.relocate(nodes[i], moved[i]);
+    ASSERT_TRUE(tree.verify_integrity());
+  }
+
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    auto it = tree.find(Node(i));
+    if (i % 2 == 0) {
+      ASSERT_EQ(&(*it), &moved[i]);
+    } else {
+      ASSERT_EQ(&(*it), &nodes[i]);
+    }
+  }
+
+  // Relocated nodes can be removed normally
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; i += 2) {
+    tree.remove(moved[i]);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  for (auto & n : tree) {
+    ASSERT_EQ(n.data % 2, 1);
+  }
+}
+
+TEST(RBTreeTest, DefragmentationTest) {
+  for (auto order : {DefragmentationOrder::IN_ORDER, DefragmentationOrder::VAN_EMDE_BOAS}) {
+    auto tree = RBTree<Node, NodeTraits, TreeOptions<>>();
+
+    std::mt19937 rng(order == DefragmentationOrder::IN_ORDER ? 42 : 43);
+    std::vector<int> values(RBTREE_TESTSIZE);
+    for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+      values[i] = i;
+    }
+    std::shuffle(values.begin(), values.end(), rng);
+
+    std::vector<Node *> scattered;
+    for (int value : values) {
+      scattered.push_back(new Node(value));
+      tree.insert(*scattered.back());
+    }
+
+    std::vector<Node> arena(RBTREE_TESTSIZE);
+    tree.defragment(arena.data(), order);
+
+    for (Node * n : scattered) {
+      delete n;
+    }
+
+    ASSERT_TRUE(tree.verify_integrity());
+
+    int expected = 0;
+    for (auto & n : tree) {
+      ASSERT_GE(&n, arena.data());
+      ASSERT_LT(&n, arena.data() + RBTREE_TESTSIZE);
+      ASSERT_EQ(n.data, expected);
+      if (order == DefragmentationOrder::IN_ORDER) {
+        ASSERT_EQ(&n, &arena[expected]);
+      }
+      expected++;
+    }
+    ASSERT_EQ(expected, RBTREE_TESTSIZE);
+
+    // van Emde Boas layout starts with the root and its children
+    if (order == DefragmentationOrder::VAN_EMDE_BOAS) {
+      Node * root = tree.get_root();
+      ASSERT_EQ(root, &arena[0]);
+      ASSERT_EQ(tree.get_left_child(root), &arena[1]);
+    }
+  }
+}
+
+TEST(RBTreeTest, DrainTest) {
+  auto tree = RBTree<Node, NodeTraits, TreeOptions<>>();
+
+  std::mt19937 rng(4);
+  std::vector<int> values(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    values[i] = i;
+  }
+  std::shuffle(values.begin(), values.end(), rng);
+
+  for (int value : values) {
+    tree.insert(*(new Node(value)));
+  }
+
+  int drained = 0;
+  std::vector<bool> seen(RBTREE_TESTSIZE, false);
+  tree.drain([&](Node & n) {
+    // Nodes are completely unlinked before being handed out
+    ASSERT_EQ(tree.get_parent(&n), nullptr);
+    ASSERT_EQ(tree.get_left_child(&n), nullptr);
+    ASSERT_EQ(tree.get_right_child(&n), nullptr);
+    ASSERT_FALSE(seen[n.data]);
+    seen[n.data] = true;
+    drained++;
+    delete &n;
+  });
+
+  ASSERT_EQ(drained, RBTREE_TESTSIZE);
+  ASSERT_TRUE(tree.empty());
+  ASSERT_TRUE(tree.verify_integrity());
+
+  // Draining an empty tree does nothing
+  tree.drain([&](Node & n) { (void)n; drained++; });
+  ASSERT_EQ(drained, RBTREE_TESTSIZE);
+}
+
+TEST(RBTreeTest, ShapeSerializationTest) {
+  using Tree = RBTree<StatisticsNode, RBDefaultNodeTraits<StatisticsNode>,
+                      TreeOptions<TreeFlags::STATISTICS>>;
+  Tree tree;
+
+  std::mt19937 rng(4);
+  std::vector<StatisticsNode> nodes(RBTREE_TESTSIZE);
+  std::vector<StatisticsNode> restored_nodes(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = StatisticsNode(i);
+    restored_nodes[i] = StatisticsNode(i);
+  }
+  std::vector<int> order(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  for (int i : order) {
+    tree.insert(nodes[i]);
+  }
+
+  std::stringstream buf;
+  tree.serialize_shape(buf, [](const StatisticsNode & n) { return n.data; });
+
+  Tree restored;
+  bool success = restored.deserialize_shape(buf, [&](uint64_t id) {
+    return (id < RBTREE_TESTSIZE) ? &restored_nodes[id] : nullptr;
+  });
+  ASSERT_TRUE(success);
+
+  // Restoring compares no keys
+  ASSERT_EQ(restored.get_statistics().comparisons, 0);
+  ASSERT_TRUE(restored.verify_integrity());
+
+  // Same shape and colors
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    StatisticsNode * orig_parent = Tree::get_parent(&nodes[i]);
+    StatisticsNode * new_parent = Tree::get_parent(&restored_nodes[i]);
+    if (orig_parent == nullptr) {
+      ASSERT_EQ(new_parent, nullptr);
+    } else {
+      ASSERT_EQ(new_parent, &restored_nodes[orig_parent->data]);
+    }
+    ASSERT_TRUE(nodes[i]._rbt_color == restored_nodes[i]._rbt_color);
+  }
+
+  int expected = 0;
+  for (auto & n : restored) {
+    ASSERT_EQ(&n, &restored_nodes[expected]);
+    expected++;
+  }
+  ASSERT_EQ(expected, RBTREE_TESTSIZE);
+
+  // Truncated data leaves the tree empty
+  std::string data = buf.str();
+  std::stringstream truncated(data.substr(0, data.size() / 2));
+  ASSERT_FALSE(restored.deserialize_shape(truncated, [&](uint64_t id) {
+    return &restored_nodes[id];
+  }));
+  ASSERT_TRUE(restored.empty());
+
+  // Unknown IDs are rejected
+  std::stringstream unknown(data);
+  ASSERT_FALSE(restored.deserialize_shape(unknown, [&](uint64_t id) {
+    return (id != 42) ? &restored_nodes[id] : nullptr;
+  }));
+  ASSERT_TRUE(restored.empty());
+
+  // Repeated IDs are rejected without verification, wherever they occur
+  for (uint64_t dup : {uint64_t(0), uint64_t(1), uint64_t(RBTREE_TESTSIZE / 2),
+                       uint64_t(RBTREE_TESTSIZE - 1)}) {
+    std::stringstream repeated(data);
+    ASSERT_FALSE(restored.deserialize_shape(repeated, [&](uint64_t id) {
+      return &restored_nodes[(id == dup) ? (id + 7) % RBTREE_TESTSIZE : id];
+    }));
+    ASSERT_TRUE(restored.empty());
+  }
+
+  // Empty trees round-trip
+  Tree empty;
+  std::stringstream empty_buf;
+  empty.serialize_shape(empty_buf, [](const StatisticsNode & n) { return n.data; });
+  ASSERT_TRUE(restored.deserialize_shape(empty_buf, [&](uint64_t id) {
+    return &restored_nodes[id];
+  }, true));
+  ASSERT_TRUE(restored.empty());
+}
+
+using PrefixOptions = TreeOptions<TreeFlags::KEY_PREFIX_CACHE, TreeFlags::STATISTICS>;
+
+class StringNode : public RBTreeNodeBase<StringNode, PrefixOptions> {
+public:
+  std::string key;
+
+  StringNode () : key() {};
+  explicit StringNode(std::string key_in) : key(key_in) {};
+
+  bool operator<(const StringNode & other) const {
+    return this->key < other.key;
+  }
+};
+
+bool operator<(const StringNode & lhs, const std::string & rhs) {
+  return lhs.key < rhs;
+}
+bool operator<(const std::string & lhs, const StringNode & rhs) {
+  return lhs < rhs.key;
+}
+
+class StringNodeTraits : public RBDefaultNodeTraits<StringNode> {
+public:
+  static uint64_t get_key_prefix(const StringNode & node) {
+    return utilities::make_key_prefix(node.key.data(), node.key.size());
+  }
+  static uint64_t get_key_prefix(const std::string & key) {
+    return utilities::make_key_prefix(key.data(), key.size());
+  }
+};
+
+TEST(RBTreeTest, KeyPrefixCacheTest) {
+  auto tree = RBTree<StringNode, StringNodeTraits, PrefixOptions>();
+
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> char_distr('a', 'z');
+  std::vector<std::string> keys;
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    std::string key;
+    for (int j = 0 ; j < 12 ; ++j) {
+      key.push_back(static_cast<char>(char_distr(rng)));
+    }
+    // Every fourth key shares its first eight bytes with another key
+    if ((i % 4 == 1) && (!keys.empty())) {
+      key = keys.back().substr(0, 8) + key.substr(8);
+    }
+    keys.push_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  std::vector<StringNode> nodes;
+  for (const auto & key : keys) {
+    nodes.emplace_back(key);
+  }
+  std::vector<size_t> order(nodes.size());
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  for (size_t i : order) {
+    tree.insert(nodes[i]);
+  }
+
+  ASSERT_TRUE(tree.verify_integrity());
+  TreeStatistics stats = tree.reset_statistics();
+  // Only ties on the prefix need full comparisons
+  ASSERT_LT(stats.comparisons, stats.descent_depth / 2);
+
+  size_t i = 0;
+  for (auto & n : tree) {
+    ASSERT_EQ(n.key, keys[i]);
+    i++;
+  }
+
+  for (size_t j = 0 ; j < keys.size() ; ++j) {
+    ASSERT_EQ(&(*tree.find(keys[j])), &nodes[j]);
+    ASSERT_EQ(&(*tree.lower_bound(keys[j])), &nodes[j]);
+  }
+  ASSERT_EQ(tree.find(std::string("zzzzzzzzzzzzz")), tree.end());
+  ASSERT_EQ(tree.find(keys[0].substr(0, 8)), tree.end());
+  ASSERT_EQ(&(*tree.lower_bound(keys[0].substr(0, 8))), &nodes[0]);
+
+  for (size_t j = 0 ; j < nodes.size() ; j += 2) {
+    tree.remove(nodes[j]);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  for (size_t j = 1 ; j < nodes.size() ; j += 2) {
+    ASSERT_EQ(&(*tree.find(keys[j])), &nodes[j]);
+  }
+}
+
+class ThreeWayCompare {
+public:
+  int operator()(const StatisticsNode & lhs, const StatisticsNode & rhs) const {
+    return (lhs.data < rhs.data) ? -1 : ((lhs.data == rhs.data) ? 0 : 1);
+  }
+  int operator()(const StatisticsNode & lhs, int rhs) const {
+    return (lhs.data < rhs) ? -1 : ((lhs.data == rhs) ? 0 : 1);
+  }
+};
+
+TEST(RBTreeTest, ThreeWayCompareTest) {
+  auto tree = RBTree<StatisticsNode, RBDefaultNodeTraits<StatisticsNode>,
+                     TreeOptions<TreeFlags::STATISTICS>, int, ThreeWayCompare>();
+
+  std::mt19937 rng(4);
+  std::vector<StatisticsNode> nodes(RBTREE_TESTSIZE);
+  std::vector<StatisticsNode> duplicates(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    // Only even values
+    nodes[i] = StatisticsNode(2 * i);
+    duplicates[i] = StatisticsNode(2 * i);
+  }
+  std::shuffle(nodes.begin(), nodes.end(), rng);
+
+  for (auto & n : nodes) {
+    tree.insert(n);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+
+  // One comparison per level, no comparisons when attaching the new leaf
+  TreeStatistics stats = tree.reset_statistics();
+  ASSERT_EQ(stats.comparisons, stats.descent_depth);
+
+  // Duplicates are rejected, wherever on the path the equal element is
+  for (auto & n : duplicates) {
+    tree.insert(n);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  int expected = 0;
+  for (auto & n : tree) {
+    ASSERT_EQ(n.data, expected);
+    ASSERT_TRUE(std::find_if(duplicates.begin(), duplicates.end(),
+                             [&](const StatisticsNode & dup) { return &dup == &n; }) ==
+                duplicates.end());
+    expected += 2;
+  }
+  ASSERT_EQ(expected, 2 * RBTREE_TESTSIZE);
+
+  tree.reset_statistics();
+  for (int i = 0 ; i < 2 * RBTREE_TESTSIZE ; ++i) {
+    auto it = tree.find(i);
+    if (i % 2 == 0) {
+      ASSERT_EQ(it->data, i);
+    } else {
+      ASSERT_EQ(it, tree.end());
+    }
+
+    auto lb = tree.lower_bound(i);
+    auto ub = tree.upper_bound(i);
+    if (i < 2 * RBTREE_TESTSIZE - 2) {
+      ASSERT_EQ(lb->data, (i + 1) / 2 * 2);
+      ASSERT_EQ(ub->data, i / 2 * 2 + 2);
+    } else if (i == 2 * RBTREE_TESTSIZE - 2) {
+      ASSERT_EQ(lb->data, i);
+      ASSERT_EQ(ub, tree.end());
+    } else {
+      ASSERT_EQ(lb, tree.end());
+      ASSERT_EQ(ub, tree.end());
+    }
+  }
+  stats = tree.get_statistics();
+  ASSERT_EQ(stats.comparisons, stats.descent_depth);
+}
+
+using BucketOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                  TreeFlags::EQUALITY_BUCKETS, TreeFlags::DEFERRED_REMOVAL>;
+
+class BucketNode : public RBTreeNodeBase<BucketNode, BucketOptions> {
+public:
+  int data;
+  int sub_data;
+
+  BucketNode() : data(0), sub_data(0) {};
+  explicit BucketNode(int data_in, int sub_data_in = 0) : data(data_in), sub_data(sub_data_in) {};
+
+  bool operator<(const BucketNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+bool operator<(const BucketNode & lhs, int rhs) {
+  return lhs.data < rhs;
+}
+bool operator<(int lhs, const BucketNode & rhs) {
+  return lhs < rhs.data;
+}
+
+using BucketTree = RBTree<BucketNode, RBDefaultNodeTraits<BucketNode>, BucketOptions>;
+
+void
+check_bucket_tree(const BucketTree & tree, const std::vector<BucketNode *> & expected)
+{
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_EQ(tree.size(), expected.size());
+
+  auto it = tree.begin();
+  for (BucketNode * n : expected) {
+    ASSERT_NE(it, tree.end());
+    ASSERT_EQ(&(*it), n);
+    ++it;
+  }
+  ASSERT_EQ(it, tree.end());
+
+  auto rit = tree.rbegin();
+  for (auto eit = expected.rbegin() ; eit != expected.rend() ; ++eit) {
+    ASSERT_NE(rit, tree.rend());
+    ASSERT_EQ(&(*rit), *eit);
+    ++rit;
+  }
+  ASSERT_EQ(rit, tree.rend());
+}
+
+TEST(RBTreeTest, EqualityBucketTest) {
+  constexpr int KEYS = 20;
+  BucketTree tree;
+  std::vector<BucketNode *> expected;
+
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, KEYS - 1);
+  std::vector<BucketNode> nodes(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = BucketNode(key_dist(rng), i);
+  }
+
+  // Left-leaning inserts go before equal elements, right-leaning ones after them, hinted ones
+  // directly before the hint.
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    BucketNode & n = nodes[i];
+    auto by_data = [](const BucketNode * a, const BucketNode * b) { return a->data < b->data; };
+    if ((i % 3 == 2) && !expected.empty()) {
+      size_t pos = std::uniform_int_distribution<size_t>(0, expected.size() - 1)(rng);
+      // Keep the order valid: pick an element with the same key, or one whose predecessor is
+      // not larger.
+      BucketNode * hint = expected[pos];
+      if (hint->data != n.data) {
+        auto lb = std::lower_bound(expected.begin(), expected.end(), &n, by_data);
+        if (lb == expected.end()) {
+          tree.insert(n, tree.end());
+          expected.push_back(&n);
+          continue;
+        }
+        hint = *lb;
+      }
+      tree.insert(n, *hint);
+      expected.insert(std::find(expected.begin(), expected.end(), hint), &n);
+    } else if (i % 3 == 1) {
+      tree.insert_right_leaning(n);
+      expected.insert(std::upper_bound(expected.begin(), expected.end(), &n, by_data), &n);
+    } else {
+      tree.insert(n);
+      expected.insert(std::lower_bound(expected.begin(), expected.end(), &n, by_data), &n);
+    }
+  }
+  check_bucket_tree(tree, expected);
+
+  // Only the representatives are tree nodes
+  int tree_nodes = 0;
+  for (const BucketNode & n : tree) {
+    if ((BucketTree::get_parent(const_cast<BucketNode *>(&n)) != nullptr) ||
+        (tree.get_root() == &n)) {
+      tree_nodes++;
+    }
+  }
+  ASSERT_EQ(tree_nodes, KEYS);
+
+  for (int key = 0 ; key < KEYS ; ++key) {
+    BucketNode * first = *std::find_if(expected.begin(), expected.end(),
+                                       [&](const BucketNode * n) { return n->data == key; });
+    ASSERT_EQ(&(*tree.find(key)), first);
+    ASSERT_EQ(&(*tree.lower_bound(key)), first);
+  }
+
+  // Relocate one element in a bucket and one representative
+  BucketNode * old_member = &(*(++tree.find(3)));
+  ASSERT_EQ(old_member->data, 3);
+  BucketNode moved_member = *old_member;
+  tree.relocate(*old_member, moved_member);
+  std::replace(expected.begin(), expected.end(), old_member, &moved_member);
+  BucketNode * old_rep = &(*tree.find(5));
+  BucketNode moved_rep = *old_rep;
+  tree.relocate(*old_rep, moved_rep);
+  std::replace(expected.begin(), expected.end(), old_rep, &moved_rep);
+  check_bucket_tree(tree, expected);
+
+  // Remove half of the elements, including representatives
+  std::vector<BucketNode *> removed = expected;
+  std::shuffle(removed.begin(), removed.end(), rng);
+  removed.resize(RBTREE_TESTSIZE / 2);
+  for (BucketNode * n : removed) {
+    tree.remove(*n);
+    expected.erase(std::find(expected.begin(), expected.end(), n));
+  }
+  check_bucket_tree(tree, expected);
+
+  // Buckets stay together when defragmenting
+  std::vector<BucketNode> arena(expected.size());
+  tree.defragment(arena.data(), DefragmentationOrder::VAN_EMDE_BOAS);
+  std::vector<BucketNode *> defragmented;
+  for (BucketNode & n : tree) {
+    ASSERT_GE(&n, arena.data());
+    ASSERT_LT(&n, arena.data() + arena.size());
+    defragmented.push_back(&n);
+  }
+  ASSERT_EQ(defragmented.size(), expected.size());
+  for (size_t i = 0 ; i < expected.size() ; ++i) {
+    ASSERT_EQ(defragmented[i]->sub_data, expected[i]->sub_data);
+  }
+  check_bucket_tree(tree, defragmented);
+
+  // Shape serialization round trip
+  std::stringstream buf;
+  tree.serialize_shape(buf, [](const BucketNode & n) { return n.sub_data; });
+  std::vector<BucketNode *> by_id(RBTREE_TESTSIZE, nullptr);
+  for (BucketNode * n : defragmented) {
+    by_id[static_cast<size_t>(n->sub_data)] = n;
+  }
+  BucketTree restored;
+  ASSERT_TRUE(restored.deserialize_shape(buf, [&](uint64_t id) { return by_id[id]; }, true));
+  check_bucket_tree(restored, defragmented);
+
+  size_t drained = 0;
+  restored.drain([&](BucketNode & n) {
+    (void)n;
+    drained++;
+  });
+  ASSERT_EQ(drained, defragmented.size());
+  ASSERT_TRUE(restored.empty());
+}
+
+using PrefixBucketOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::EQUALITY_BUCKETS,
+                                        TreeFlags::KEY_PREFIX_CACHE, TreeFlags::DEFERRED_REMOVAL>;
+
+class PrefixBucketNode : public RBTreeNodeBase<PrefixBucketNode, PrefixBucketOptions> {
+public:
+  int data;
+  int sub_data;
+
+  bool operator<(const PrefixBucketNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+bool operator<(const PrefixBucketNode & lhs, int rhs) {
+  return lhs.data < rhs;
+}
+bool operator<(int lhs, const PrefixBucketNode & rhs) {
+  return lhs < rhs.data;
+}
+
+class PrefixBucketNodeTraits : public RBDefaultNodeTraits<PrefixBucketNode> {
+public:
+  static uint64_t get_key_prefix(const PrefixBucketNode & node) {
+    return static_cast<uint64_t>(node.data);
+  }
+  static uint64_t get_key_prefix(int key) {
+    return static_cast<uint64_t>(key);
+  }
+};
+
+TEST(RBTreeTest, PrefixBucketSerializationTest) {
+  using Tree = RBTree<PrefixBucketNode, PrefixBucketNodeTraits, PrefixBucketOptions>;
+  constexpr int KEYS = 20;
+
+  std::vector<PrefixBucketNode> nodes(RBTREE_TESTSIZE);
+  std::vector<PrefixBucketNode> restored_nodes(RBTREE_TESTSIZE);
+  Tree tree;
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i].data = i % KEYS;
+    nodes[i].sub_data = i;
+    restored_nodes[i] = nodes[i];
+    // Whatever was left in the node before
+    restored_nodes[i]._rbt_key_prefix = 1000;
+    tree.insert(nodes[i]);
+  }
+
+  std::stringstream buf;
+  tree.serialize_shape(buf, [](const PrefixBucketNode & n) { return n.sub_data; });
+  Tree restored;
+  ASSERT_TRUE(restored.deserialize_shape(buf, [&](uint64_t id) { return &restored_nodes[id]; }));
+
+  // Dropping the representatives turns bucket members into tree nodes, which must carry the
+  // right prefixes.
+  for (int round = 0 ; round < 3 ; ++round) {
+    for (int key = 0 ; key < KEYS ; ++key) {
+      restored.mark_for_removal(*restored.find(key));
+    }
+    restored.flush_removals(0.0);
+    ASSERT_TRUE(restored.verify_integrity());
+    for (int key = 0 ; key < KEYS ; ++key) {
+      auto it = restored.find(key);
+      ASSERT_NE(it, restored.end());
+      ASSERT_EQ(it->data, key);
+      ASSERT_EQ(restored.lower_bound(key)->data, key);
+    }
+  }
+}
+
+template<class Options>
+class OrderNode : public RBTreeNodeBase<OrderNode<Options>, Options> {
+public:
+  int data;
+
+  OrderNode() : data(0) {};
+  explicit OrderNode(int data_in) : data(data_in) {};
+
+  bool operator<(const OrderNode<Options> & other) const {
+    return this->data < other.data;
+  }
+};
+
+template<class Options>
+void
+check_order_queries()
+{
+  using ONode = OrderNode<Options>;
+  RBTree<ONode, RBDefaultNodeTraits<ONode>, Options> tree;
+  std::mt19937 rng(4);
+  std::vector<ONode> nodes(RBTREE_TESTSIZE);
+
+  auto check = [&]() {
+    ASSERT_TRUE(tree.verify_integrity());
+    std::vector<const ONode *> order;
+    for (const ONode & n : tree) {
+      order.push_back(&n);
+    }
+    for (size_t i = 0 ; i + 1 < order.size() ; ++i) {
+      ASSERT_TRUE(tree.is_before(*order[i], *order[i + 1]));
+      ASSERT_FALSE(tree.is_before(*order[i + 1], *order[i]));
+    }
+    std::uniform_int_distribution<size_t> pos(0, order.size() - 1);
+    for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+      size_t a = pos(rng);
+      size_t b = pos(rng);
+      ASSERT_EQ(tree.is_before(*order[a], *order[b]), a < b);
+    }
+  };
+
+  // Always inserting at the front of the same key exhausts the free labels quickly
+  for (int i = 0 ; i < RBTREE_TESTSIZE / 2 ; ++i) {
+    nodes[i] = ONode(5);
+    tree.insert(nodes[i]);
+  }
+  check();
+
+  std::uniform_int_distribution<int> key_dist(0, 9);
+  for (int i = RBTREE_TESTSIZE / 2 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = ONode(key_dist(rng));
+    if (i % 3 == 0) {
+      tree.insert_right_leaning(nodes[i]);
+    } else if (i % 3 == 1) {
+      tree.insert(nodes[i]);
+    } else {
+      auto lb = tree.lower_bound(nodes[i]);
+      tree.insert(nodes[i], lb);
+    }
+  }
+  check();
+
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; i += 2) {
+    tree.remove(nodes[i]);
+  }
+  check();
+
+  // Labels survive relocation and shape serialization
+  std::vector<ONode> arena(RBTREE_TESTSIZE / 2);
+  tree.defragment(arena.data());
+  check();
+
+  std::stringstream buf;
+  tree.serialize_shape(buf, [&](const ONode & n) { return &n - arena.data(); });
+  decltype(tree) restored;
+  ASSERT_TRUE(restored.deserialize_shape(buf, [&](uint64_t id) { return &arena[id]; }));
+  std::vector<const ONode *> order;
+  for (const ONode & n : restored) {
+    order.push_back(&n);
+  }
+  for (size_t i = 0 ; i + 1 < order.size() ; ++i) {
+    ASSERT_TRUE(restored.is_before(*order[i], *order[i + 1]));
+  }
+}
+
+TEST(RBTreeTest, OrderQueriesTest) {
+  check_order_queries<TreeOptions<TreeFlags::MULTIPLE, TreeFlags::ORDER_QUERIES>>();
+  check_order_queries<TreeOptions<TreeFlags::MULTIPLE, TreeFlags::ORDER_QUERIES,
+                                  TreeFlags::EQUALITY_BUCKETS>>();
+}
+
+class UniqueNode : public RBTreeNodeBase<UniqueNode,
+                                          TreeOptions<TreeFlags::CONSTANT_TIME_SIZE,
+                                                      TreeFlags::DEFERRED_REMOVAL>> {
+public:
+  int data;
+
+  UniqueNode() : data(0) {};
+  explicit UniqueNode(int data_in) : data(data_in) {};
+
+  bool operator<(const UniqueNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+bool operator<(const UniqueNode & lhs, int rhs) {
+  return lhs.data < rhs;
+}
+bool operator<(int lhs, const UniqueNode & rhs) {
+  return lhs < rhs.data;
+}
+
+TEST(RBTreeTest, UniqueInsertionTest) {
+  using UniqueTree = RBTree<UniqueNode, RBDefaultNodeTraits<UniqueNode>,
+                            TreeOptions<TreeFlags::CONSTANT_TIME_SIZE,
+                                        TreeFlags::DEFERRED_REMOVAL>>;
+  UniqueTree tree;
+
+  // The equal element is an ancestor, but not the parent of the insertion position
+  UniqueNode five(5);
+  UniqueNode three(3);
+  UniqueNode other_five(5);
+  tree.insert(five);
+  tree.insert(three);
+  tree.insert(other_five);
+  ASSERT_EQ(tree.size(), 2u);
+  tree.insert(other_five, tree.end());
+  tree.insert(other_five, five);
+  ASSERT_EQ(tree.size(), 2u);
+  ASSERT_TRUE(tree.verify_integrity());
+  tree.clear();
+
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE);
+  std::vector<UniqueNode> nodes(RBTREE_TESTSIZE);
+  std::set<int> reference;
+
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = UniqueNode(key_dist(rng));
+    auto result = tree.insert_unique(nodes[i]);
+    bool expected = reference.insert(nodes[i].data).second;
+    ASSERT_EQ(result.second, expected);
+    ASSERT_EQ(result.first->data, nodes[i].data);
+    if (expected) {
+      ASSERT_EQ(&(*result.first), &nodes[i]);
+    }
+    ASSERT_EQ(tree.size(), reference.size());
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+
+  // Only create nodes for absent keys
+  std::vector<UniqueNode> created;
+  created.reserve(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    int key = key_dist(rng);
+    auto commit_data = tree.insert_check(key);
+    if (reference.find(key) != reference.end()) {
+      ASSERT_NE(commit_data.existing, nullptr);
+      ASSERT_EQ(commit_data.existing->data, key);
+      continue;
+    }
+    ASSERT_EQ(commit_data.existing, nullptr);
+
+    created.emplace_back(key);
+    auto it = tree.insert_commit(created.back(), commit_data);
+    ASSERT_EQ(&(*it), &created.back());
+    reference.insert(key);
+    ASSERT_EQ(tree.size(), reference.size());
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+
+  // Hinted insertions must reject duplicates no matter how far away the hint is
+  std::vector<UniqueNode> hinted;
+  hinted.reserve(RBTREE_TESTSIZE);
+  std::uniform_int_distribution<size_t> created_dist(0, created.size() - 1);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    int key = key_dist(rng);
+    hinted.emplace_back(key);
+    if ((i % 2 == 0) && (tree.lower_bound(key) != tree.end())) {
+      tree.insert(hinted.back(), tree.lower_bound(key));
+    } else {
+      tree.insert(hinted.back(), created[created_dist(rng)]);
+    }
+    reference.insert(key);
+    ASSERT_EQ(tree.size(), reference.size());
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+
+  auto it = tree.begin();
+  for (int key : reference) {
+    ASSERT_EQ(it->data, key);
+    ++it;
+  }
+  ASSERT_EQ(it, tree.end());
+}
+
+template<class Tree, class NodeT>
+void
+check_reposition(bool unique)
+{
+  Tree tree;
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, 10 * RBTREE_TESTSIZE);
+  std::uniform_int_distribution<int> delta_dist(-20, 20);
+  std::vector<NodeT> nodes(RBTREE_TESTSIZE);
+  std::vector<bool> in_tree(RBTREE_TESTSIZE, false);
+
+  std::set<int> seen;
+  size_t size = 0;
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i].data = key_dist(rng) / (unique ? 1 : 50);
+    if (!unique || seen.insert(nodes[i].data).second) {
+      tree.insert(nodes[i]);
+      in_tree[static_cast<size_t>(i)] = true;
+      size++;
+    }
+  }
+
+  for (int round = 0 ; round < 4 * RBTREE_TESTSIZE ; ++round) {
+    size_t i = static_cast<size_t>(round % RBTREE_TESTSIZE);
+    if (!in_tree[i]) {
+      continue;
+    }
+    // Mostly small changes, sometimes large ones
+    if (round % 10 == 0) {
+      nodes[i].data = key_dist(rng) / (unique ? 1 : 50);
+    } else {
+      nodes[i].data += delta_dist(rng);
+    }
+
+    bool kept = tree.reposition(nodes[i]);
+    if (!kept) {
+      ASSERT_TRUE(unique);
+      in_tree[i] = false;
+      size--;
+    }
+    ASSERT_EQ(tree.size(), size);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+
+  size_t count = 0;
+  const NodeT * last = nullptr;
+  for (const NodeT & n : tree) {
+    if (last != nullptr) {
+      ASSERT_LE(last->data, n.data);
+    }
+    last = &n;
+    count++;
+  }
+  ASSERT_EQ(count, size);
+
+  // Replace every other node by an equal copy
+  std::vector<NodeT> copies(RBTREE_TESTSIZE);
+  for (size_t i = 0 ; i < nodes.size() ; i += 2) {
+    if (in_tree[i]) {
+      copies[i].data = nodes[i].data;
+      tree.replace_node(nodes[i], copies[i]);
+    }
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  for (size_t i = 0 ; i < nodes.size() ; i += 2) {
+    if (in_tree[i]) {
+      ASSERT_EQ(&(*tree.iterator_to(copies[i])), &copies[i]);
+    }
+  }
+}
+
+class RepositionNode : public RBTreeNodeBase<RepositionNode,
+                                             TreeOptions<TreeFlags::MULTIPLE,
+                                                         TreeFlags::CONSTANT_TIME_SIZE,
+                                                         TreeFlags::DEFERRED_REMOVAL>> {
+public:
+  int data = 0;
+
+  bool operator<(const RepositionNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+TEST(RBTreeTest, RepositionTest) {
+  check_reposition<RBTree<RepositionNode, RBDefaultNodeTraits<RepositionNode>,
+                          TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                      TreeFlags::DEFERRED_REMOVAL>>,
+                   RepositionNode>(false);
+  check_reposition<BucketTree, BucketNode>(false);
+  check_reposition<RBTree<UniqueNode, RBDefaultNodeTraits<UniqueNode>,
+                          TreeOptions<TreeFlags::CONSTANT_TIME_SIZE, TreeFlags::DEFERRED_REMOVAL>>,
+                   UniqueNode>(true);
+}
+
+template<class Tree, class NodeT>
+void
+check_deferred_removal(double rebuild_fraction)
+{
+  Tree tree;
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE / 4);
+  std::vector<NodeT> nodes(RBTREE_TESTSIZE);
+  std::vector<bool> in_tree(RBTREE_TESTSIZE, true);
+  std::multiset<int> expected;
+
+  for (auto & n : nodes) {
+    n.data = key_dist(rng);
+    tree.insert(n);
+    expected.insert(n.data);
+  }
+
+  for (int round = 0 ; round < 3 ; ++round) {
+    // Remove about 40% of the remaining nodes, marking some twice
+    std::uniform_int_distribution<int> coin(0, 9);
+    size_t marked = 0;
+    for (size_t i = 0 ; i < nodes.size() ; ++i) {
+      if (in_tree[i] && (coin(rng) < 4)) {
+        tree.mark_for_removal(nodes[i]);
+        tree.mark_for_removal(nodes[i]);
+        expected.erase(expected.find(nodes[i].data));
+        in_tree[i] = false;
+        marked++;
+      }
+    }
+
+    // Marked nodes stay in the tree until the flush
+    ASSERT_EQ(tree.size(), expected.size() + marked);
+    ASSERT_EQ(tree.flush_removals(rebuild_fraction), marked);
+    ASSERT_EQ(tree.flush_removals(rebuild_fraction), 0u);
+
+    ASSERT_TRUE(tree.verify_integrity());
+    ASSERT_EQ(tree.size(), expected.size());
+    auto exp_it = expected.begin();
+    for (const auto & n : tree) {
+      ASSERT_EQ(n.data, *exp_it);
+      ++exp_it;
+    }
+  }
+}
+
+TEST(RBTreeTest, DeferredRemovalTest) {
+  using MultiTree = RBTree<RepositionNode, RBDefaultNodeTraits<RepositionNode>,
+                           TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                       TreeFlags::DEFERRED_REMOVAL>>;
+  // Always remove one by one / always rebuild
+  check_deferred_removal<MultiTree, RepositionNode>(2.0);
+  check_deferred_removal<MultiTree, RepositionNode>(0.0);
+  check_deferred_removal<BucketTree, BucketNode>(2.0);
+  check_deferred_removal<BucketTree, BucketNode>(0.0);
+}
+
+class CachedFindNode;
+using CachedFindOptions = TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                      TreeFlags::FIND_CACHE<16>>;
+
+class CachedFindNode : public RBTreeNodeBase<CachedFindNode, CachedFindOptions> {
+public:
+  int data = 0;
+
+  bool operator<(const CachedFindNode & other) const {
+    return this->data < other.data;
+  }
+};
+
+bool operator<(const CachedFindNode & lhs, int rhs) {
+  return lhs.data < rhs;
+}
+bool operator<(int lhs, const CachedFindNode & rhs) {
+  return lhs < rhs.data;
+}
+
+class CachedFindNodeTraits : public RBDefaultNodeTraits<CachedFindNode> {
+public:
+  static size_t get_key_hash(int key) {
+    return static_cast<size_t>(key);
+  }
+};
+
+TEST(RBTreeTest, FindCacheTest) {
+  RBTree<CachedFindNode, CachedFindNodeTraits, CachedFindOptions> tree;
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE / 2);
+  std::vector<CachedFindNode> nodes(RBTREE_TESTSIZE);
+  std::vector<bool> in_tree(RBTREE_TESTSIZE, true);
+
+  for (auto & n : nodes) {
+    n.data = key_dist(rng);
+    tree.insert(n);
+  }
+
+  // The cache must never return anything but the first equal element
+  auto check_find = [&](int key) {
+    auto it = tree.find(key);
+    auto lb = tree.lower_bound(key);
+    if ((lb == tree.end()) || (lb->data != key)) {
+      ASSERT_EQ(it, tree.end());
+    } else {
+      ASSERT_EQ(&(*it), &(*lb));
+    }
+  };
+
+  // A few hot keys, some of which collide in the cache
+  std::vector<int> hot_keys;
+  for (int i = 0 ; i < 8 ; ++i) {
+    hot_keys.push_back(nodes[static_cast<size_t>(i)].data);
+  }
+  hot_keys.push_back(hot_keys[0] + 16);
+  hot_keys.push_back(-1);
+
+  for (int round = 0 ; round < 100 ; ++round) {
+    for (int key : hot_keys) {
+      check_find(key);
+      check_find(key);
+    }
+  }
+  ASSERT_GT(tree.get_find_cache_statistics().hit_rate(), 0.5);
+
+  // Modifications in between
+  std::uniform_int_distribution<size_t> index_dist(0, RBTREE_TESTSIZE - 1);
+  for (int round = 0 ; round < RBTREE_TESTSIZE ; ++round) {
+    size_t i = index_dist(rng);
+    if (in_tree[i]) {
+      tree.remove(nodes[i]);
+    } else {
+      tree.insert(nodes[i]);
+    }
+    in_tree[i] = !in_tree[i];
+
+    for (int key : hot_keys) {
+      check_find(key);
+      check_find(key);
+    }
+    check_find(nodes[i].data);
+  }
+
+  FindCacheStatistics stats = tree.reset_find_cache_statistics();
+  ASSERT_GT(stats.hits, 0u);
+  ASSERT_GT(stats.misses, 0u);
+  ASSERT_EQ(tree.get_find_cache_statistics().hits, 0u);
+
+  // The const find() neither reads nor writes the cache
+  const auto & const_tree = tree;
+  for (int key : hot_keys) {
+    auto it = const_tree.find(key);
+    auto lb = const_tree.lower_bound(key);
+    if ((lb == const_tree.end()) || (lb->data != key)) {
+      ASSERT_EQ(it, const_tree.end());
+    } else {
+      ASSERT_EQ(&(*it), &(*lb));
+    }
+  }
+  ASSERT_EQ(tree.get_find_cache_statistics().hits, 0u);
+  ASSERT_EQ(tree.get_find_cache_statistics().misses, 0u);
+}
+
+template<class Tree, class NodeT>
+size_t
+node_depth(const Tree & tree, NodeT * node)
+{
+  (void)tree;
+  size_t depth = 0;
+  while (Tree::get_parent(node) != nullptr) {
+    node = Tree::get_parent(node);
+    depth++;
+  }
+  return depth;
+}
+
+template<class Tree, class NodeT>
+size_t
+subtree_height(NodeT * node)
+{
+  if (node == nullptr) {
+    return 0;
+  }
+  return 1 + std::max(subtree_height<Tree>(Tree::get_left_child(node)),
+                      subtree_height<Tree>(Tree::get_right_child(node)));
+}
+
+template<class Tree, class NodeT>
+void
+check_optimize(bool buckets)
+{
+  Tree tree;
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE * (buckets ? 1 : 10));
+  std::vector<NodeT> nodes(RBTREE_TESTSIZE);
+  for (auto & n : nodes) {
+    n.data = key_dist(rng);
+    tree.insert(n);
+  }
+
+  std::vector<const NodeT *> order;
+  for (const auto & n : tree) {
+    order.push_back(&n);
+  }
+  auto check_order = [&]() {
+    size_t i = 0;
+    for (const auto & n : tree) {
+      ASSERT_EQ(&n, order[i]);
+      i++;
+    }
+    ASSERT_EQ(i, order.size());
+  };
+
+  size_t tree_nodes = 0;
+  for (const auto & n : tree) {
+    if (n._rbt_left != &n) {
+      tree_nodes++;
+    }
+  }
+  size_t min_height = 0;
+  while (((static_cast<size_t>(1) << min_height) - 1) < tree_nodes) {
+    min_height++;
+  }
+
+  tree.optimize();
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_EQ(subtree_height<Tree>(tree.get_root()), min_height);
+  check_order();
+
+  // Few heavy nodes
+  std::vector<int> weights(RBTREE_TESTSIZE, 1);
+  std::uniform_int_distribution<size_t> index_dist(0, RBTREE_TESTSIZE - 1);
+  for (int i = 0 ; i < 20 ; ++i) {
+    size_t index = index_dist(rng);
+    if (nodes[index]._rbt_left != &nodes[index]) {
+      weights[index] = 1000 + i;
+    }
+  }
+  auto weight = [&](const NodeT & n) { return weights[static_cast<size_t>(&n - &nodes[0])]; };
+
+  size_t depth_before = 0;
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    if (weights[i] > 1) {
+      depth_before += node_depth(tree, &nodes[i]);
+    }
+  }
+
+  tree.optimize(weight);
+  ASSERT_TRUE(tree.verify_integrity());
+  check_order();
+
+  size_t depth_after = 0;
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    if (weights[i] > 1) {
+      depth_after += node_depth(tree, &nodes[i]);
+    }
+  }
+  ASSERT_LT(depth_after, depth_before);
+
+  // Pending removals survive
+  for (size_t i = 0 ; i < nodes.size() ; i += 3) {
+    tree.mark_for_removal(nodes[i]);
+  }
+  tree.optimize();
+  ASSERT_TRUE(tree.verify_integrity());
+  check_order();
+  tree.flush_removals();
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_EQ(tree.size(), nodes.size() - (nodes.size() + 2) / 3);
+}
+
+TEST(RBTreeTest, OptimizeTest) {
+  using MultiTree = RBTree<RepositionNode, RBDefaultNodeTraits<RepositionNode>,
+                           TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                       TreeFlags::DEFERRED_REMOVAL>>;
+  check_optimize<MultiTree, RepositionNode>(false);
+  check_optimize<BucketTree, BucketNode>(true);
+
+  // The single heaviest node in the middle becomes the root
+  MultiTree tree;
+  std::vector<RepositionNode> nodes(RBTREE_TESTSIZE);
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    nodes[i].data = static_cast<int>(i);
+    tree.insert(nodes[i]);
+  }
+  RepositionNode * hot = &nodes[RBTREE_TESTSIZE / 3];
+  tree.optimize([&](const RepositionNode & n) { return (&n == hot) ? 2 : 1; });
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_EQ(tree.get_root(), hot);
+
+  // Trivial trees
+  MultiTree empty;
+  empty.optimize();
+  empty.optimize([](const RepositionNode &) { return 1; });
+  ASSERT_EQ(empty.get_root(), nullptr);
+  for (size_t n = 1 ; n < 40 ; ++n) {
+    MultiTree small;
+    for (size_t i = 0 ; i < n ; ++i) {
+      small.insert(nodes[i]);
+    }
+    small.optimize();
+    ASSERT_TRUE(small.verify_integrity());
+    small.optimize([&](const RepositionNode & node) { return node.data % 7; });
+    ASSERT_TRUE(small.verify_integrity());
+    ASSERT_EQ(small.size(), n);
+  }
+}
+
+template<class Options>
+void
+check_top_down()
+{
+  using ONode = OrderNode<Options>;
+  RBTree<ONode, RBDefaultNodeTraits<ONode>, Options> tree;
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE / 4);
+  std::vector<ONode> nodes(RBTREE_TESTSIZE);
+
+  // Expected order: insert() puts a node before its equals, insert_right_leaning() after them
+  std::map<int, std::deque<const ONode *>> expected;
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = ONode(key_dist(rng));
+    std::deque<const ONode *> & equal = expected[nodes[i].data];
+    bool present = !equal.empty();
+    if (i % 2 == 0) {
+      tree.insert(nodes[i]);
+      if (Options::multiple || !present) {
+        equal.push_front(&nodes[i]);
+      }
+    } else {
+      tree.insert_right_leaning(nodes[i]);
+      if (Options::multiple || !present) {
+        equal.push_back(&nodes[i]);
+      }
+    }
+    ASSERT_TRUE(tree.verify_integrity());
+  }
+
+  auto it = tree.begin();
+  for (const auto & entry : expected) {
+    for (const ONode * n : entry.second) {
+      ASSERT_NE(it, tree.end());
+      ASSERT_EQ(&(*it), n);
+      ++it;
+    }
+  }
+  ASSERT_EQ(it, tree.end());
+
+  // Hinted insertion and deletion stay bottom-up and still work
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; i += 3) {
+    if (tree.find(nodes[i]) != tree.end()) {
+      tree.remove(nodes[i]);
+      auto hint = tree.lower_bound(nodes[i]);
+      tree.insert(nodes[i], hint);
+    }
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; i += 2) {
+    if (tree.find(nodes[i]) != tree.end()) {
+      tree.remove(nodes[i]);
+    }
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+}
+
+using TopDownThreeWayOptions = TreeOptions<TreeFlags::TOP_DOWN, TreeFlags::STATISTICS,
+                                           TreeFlags::CONSTANT_TIME_SIZE>;
+
+class TopDownThreeWayCompare {
+public:
+  using TDNode = OrderNode<TopDownThreeWayOptions>;
+
+  int operator()(const TDNode & lhs, const TDNode & rhs) const {
+    return (lhs.data < rhs.data) ? -1 : ((lhs.data == rhs.data) ? 0 : 1);
+  }
+  int operator()(const TDNode & lhs, int rhs) const {
+    return (lhs.data < rhs) ? -1 : ((lhs.data == rhs) ? 0 : 1);
+  }
+};
+
+TEST(RBTreeTest, TopDownInsertionTest) {
+  check_top_down<TreeOptions<TreeFlags::TOP_DOWN>>();
+  check_top_down<TreeOptions<TreeFlags::MULTIPLE, TreeFlags::TOP_DOWN>>();
+  check_top_down<TreeOptions<TreeFlags::MULTIPLE, TreeFlags::EQUALITY_BUCKETS,
+                             TreeFlags::TOP_DOWN>>();
+  check_top_down<TreeOptions<TreeFlags::MULTIPLE, TreeFlags::ORDER_QUERIES,
+                             TreeFlags::TOP_DOWN>>();
+
+  // With three-way comparisons
+  using TDNode = OrderNode<TopDownThreeWayOptions>;
+  auto tree = RBTree<TDNode, RBDefaultNodeTraits<TDNode>, TopDownThreeWayOptions, int,
+                     TopDownThreeWayCompare>();
+  std::mt19937 rng(4);
+  std::vector<TDNode> nodes(RBTREE_TESTSIZE);
+  std::vector<TDNode> duplicates(RBTREE_TESTSIZE);
+  for (int i = 0 ; i < RBTREE_TESTSIZE ; ++i) {
+    nodes[i] = TDNode(i);
+    duplicates[i] = TDNode(i);
+  }
+  std::shuffle(nodes.begin(), nodes.end(), rng);
+  for (auto & n : nodes) {
+    tree.insert(n);
+    tree.insert(duplicates[static_cast<size_t>(n.data)]);
+  }
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_EQ(tree.size(), static_cast<size_t>(RBTREE_TESTSIZE));
+  for (auto & n : nodes) {
+    ASSERT_EQ(&(*tree.find(n.data)), &n);
+  }
+  ASSERT_GT(tree.get_statistics().insert_fixup_iterations, 0u);
+}
+
+template<class Tree, class NodeT>
+void
+check_merge(bool unique)
+{
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE / 2);
+  std::vector<NodeT> nodes(RBTREE_TESTSIZE);
+
+  Tree tree;
+  Tree other;
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    nodes[i].data = key_dist(rng);
+    if (i % 2 == 0) {
+      tree.insert(nodes[i]);
+    } else {
+      other.insert(nodes[i]);
+    }
+  }
+  std::vector<const NodeT *> mine;
+  for (const NodeT & n : tree) {
+    mine.push_back(&n);
+  }
+  std::vector<const NodeT *> theirs;
+  for (const NodeT & n : other) {
+    theirs.push_back(&n);
+  }
+
+  // Pending removals must survive the merge
+  std::set<const NodeT *> marked;
+  for (size_t i = 0 ; i < mine.size() ; i += 7) {
+    tree.mark_for_removal(*const_cast<NodeT *>(mine[i]));
+    marked.insert(mine[i]);
+  }
+  for (size_t i = 0 ; i < theirs.size() ; i += 5) {
+    other.mark_for_removal(*const_cast<NodeT *>(theirs[i]));
+    marked.insert(theirs[i]);
+  }
+
+  auto less = [](const NodeT * lhs, const NodeT * rhs) { return lhs->data < rhs->data; };
+  std::vector<const NodeT *> expected;
+  std::vector<const NodeT *> expected_kept;
+  if (unique) {
+    std::set_union(mine.begin(), mine.end(), theirs.begin(), theirs.end(),
+                   std::back_inserter(expected), less);
+    std::set_intersection(theirs.begin(), theirs.end(), mine.begin(), mine.end(),
+                          std::back_inserter(expected_kept), less);
+  } else {
+    // std::merge puts equal elements of the first range first
+    std::merge(mine.begin(), mine.end(), theirs.begin(), theirs.end(),
+               std::back_inserter(expected), less);
+  }
+
+  tree.merge(other);
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_TRUE(other.verify_integrity());
+  ASSERT_EQ(tree.size(), expected.size());
+  ASSERT_EQ(other.size(), expected_kept.size());
+
+  std::vector<const NodeT *> merged;
+  for (const NodeT & n : tree) {
+    merged.push_back(&n);
+  }
+  ASSERT_EQ(merged, expected);
+  std::vector<const NodeT *> kept;
+  for (const NodeT & n : other) {
+    kept.push_back(&n);
+  }
+  ASSERT_EQ(kept, expected_kept);
+
+  tree.flush_removals();
+  other.flush_removals();
+  ASSERT_TRUE(tree.verify_integrity());
+  ASSERT_TRUE(other.verify_integrity());
+  size_t remaining = 0;
+  for (const NodeT * n : expected) {
+    remaining += (marked.find(n) == marked.end()) ? 1 : 0;
+  }
+  ASSERT_EQ(tree.size(), remaining);
+  for (const NodeT & n : tree) {
+    ASSERT_EQ(marked.find(&n), marked.end());
+  }
+  for (const NodeT & n : other) {
+    ASSERT_EQ(marked.find(&n), marked.end());
+  }
+
+  // Merging into an empty tree and merging an empty tree
+  Tree empty;
+  size_t size = tree.size();
+  tree.merge(empty);
+  ASSERT_EQ(tree.size(), size);
+  empty.merge(tree);
+  ASSERT_EQ(empty.size(), size);
+  ASSERT_EQ(tree.size(), 0u);
+  ASSERT_TRUE(empty.verify_integrity());
+  ASSERT_TRUE(tree.verify_integrity());
+}
+
+TEST(RBTreeTest, MergeTest) {
+  check_merge<RBTree<RepositionNode, RBDefaultNodeTraits<RepositionNode>,
+                     TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                                 TreeFlags::DEFERRED_REMOVAL>>,
+              RepositionNode>(false);
+  check_merge<BucketTree, BucketNode>(false);
+  check_merge<RBTree<UniqueNode, RBDefaultNodeTraits<UniqueNode>,
+                     TreeOptions<TreeFlags::CONSTANT_TIME_SIZE, TreeFlags::DEFERRED_REMOVAL>>,
+              UniqueNode>(true);
+}
+
+template<size_t lookahead, class Tree>
+void
+check_scan(const Tree & tree)
+{
+  auto it = tree.begin();
+  for (auto scan = tree.template scan_begin<lookahead>() ;
+       scan != tree.template scan_end<lookahead>() ; ++scan) {
+    ASSERT_NE(it, tree.end());
+    ASSERT_EQ(&(*scan), &(*it));
+    ++it;
+  }
+  ASSERT_EQ(it, tree.end());
+
+  // Starting in the middle
+  it = tree.begin();
+  for (size_t i = 0 ; (i < 100) && (it != tree.end()) ; ++i) {
+    ++it;
+  }
+  auto scan = tree.template scan_begin<lookahead>(it);
+  for (; it != tree.end() ; ++it, scan++) {
+    ASSERT_EQ(&(*scan), &(*it));
+  }
+  ASSERT_EQ(scan, tree.template scan_end<lookahead>());
+}
+
+TEST(RBTreeTest, ScanIteratorTest) {
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> key_dist(0, RBTREE_TESTSIZE / 4);
+
+  RBTree<RepositionNode, RBDefaultNodeTraits<RepositionNode>,
+         TreeOptions<TreeFlags::MULTIPLE, TreeFlags::CONSTANT_TIME_SIZE,
+                     TreeFlags::DEFERRED_REMOVAL>> tree;
+  BucketTree bucket_tree;
+  std::vector<RepositionNode> nodes(RBTREE_TESTSIZE);
+  std::vector<BucketNode> bucket_nodes(RBTREE_TESTSIZE);
+
+  check_scan<8>(tree);
+  check_scan<8>(bucket_tree);
+
+  for (size_t i = 0 ; i < nodes.size() ; ++i) {
+    nodes[i].data = key_dist(rng);
+    tree.insert(nodes[i]);
+    bucket_nodes[i] = BucketNode(nodes[i].data, static_cast<int>(i));
+    bucket_tree.insert(bucket_nodes[i]);
+  }
+
+  check_scan<1>(tree);
+  check_scan<8>(tree);
+  check_scan<1>(bucket_tree);
+  check_scan<8>(bucket_tree);
+  check_scan<3>(bucket_tree);
+
+  // A range scan from lower_bound()
+  RepositionNode probe;
+  probe.data = RBTREE_TESTSIZE / 8;
+  int last = probe.data;
+  for (auto scan = tree.scan_begin(tree.lower_bound(probe)) ; scan != tree.scan_end() ; ++scan) {
+    ASSERT_LE(last, scan->data);
+    last = scan->data;
+  }
+}
+
 // TODO test equal elements
 
 #endif // TEST_RBTREE_HPP